@@ -0,0 +1,733 @@
+// Parameter sweep over the forward_and_gradient engines. Every combination
+// of the lists below is timed with std::chrono::steady_clock and reported
+// as one CSV line or JSON object:
+//
+//   bench_exec [--rows 200000,...] [--columns 32,256,...]
+//              [--dtypes f32,f64,bf16,f16,i8] [--threads 1,4,...]
+//              [--block-rows 0,256,...] [--partitioners static,affinity,auto]
+//              [--kernels noopt,mkl,fused,tiled,sparse,stream,multi,softmax]
+//              [--outputs 8] [--stream-file path] [--runs 20] [--warmup 3]
+//              [--format csv|json] [--output path]
+//
+// --block-rows 0 keeps the library default (L2-sized blocks, autotuned
+// unless COMP_OPT_AUTOTUNE=0); other values fix the block size and the
+// partitioner. Compressed dtypes (bf16, f16, i8) are read by the fused
+// kernel only, other kernels skip them.
+//
+// The other engines:
+//   sparse   logreg_sparse on a CSR copy of the (dense) features; blocks are
+//            nnz-balanced, so rows_in_block is reported as 0;
+//   stream   logreg_stream with the fused kernel, reading the problem back
+//            from --stream-file in chunks, labels included. The file was
+//            just written, so this usually measures the chunk pipeline over
+//            the page cache rather than the disk;
+//   multi    logreg_multi, --outputs models sharing the labels;
+//   softmax  logreg_softmax, --outputs classes.
+// multi and softmax keep their L2-sized blocks and only take the
+// partitioner.
+//
+// Effective GB/s counts one read of the features and labels per pass (CSR
+// values and column indices for sparse) and GFLOP/s 4 * rows * columns
+// (dot product and gradient update), times --outputs for multi and
+// softmax. The roof is
+// the read bandwidth of a STREAM-style sum over a buffer much larger than
+// L3 with the same thread count; triad bandwidth is reported next to it.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <mkl.h>
+#include <tbb/tbb.h>
+
+#include "data_gen.hpp"
+#include "dispatch.hpp"
+#include "format.hpp"
+#include "logreg.hpp"
+#include "logreg_fused.hpp"
+#include "logreg_multi.hpp"
+#include "logreg_softmax.hpp"
+#include "logreg_sparse.hpp"
+#include "precision.hpp"
+#include "simd.hpp"
+#include "sparse.hpp"
+#include "streaming.hpp"
+#include "structures.hpp"
+#include "tuning.hpp"
+#include "workspace.hpp"
+
+namespace {
+
+struct Options {
+  std::vector<size_t> rows{200000};
+  std::vector<size_t> columns{32, 256};
+  std::vector<std::string> dtypes{"f32"};
+  std::vector<size_t> threads{};
+  std::vector<size_t> block_rows{0};
+  std::vector<std::string> partitioners{"static"};
+  std::vector<std::string> kernels{"noopt",  "mkl",    "fused", "tiled",
+                                   "sparse", "stream", "multi", "softmax"};
+  size_t outputs = 8;
+  std::string stream_file = "bench_stream.dat";
+  size_t runs = 20;
+  size_t warmup = 3;
+  std::string format = "csv";
+  std::string output{};
+};
+
+struct Roof {
+  size_t threads;
+  double read_gbs;
+  double triad_gbs;
+};
+
+struct Result {
+  std::string kernel;
+  std::string dtype;
+  size_t rows;
+  size_t columns;
+  size_t threads;
+  size_t rows_in_block;
+  std::string partitioner;
+  size_t runs;
+  double median;
+  double p95;
+  double min;
+  double mean;
+  double gbs;
+  double gflops;
+  double roof_gbs;
+};
+
+std::vector<std::string> split(const std::string &text) {
+  std::vector<std::string> items;
+  std::stringstream stream(text);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+std::vector<size_t> split_numbers(const std::string &text) {
+  std::vector<size_t> numbers;
+  for (const auto &item : split(text)) {
+    numbers.push_back(std::strtoull(item.c_str(), nullptr, 10));
+  }
+  return numbers;
+}
+
+bool parse(int argc, char **argv, Options &options) {
+  for (int index = 1; index + 1 < argc; index += 2) {
+    const std::string name = argv[index];
+    const std::string value = argv[index + 1];
+    if (name == "--rows") {
+      options.rows = split_numbers(value);
+    } else if (name == "--columns") {
+      options.columns = split_numbers(value);
+    } else if (name == "--dtypes") {
+      options.dtypes = split(value);
+    } else if (name == "--threads") {
+      options.threads = split_numbers(value);
+    } else if (name == "--block-rows") {
+      options.block_rows = split_numbers(value);
+    } else if (name == "--partitioners") {
+      options.partitioners = split(value);
+    } else if (name == "--kernels") {
+      options.kernels = split(value);
+    } else if (name == "--outputs") {
+      options.outputs = std::max<size_t>(
+          2, std::strtoull(value.c_str(), nullptr, 10));
+    } else if (name == "--stream-file") {
+      options.stream_file = value;
+    } else if (name == "--runs") {
+      options.runs = std::max<size_t>(1, std::strtoull(value.c_str(), nullptr,
+                                                       10));
+    } else if (name == "--warmup") {
+      options.warmup = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (name == "--format") {
+      options.format = value;
+    } else if (name == "--output") {
+      options.output = value;
+    } else {
+      std::cerr << "Unknown option " << name << std::endl;
+      return false;
+    }
+  }
+  if (argc % 2 == 0) {
+    std::cerr << "Missing value of " << argv[argc - 1] << std::endl;
+    return false;
+  }
+  if (options.threads.empty()) {
+    options.threads.push_back(tbb::this_task_arena::max_concurrency());
+  }
+  return true;
+}
+
+bool partitioner_from_name(const std::string &name,
+                           tuning::Partitioner &partitioner) {
+  for (const auto candidate : {tuning::Partitioner::static_partitioner,
+                               tuning::Partitioner::affinity,
+                               tuning::Partitioner::automatic}) {
+    if (name == tuning::partitioner_name(candidate)) {
+      partitioner = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Features, labels and an initial model generated in memory with the
+// generator of generate_data.
+template <typename FPType> struct Problem {
+  Meta meta;
+  std::vector<FPType> data;
+  std::vector<float> labels;
+  std::vector<FPType> weights;
+  FPType beta = 0;
+};
+
+template <typename FPType> Problem<FPType> make_problem(const Meta &meta) {
+  const GenerationOptions generation;
+  Problem<FPType> problem;
+  problem.meta = meta;
+  problem.data.resize(meta.rows_count * meta.columns_count);
+  problem.labels.resize(meta.rows_count);
+  std::vector<FPType> true_weights;
+  FPType true_beta = 0;
+  data_gen::true_model(meta, generation.seed, true_weights, true_beta);
+  const size_t rows_in_block = std::max<size_t>(
+      1, data_gen::block_bytes / (meta.columns_count * sizeof(FPType)));
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, meta.rows_count, rows_in_block),
+      [&](tbb::blocked_range<size_t> r) {
+        data_gen::generate_rows<FPType>(meta, generation, true_weights,
+                                        true_beta, r.begin(), r.size(),
+                                        problem.data.data(),
+                                        problem.labels.data());
+      });
+  problem.weights.resize(meta.columns_count);
+  rng::fill_uniform<FPType>(problem.weights.data(), meta.columns_count,
+                            generation.seed, data_gen::initial_stream, 0, -1,
+                            1);
+  return problem;
+}
+
+// Seconds of every timed run, after `warmup` untimed ones.
+template <typename Body>
+std::vector<double> time_runs(const Options &options, const Body &body) {
+  for (size_t index = 0; index < options.warmup; ++index) {
+    body();
+  }
+  std::vector<double> times;
+  times.reserve(options.runs);
+  for (size_t index = 0; index < options.runs; ++index) {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    const std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+    times.push_back(time.count());
+  }
+  return times;
+}
+
+// Nearest-rank percentile of sorted values.
+double percentile(const std::vector<double> &sorted, const double fraction) {
+  const size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+  return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// Best of 5 passes over 8x L3 (at least 256 MB) with `threads` threads.
+Roof measure_roof(const size_t threads) {
+  const size_t bytes =
+      std::max<size_t>(8 * tuning::cache_info().l3, 256 << 20);
+  const size_t count = bytes / sizeof(double) / 3;
+  std::vector<double> a(count, 1), b(count, 2), c(count, 0);
+  Roof roof{threads, 0, 0};
+  tbb::task_arena arena(threads);
+  arena.execute([&] {
+    for (int repeat = 0; repeat < 5; ++repeat) {
+      auto start = std::chrono::steady_clock::now();
+      const double sum = tbb::parallel_reduce(
+          tbb::blocked_range<size_t>(0, count), 0.,
+          [&](const tbb::blocked_range<size_t> &r, double acc) {
+            // Independent partial sums, so the adds do not limit the loads.
+            double partial[8] = {};
+            size_t index = r.begin();
+            for (; index + 8 <= r.end(); index += 8) {
+              for (size_t lane = 0; lane < 8; ++lane) {
+                partial[lane] += a[index + lane];
+              }
+            }
+            for (; index < r.end(); ++index) {
+              acc += a[index];
+            }
+            for (const double value : partial) {
+              acc += value;
+            }
+            return acc;
+          },
+          std::plus<double>(), tbb::static_partitioner());
+      std::chrono::duration<double> time =
+          std::chrono::steady_clock::now() - start;
+      if (sum > 0) {
+        roof.read_gbs = std::max(roof.read_gbs,
+                                 count * sizeof(double) / time.count() / 1e9);
+      }
+
+      start = std::chrono::steady_clock::now();
+      tbb::parallel_for(
+          tbb::blocked_range<size_t>(0, count),
+          [&](const tbb::blocked_range<size_t> &r) {
+            for (size_t index = r.begin(); index < r.end(); ++index) {
+              c[index] = a[index] + 3 * b[index];
+            }
+          },
+          tbb::static_partitioner());
+      time = std::chrono::steady_clock::now() - start;
+      roof.triad_gbs = std::max(
+          roof.triad_gbs, 3 * count * sizeof(double) / time.count() / 1e9);
+    }
+  });
+  return roof;
+}
+
+// Fixes the block size and partitioner of a workspace, or keeps the library
+// default when block_rows is 0.
+template <typename FPType>
+void configure(LogRegWorkspace<FPType> &workspace, const size_t block_rows,
+               const tuning::Partitioner partitioner) {
+  if (block_rows) {
+    workspace.configure(tuning::Config{block_rows, partitioner});
+  }
+}
+
+class Runner {
+public:
+  Runner(const Options &options, std::vector<Roof> roofs)
+      : options(options), roofs(std::move(roofs)) {}
+
+  template <typename FPType>
+  void run_float(const Problem<FPType> &problem, const std::string &dtype) {
+    // Written once per problem, read by every "stream" run.
+    stream_ready = false;
+    if (has_kernel("stream")) {
+      const format::Status status = format::write<FPType>(
+          options.stream_file.c_str(),
+          DataView<FPType>{problem.data.data(), problem.meta},
+          problem.labels.data());
+      stream_ready = status == format::Status::ok;
+      if (!stream_ready) {
+        std::cerr << "Can't write " << options.stream_file << ": "
+                  << format::status_name(status) << std::endl;
+      }
+    }
+    for (const size_t threads : options.threads) {
+      tbb::task_arena arena(threads);
+      arena.execute([&] {
+        for_each_config([&](const size_t block_rows,
+                            const tuning::Partitioner partitioner) {
+          for (const auto &kernel : options.kernels) {
+            run_kernel(problem, dtype, kernel, threads, block_rows,
+                       partitioner);
+          }
+        });
+      });
+    }
+    if (stream_ready) {
+      std::remove(options.stream_file.c_str());
+    }
+  }
+
+  // Compressed copy of a float problem, fused kernel only.
+  template <typename Storage>
+  void run_quantized(const Problem<float> &problem, const std::string &dtype) {
+    if (!has_kernel("fused")) {
+      return;
+    }
+    const auto quantized = precision::quantize<Storage>(
+        DataView<float>{problem.data.data(), problem.meta});
+    for (const size_t threads : options.threads) {
+      tbb::task_arena arena(threads);
+      arena.execute([&] {
+        for_each_config([&](const size_t block_rows,
+                            const tuning::Partitioner partitioner) {
+          LogRegWorkspace<float> workspace(problem.meta, false);
+          configure(workspace, block_rows, partitioner);
+          const auto times = time_runs(options, [&] {
+            logreg_fused::forward_and_gradient<Storage>(
+                quantized.view(), problem.weights.data(),
+                problem.labels.data(), problem.beta, workspace, false);
+          });
+          record("fused", dtype, problem.meta, sizeof(Storage), threads,
+                 workspace, times);
+        });
+      });
+    }
+  }
+
+  const std::vector<Result> &results() const { return all_results; }
+
+private:
+  bool has_kernel(const char *name) const {
+    return std::find(options.kernels.begin(), options.kernels.end(), name) !=
+           options.kernels.end();
+  }
+
+  template <typename Body> void for_each_config(const Body &body) {
+    for (const size_t block_rows : options.block_rows) {
+      for (const auto &name : options.partitioners) {
+        tuning::Partitioner partitioner;
+        if (!partitioner_from_name(name, partitioner)) {
+          std::cerr << "Unknown partitioner " << name << std::endl;
+          continue;
+        }
+        body(block_rows, partitioner);
+        if (block_rows == 0) {
+          break; // The default ignores the partitioner list.
+        }
+      }
+    }
+  }
+
+  template <typename FPType>
+  void run_kernel(const Problem<FPType> &problem, const std::string &dtype,
+                  const std::string &kernel_name, const size_t threads,
+                  const size_t block_rows,
+                  const tuning::Partitioner partitioner) {
+    const Meta &meta = problem.meta;
+    const FPType *data = problem.data.data();
+    const FPType *weights = problem.weights.data();
+    const float *labels = problem.labels.data();
+    if (kernel_name == "noopt") {
+      LogRegWorkspace<FPType> workspace(meta);
+      configure(workspace, block_rows, partitioner);
+      const auto times = time_runs(options, [&] {
+        logreg_noopt::forward<FPType>(meta, data, weights, labels,
+                                      problem.beta, workspace, false);
+        logreg_noopt::gradient<FPType>(meta, data, weights, labels,
+                                       problem.beta,
+                                       workspace.forward.sigm.data(),
+                                       workspace, false);
+      });
+      record(kernel_name, dtype, meta, sizeof(FPType), threads, workspace,
+             times);
+      return;
+    }
+    if (kernel_name == "sparse") {
+      run_sparse(problem, dtype, threads, block_rows, partitioner);
+      return;
+    }
+    if (kernel_name == "stream") {
+      run_stream(problem, dtype, threads, block_rows, partitioner);
+      return;
+    }
+    if (kernel_name == "multi" || kernel_name == "softmax") {
+      run_outputs(problem, dtype, kernel_name, threads, block_rows,
+                  partitioner);
+      return;
+    }
+    Kernel kernel;
+    if (kernel_name == "mkl") {
+      kernel = Kernel::mkl;
+    } else if (kernel_name == "fused") {
+      kernel = Kernel::fused;
+    } else if (kernel_name == "tiled") {
+      kernel = Kernel::tiled;
+    } else {
+      std::cerr << "Unknown kernel " << kernel_name << std::endl;
+      return;
+    }
+    LogRegWorkspace<FPType> workspace(meta, false);
+    configure(workspace, block_rows, partitioner);
+    const auto times = time_runs(options, [&] {
+      forward_and_gradient<FPType>(kernel, meta, data, weights, labels,
+                                   problem.beta, workspace, false);
+    });
+    record(kernel_name, dtype, meta, sizeof(FPType), threads, workspace,
+           times);
+  }
+
+  template <typename FPType>
+  void run_sparse(const Problem<FPType> &problem, const std::string &dtype,
+                  const size_t threads, const size_t block_rows,
+                  const tuning::Partitioner partitioner) {
+    const CSRMatrix<FPType> csr = sparse::from_dense(
+        DataView<FPType>{problem.data.data(), problem.meta});
+    LogRegWorkspace<FPType> workspace(problem.meta, false);
+    configure(workspace, block_rows, partitioner);
+    const auto times = time_runs(options, [&] {
+      logreg_sparse::forward_and_gradient<FPType>(
+          csr.view(), problem.weights.data(), problem.labels.data(),
+          problem.beta, workspace, false);
+    });
+    // The generated features are dense: a value and its column per entry.
+    record("sparse", dtype, problem.meta, sizeof(FPType) + sizeof(uint32_t),
+           1, threads, 0, workspace.partitioner, times);
+  }
+
+  template <typename FPType>
+  void run_stream(const Problem<FPType> &problem, const std::string &dtype,
+                  const size_t threads, const size_t block_rows,
+                  const tuning::Partitioner partitioner) {
+    if (!stream_ready) {
+      return;
+    }
+    format::Header header;
+    if (format::read_header(options.stream_file.c_str(), header) !=
+        format::Status::ok) {
+      std::cerr << "Can't read " << options.stream_file << std::endl;
+      return;
+    }
+    StreamOptions stream_options;
+    stream_options.data_offset = header.features_offset;
+    stream_options.labels_offset = header.labels_offset;
+    ChunkReader reader(options.stream_file.c_str(),
+                       problem.meta.columns_count * sizeof(FPType),
+                       problem.meta.rows_count, stream_options);
+    LogRegWorkspace<FPType> workspace(problem.meta, false);
+    configure(workspace, block_rows, partitioner);
+    bool read_ok = reader.good();
+    const auto times = time_runs(options, [&] {
+      read_ok = read_ok && logreg_stream::forward_and_gradient<FPType>(
+                               Kernel::fused, problem.meta, reader,
+                               problem.weights.data(), nullptr,
+                               problem.beta, workspace, false);
+    });
+    if (!read_ok) {
+      std::cerr << "Can't stream " << options.stream_file << std::endl;
+      return;
+    }
+    record("stream", dtype, problem.meta, sizeof(FPType), threads, workspace,
+           times);
+  }
+
+  // --outputs models (multi) or classes (softmax) in one pass.
+  template <typename FPType>
+  void run_outputs(const Problem<FPType> &problem, const std::string &dtype,
+                   const std::string &kernel_name, const size_t threads,
+                   const size_t block_rows,
+                   const tuning::Partitioner partitioner) {
+    const Meta &meta = problem.meta;
+    const size_t outputs = options.outputs;
+    const bool softmax = kernel_name == "softmax";
+    std::vector<FPType> weights;
+    std::vector<float> labels;
+    if (softmax) {
+      weights.resize(meta.columns_count * outputs);
+      rng::fill_uniform<FPType>(weights.data(), weights.size(),
+                                GenerationOptions{}.seed,
+                                data_gen::initial_stream, 0, -1, 1);
+      labels = data_gen::softmax_labels(
+          DataView<FPType>{problem.data.data(), meta}, outputs,
+          GenerationOptions{}.seed);
+    } else {
+      weights = logreg_multi::interleave(
+          std::vector<std::vector<FPType>>(outputs, problem.weights));
+    }
+    const std::vector<FPType> betas(outputs, problem.beta);
+    MultiWorkspace<FPType> workspace(meta, outputs);
+    if (block_rows) {
+      workspace.partitioner = partitioner;
+    }
+    const auto times = time_runs(options, [&] {
+      if (softmax) {
+        logreg_softmax::forward_and_gradient<FPType>(
+            meta, problem.data.data(), weights.data(), labels.data(),
+            betas.data(), workspace, false);
+      } else {
+        logreg_multi::forward_and_gradient<FPType>(
+            meta, problem.data.data(), weights.data(), problem.labels.data(),
+            0, betas.data(), workspace, false);
+      }
+    });
+    record(kernel_name, dtype, meta, sizeof(FPType), outputs, threads,
+           workspace.rows_in_block, workspace.partitioner, times);
+  }
+
+  template <typename FPType>
+  void record(const std::string &kernel, const std::string &dtype,
+              const Meta &meta, const size_t element_size,
+              const size_t threads, const LogRegWorkspace<FPType> &workspace,
+              std::vector<double> times) {
+    record(kernel, dtype, meta, element_size, 1, threads,
+           workspace.rows_in_block, workspace.partitioner, std::move(times));
+  }
+
+  void record(const std::string &kernel, const std::string &dtype,
+              const Meta &meta, const size_t element_size,
+              const size_t outputs, const size_t threads,
+              const size_t rows_in_block,
+              const tuning::Partitioner partitioner,
+              std::vector<double> times) {
+    std::sort(times.begin(), times.end());
+    Result result;
+    result.kernel = kernel;
+    result.dtype = dtype;
+    result.rows = meta.rows_count;
+    result.columns = meta.columns_count;
+    result.threads = threads;
+    result.rows_in_block = rows_in_block;
+    result.partitioner = tuning::partitioner_name(partitioner);
+    result.runs = times.size();
+    result.median = percentile(times, 0.5);
+    result.p95 = percentile(times, 0.95);
+    result.min = times.front();
+    double sum = 0;
+    for (const double time : times) {
+      sum += time;
+    }
+    result.mean = sum / times.size();
+    const double bytes =
+        meta.rows_count * (meta.columns_count * element_size + sizeof(float));
+    result.gbs = bytes / result.median / 1e9;
+    result.gflops = 4. * meta.rows_count * meta.columns_count * outputs /
+                    result.median / 1e9;
+    result.roof_gbs = 0;
+    for (const auto &roof : roofs) {
+      if (roof.threads == threads) {
+        result.roof_gbs = roof.read_gbs;
+      }
+    }
+    std::cerr << kernel << " " << dtype << " " << meta.rows_count << "x"
+              << meta.columns_count << " threads " << threads
+              << ": median (sec) " << result.median << ", " << result.gbs
+              << " GB/s" << std::endl;
+    all_results.push_back(result);
+  }
+
+  const Options &options;
+  std::vector<Roof> roofs;
+  std::vector<Result> all_results;
+  bool stream_ready = false;
+};
+
+void write_csv(std::ostream &out, const std::vector<Result> &results) {
+  out << "kernel,dtype,rows,columns,threads,rows_in_block,partitioner,runs,"
+         "median_s,p95_s,min_s,mean_s,gbs,gflops,roof_gbs,roof_fraction\n";
+  for (const auto &result : results) {
+    out << result.kernel << ',' << result.dtype << ',' << result.rows << ','
+        << result.columns << ',' << result.threads << ','
+        << result.rows_in_block << ',' << result.partitioner << ','
+        << result.runs << ',' << result.median << ',' << result.p95 << ','
+        << result.min << ',' << result.mean << ',' << result.gbs << ','
+        << result.gflops << ',' << result.roof_gbs << ','
+        << (result.roof_gbs ? result.gbs / result.roof_gbs : 0) << '\n';
+  }
+}
+
+void write_json(std::ostream &out, const std::vector<Roof> &roofs,
+                const std::vector<Result> &results) {
+  const tuning::CacheInfo &caches = tuning::cache_info();
+  out << "{\n  \"machine\": {\"simd\": \"" << simd::isa_name()
+      << "\", \"l1d\": " << caches.l1d << ", \"l2\": " << caches.l2
+      << ", \"l3\": " << caches.l3 << "},\n  \"roofs\": [";
+  for (size_t index = 0; index < roofs.size(); ++index) {
+    out << (index ? ",\n    " : "\n    ") << "{\"threads\": "
+        << roofs[index].threads << ", \"read_gbs\": " << roofs[index].read_gbs
+        << ", \"triad_gbs\": " << roofs[index].triad_gbs << "}";
+  }
+  out << "\n  ],\n  \"results\": [";
+  for (size_t index = 0; index < results.size(); ++index) {
+    const Result &result = results[index];
+    out << (index ? ",\n    " : "\n    ") << "{\"kernel\": \""
+        << result.kernel << "\", \"dtype\": \"" << result.dtype
+        << "\", \"rows\": " << result.rows
+        << ", \"columns\": " << result.columns
+        << ", \"threads\": " << result.threads
+        << ", \"rows_in_block\": " << result.rows_in_block
+        << ", \"partitioner\": \"" << result.partitioner
+        << "\", \"runs\": " << result.runs
+        << ", \"median_s\": " << result.median << ", \"p95_s\": " << result.p95
+        << ", \"min_s\": " << result.min << ", \"mean_s\": " << result.mean
+        << ", \"gbs\": " << result.gbs << ", \"gflops\": " << result.gflops
+        << ", \"roof_gbs\": " << result.roof_gbs << ", \"roof_fraction\": "
+        << (result.roof_gbs ? result.gbs / result.roof_gbs : 0) << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse(argc, argv, options)) {
+    return 1;
+  }
+  mkl_set_num_threads(1);
+
+  std::vector<Roof> roofs;
+  for (const size_t threads : options.threads) {
+    roofs.push_back(measure_roof(threads));
+    std::cerr << "Roof, " << threads << " threads: read "
+              << roofs.back().read_gbs << " GB/s, triad "
+              << roofs.back().triad_gbs << " GB/s" << std::endl;
+  }
+
+  // Opened before the sweep, so a bad path fails at once.
+  std::ofstream file;
+  if (!options.output.empty()) {
+    file.open(options.output);
+    if (!file) {
+      std::cerr << "Can't open " << options.output << std::endl;
+      return 1;
+    }
+  }
+
+  Runner runner(options, roofs);
+  for (const size_t rows : options.rows) {
+    for (const size_t columns : options.columns) {
+      const Meta meta{tuning::cache_info().l2, columns, rows};
+      for (const auto &dtype : options.dtypes) {
+        format::DType type;
+        if (!format::dtype_from_name(dtype.c_str(), type)) {
+          std::cerr << "Unknown dtype " << dtype << std::endl;
+          continue;
+        }
+        if (type == format::DType::f64) {
+          runner.run_float(make_problem<double>(meta), dtype);
+          continue;
+        }
+        const Problem<float> problem = make_problem<float>(meta);
+        switch (type) {
+        case format::DType::bf16:
+          runner.run_quantized<precision::bf16>(problem, dtype);
+          break;
+        case format::DType::f16:
+          runner.run_quantized<precision::fp16>(problem, dtype);
+          break;
+        case format::DType::i8:
+          runner.run_quantized<int8_t>(problem, dtype);
+          break;
+        default:
+          runner.run_float(problem, dtype);
+          break;
+        }
+      }
+    }
+  }
+
+  std::ostream &out = options.output.empty() ? std::cout : file;
+  if (options.format == "json") {
+    write_json(out, roofs, runner.results());
+  } else {
+    write_csv(out, runner.results());
+  }
+  out.flush();
+  if (!out) {
+    std::cerr << "Can't write the results" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -1,86 +1,208 @@
 #ifndef DATA_GEN_HPP
 #define DATA_GEN_HPP
 
-#include <fstream>
-#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <tuple>
 
 #include <tbb/tbb.h>
 
+#include "dataset.hpp"
+#include "format.hpp"
+#include "random.hpp"
 #include "structures.hpp"
+#include "verbose.hpp"
 
-template <typename FPType>
-std::tuple<std::vector<FPType>, std::vector<FPType>, FPType,
-           std::vector<FPType>>
-generate_data(const Meta &meta, const char *filename) {
-  std::vector<FPType> data(meta.rows_count * meta.columns_count),
-      weights(meta.columns_count), groundTruth(meta.rows_count);
-  FPType beta;
+struct GenerationOptions {
+  uint64_t seed = 42;
+  // Labels are drawn from sigmoid(x * true_weights + true_beta) of a random
+  // "true" model, so they are learnable. Otherwise they are fair coin flips.
+  bool true_model = true;
+  // Check the section checksums of an existing file when it is opened. This
+  // reads the whole file, so it is off by default: the header checksum and
+  // the size checks already reject misinterpreted and truncated files.
+  bool verify = false;
+};
 
-  std::uniform_real_distribution<FPType> data_dist(-1, 1), beta_dist(0, 0.01),
-      weights_dist(-1, 1), ground_truth_dist(0, 1);
-  std::random_device rd;
-
-  std::ifstream input(filename, std::ios::binary);
-  bool need_to_create_data = false;
-  if (input.good()) {
-    input.seekg(0, std::ios::end);
-    auto fileSize = input.tellg();
-    input.seekg(0, std::ios::beg);
-    input.read((char *)data.data(), fileSize);
-    input.close();
-  } else {
-    need_to_create_data = true;
-  }
+namespace data_gen {
 
-  constexpr size_t num_threads = 5;
-  const size_t rows_in_block =
-      meta.columns_count / num_threads + !!(meta.columns_count % num_threads);
-  const size_t blocks_count =
-      meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
-  tbb::parallel_for(
-      tbb::blocked_range<int>(0, blocks_count),
-      [&](tbb::blocked_range<int> r) {
-        for (int block_index = r.begin(); block_index < r.end();
-             ++block_index) {
-          const size_t start_row = rows_in_block * block_index;
-          const size_t rows_to_process =
-              block_index + 1 == blocks_count
-                  ? meta.rows_count - rows_in_block * block_index
-                  : rows_in_block;
-          if (need_to_create_data) {
-            for (size_t index = start_row * meta.columns_count;
-                 index < (start_row + rows_to_process) * meta.columns_count;
-                 ++index) {
-              data[index] = data_dist(rd);
-            }
-          }
-          for (size_t index = start_row; index < start_row + rows_to_process;
-               ++index) {
-            FPType value = ground_truth_dist(rd);
-            if (value < 0.5) {
-              value = 0.;
-            } else {
-              value = 1.;
-            }
-            groundTruth[index] = value;
+// Independent random streams of one seed.
+constexpr uint64_t features_stream = 0;
+constexpr uint64_t labels_stream = 1;
+constexpr uint64_t true_model_stream = 2;
+constexpr uint64_t initial_stream = 3;
+constexpr uint64_t softmax_model_stream = 4;
+constexpr uint64_t softmax_labels_stream = 5;
+
+// Rows generated by one task: a few hundred KB of features.
+constexpr size_t block_bytes = 256 * 1024;
+
+// The true model has weights in [-scale, scale) with scale = 3 / sqrt(cols),
+// so the logits of uniform(-1, 1) features have a standard deviation of
+// about sqrt(3) for any column count.
+template <typename FPType>
+void true_model(const Meta &meta, const uint64_t seed,
+                std::vector<FPType> &weights, FPType &beta) {
+  const FPType scale = 3 / std::sqrt(static_cast<FPType>(meta.columns_count));
+  weights.resize(meta.columns_count);
+  rng::fill_uniform<FPType>(weights.data(), meta.columns_count, seed,
+                            true_model_stream, 0, -scale, scale);
+  rng::fill_uniform<FPType>(&beta, 1, seed, true_model_stream,
+                            meta.columns_count, -0.5, 0.5);
+}
+
+// Fills rows [start_row, start_row + rows_count) of the features and labels.
+// Every value depends only on the seed and its position.
+template <typename FPType>
+void generate_rows(const Meta &meta, const GenerationOptions &options,
+                   const std::vector<FPType> &true_weights,
+                   const FPType true_beta, const size_t start_row,
+                   const size_t rows_count, FPType *data, float *labels) {
+  const size_t columns_count = meta.columns_count;
+  rng::fill_uniform<FPType>(data + start_row * columns_count,
+                            rows_count * columns_count, options.seed,
+                            features_stream, start_row * columns_count, -1,
+                            1);
+  rng::for_each_value(
+      options.seed, labels_stream, start_row, rows_count,
+      [&](uint64_t row, uint32_t bits) {
+        FPType probability = 0.5;
+        if (options.true_model) {
+          const FPType *row_ptr = data + row * columns_count;
+          FPType logit = true_beta;
+          for (size_t index = 0; index < columns_count; ++index) {
+            logit += row_ptr[index] * true_weights[index];
           }
+          probability = 1 / (1 + std::exp(-logit));
         }
-      },
-      tbb::static_partitioner());
+        labels[row] = rng::uniform<FPType>(bits, 0, 1) < probability ? 1 : 0;
+      });
+}
+
+// Class labels 0 .. classes_count - 1 for existing features, drawn from the
+// softmax of a random true model (columns x classes_count weights with the
+// same scale as true_model()). Like the binary labels they depend only on
+// the seed and the row.
+template <typename FPType>
+std::vector<float> softmax_labels(const DataView<FPType> &data,
+                                  const size_t classes_count,
+                                  const uint64_t seed) {
+  const size_t columns_count = data.meta.columns_count;
+  const FPType scale = 3 / std::sqrt(static_cast<FPType>(columns_count));
+  std::vector<FPType> weights(columns_count * classes_count);
+  rng::fill_uniform<FPType>(weights.data(), weights.size(), seed,
+                            softmax_model_stream, 0, -scale, scale);
+  std::vector<float> labels(data.meta.rows_count);
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, data.meta.rows_count),
+      [&](tbb::blocked_range<size_t> r) {
+        std::vector<FPType> logits(classes_count);
+        rng::for_each_value(
+            seed, softmax_labels_stream, r.begin(), r.size(),
+            [&](uint64_t row, uint32_t bits) {
+              const FPType *row_ptr = data.row(row);
+              std::fill(logits.begin(), logits.end(), FPType(0));
+              for (size_t column = 0; column < columns_count; ++column) {
+                for (size_t label = 0; label < classes_count; ++label) {
+                  logits[label] += row_ptr[column] *
+                                   weights[column * classes_count + label];
+                }
+              }
+              const FPType max_logit =
+                  *std::max_element(logits.begin(), logits.end());
+              FPType sum = 0;
+              for (auto &value : logits) {
+                value = std::exp(value - max_logit);
+                sum += value;
+              }
+              // Inverse CDF of the class distribution.
+              FPType target = rng::uniform<FPType>(bits, 0, sum);
+              size_t label = 0;
+              while (label + 1 < classes_count && target >= logits[label]) {
+                target -= logits[label];
+                ++label;
+              }
+              labels[row] = label;
+            });
+      });
+  return labels;
+}
 
-  if (need_to_create_data) {
-    std::ofstream out_file(filename);
-    out_file.write((char *)data.data(), data.size() * sizeof(FPType));
-    out_file.close();
+} // namespace data_gen
+
+// Maps filename if it is a valid dataset file of the requested shape and
+// type, otherwise generates features and labels straight into a new mapping
+// of the file (see format.hpp). Labels are read back from the file, so they
+// stay the same between runs. Generation is reproducible: the same seed gives
+// bit-identical files for any thread count. Check good() of the returned
+// file: it is false if the file can't be created.
+template <typename FPType>
+std::tuple<format::File, std::vector<FPType>, FPType, std::vector<float>>
+generate_data(const Meta &meta, const char *filename,
+              const MapOptions &options = {}, const bool verbosity = false,
+              const GenerationOptions &generation = {}) {
+  std::vector<FPType> weights(meta.columns_count);
+  std::vector<float> groundTruth(meta.rows_count);
+  FPType beta;
+
+  format::File dataset;
+  format::Status status = dataset.open(filename, options, generation.verify);
+  if (status == format::Status::ok &&
+      (dataset.header().dtype !=
+           static_cast<uint32_t>(format::dtype_of<FPType>()) ||
+       dataset.header().rows_count != meta.rows_count ||
+       dataset.header().columns_count != meta.columns_count)) {
+    status = format::Status::dtype_mismatch;
   }
+  if (status != format::Status::ok) {
+    verbose_print(verbosity, "Generating ", filename, " (",
+                  format::status_name(status), ")");
+    dataset = format::File();
+    if (dataset.create(filename, format::dtype_of<FPType>(), meta.rows_count,
+                       meta.columns_count, false) == format::Status::ok) {
+      FPType *data = static_cast<FPType *>(dataset.features());
+      float *labels = dataset.labels();
+      std::vector<FPType> true_weights;
+      FPType true_beta = 0;
+      data_gen::true_model(meta, generation.seed, true_weights, true_beta);
 
-  for (auto &value : weights) {
-    value = weights_dist(rd);
+      const size_t rows_in_block = std::max<size_t>(
+          1, data_gen::block_bytes / (meta.columns_count * sizeof(FPType)));
+      const size_t blocks_count =
+          meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
+      tbb::parallel_for(
+          tbb::blocked_range<size_t>(0, blocks_count),
+          [&](tbb::blocked_range<size_t> r) {
+            for (size_t block_index = r.begin(); block_index < r.end();
+                 ++block_index) {
+              const size_t start_row = rows_in_block * block_index;
+              const size_t rows_to_process =
+                  std::min(rows_in_block, meta.rows_count - start_row);
+              data_gen::generate_rows<FPType>(meta, generation, true_weights,
+                                              true_beta, start_row,
+                                              rows_to_process, data, labels);
+            }
+          });
+      if (dataset.finalize() != format::Status::ok) {
+        dataset = format::File();
+      }
+    }
+  }
+  if (dataset.good()) {
+    std::copy(dataset.labels(), dataset.labels() + meta.rows_count,
+              groundTruth.begin());
   }
 
-  beta = beta_dist(rd);
-  return std::make_tuple(data, weights, beta, groundTruth);
+  // Initial model for the kernels and training, independent of the true one.
+  rng::fill_uniform<FPType>(weights.data(), meta.columns_count,
+                            generation.seed, data_gen::initial_stream, 0, -1,
+                            1);
+  rng::fill_uniform<FPType>(&beta, 1, generation.seed,
+                            data_gen::initial_stream, meta.columns_count, 0,
+                            0.01);
+  return std::make_tuple(std::move(dataset), std::move(weights), beta,
+                         std::move(groundTruth));
 }
 
 #endif
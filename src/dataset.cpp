@@ -0,0 +1,98 @@
+#include "dataset.hpp"
+
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+void *map_descriptor(int descriptor, size_t size, int protection,
+                     const MapOptions &options) {
+  if (size == 0) {
+    return nullptr;
+  }
+  int flags = MAP_SHARED;
+  if (options.populate) {
+    flags |= MAP_POPULATE;
+  }
+  void *address = mmap(nullptr, size, protection, flags, descriptor, 0);
+  if (address == MAP_FAILED) {
+    return nullptr;
+  }
+  if (options.sequential) {
+    madvise(address, size, MADV_SEQUENTIAL);
+  }
+  if (options.will_need) {
+    madvise(address, size, MADV_WILLNEED);
+  }
+#ifdef MADV_HUGEPAGE
+  if (options.huge_pages) {
+    madvise(address, size, MADV_HUGEPAGE);
+  }
+#endif
+  return address;
+}
+
+} // namespace
+
+MappedFile::MappedFile(const char *filename, const MapOptions &options) {
+  const int descriptor = open(filename, O_RDONLY);
+  if (descriptor < 0) {
+    return;
+  }
+  struct stat file_stat;
+  if (fstat(descriptor, &file_stat) == 0) {
+    length = file_stat.st_size;
+    address = map_descriptor(descriptor, length, PROT_READ, options);
+    if (!address) {
+      length = 0;
+    }
+  }
+  close(descriptor);
+}
+
+MappedFile MappedFile::create(const char *filename, size_t size,
+                              const MapOptions &options) {
+  MappedFile result;
+  const int descriptor = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (descriptor < 0) {
+    return result;
+  }
+  if (ftruncate(descriptor, size) == 0) {
+    result.address =
+        map_descriptor(descriptor, size, PROT_READ | PROT_WRITE, options);
+    result.length = result.address ? size : 0;
+  }
+  close(descriptor);
+  return result;
+}
+
+MappedFile::~MappedFile() { release(); }
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : address(std::exchange(other.address, nullptr)),
+      length(std::exchange(other.length, 0)) {}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+  if (this != &other) {
+    release();
+    address = std::exchange(other.address, nullptr);
+    length = std::exchange(other.length, 0);
+  }
+  return *this;
+}
+
+bool MappedFile::sync() {
+  return address && msync(address, length, MS_SYNC) == 0;
+}
+
+void MappedFile::release() {
+  if (address) {
+    munmap(address, length);
+    address = nullptr;
+    length = 0;
+  }
+}
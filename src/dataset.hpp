@@ -0,0 +1,52 @@
+#ifndef DATASET_HPP
+#define DATASET_HPP
+
+#include <cstddef>
+
+struct MapOptions {
+  // Prefault the whole mapping in mmap (MAP_POPULATE), so the first pass does
+  // not pay for page faults.
+  bool populate = false;
+  // madvise hints: sequential read-ahead and asynchronous read of the file.
+  bool sequential = true;
+  bool will_need = false;
+  // Ask for transparent huge pages (MADV_HUGEPAGE). Has an effect only where
+  // the kernel supports THP for the page cache of the file system.
+  bool huge_pages = false;
+};
+
+// Read-only (or, through create(), read-write) shared mapping of a whole
+// file. Shared mappings of the same file use the same page cache, so a warm
+// file is not copied per process. Move-only.
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const char *filename, const MapOptions &options = {});
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile(MappedFile &&other) noexcept;
+  MappedFile &operator=(MappedFile &&other) noexcept;
+
+  // Creates (or truncates) the file with the given size and maps it for
+  // writing.
+  static MappedFile create(const char *filename, size_t size,
+                           const MapOptions &options = {});
+
+  // Writes dirty pages back to the file.
+  bool sync();
+
+  bool good() const { return address != nullptr; }
+  const void *data() const { return address; }
+  void *data() { return address; }
+  size_t size() const { return length; }
+
+private:
+  void release();
+
+  void *address = nullptr;
+  size_t length = 0;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "dispatch.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+Kernel kernel_from_env() {
+  const char *value = std::getenv("COMP_OPT_KERNEL");
+  if (value && std::strcmp(value, "fused") == 0) {
+    return Kernel::fused;
+  }
+  if (value && std::strcmp(value, "tiled") == 0) {
+    return Kernel::tiled;
+  }
+  return Kernel::mkl;
+}
+
+const char *kernel_name(Kernel kernel) {
+  switch (kernel) {
+  case Kernel::fused:
+    return "fused";
+  case Kernel::tiled:
+    return "tiled";
+  case Kernel::mkl:
+  default:
+    return "MKL";
+  }
+}
+
+format::DType storage_from_env() {
+  const char *value = std::getenv("COMP_OPT_STORAGE");
+  format::DType dtype = format::DType::f32;
+  if (value && !format::dtype_from_name(value, dtype)) {
+    dtype = format::DType::f32;
+  }
+  return dtype;
+}
+
+size_t models_from_env() {
+  const char *value = std::getenv("COMP_OPT_MODELS");
+  return value ? std::strtoull(value, nullptr, 10) : 0;
+}
+
+size_t classes_from_env() {
+  const char *value = std::getenv("COMP_OPT_CLASSES");
+  return value ? std::strtoull(value, nullptr, 10) : 0;
+}
+
+bool serving_from_env() {
+  const char *value = std::getenv("COMP_OPT_SERVING");
+  return value && std::strcmp(value, "1") == 0;
+}
+
+bool stream_from_env() {
+  const char *value = std::getenv("COMP_OPT_STREAM");
+  return value && std::strcmp(value, "1") == 0;
+}
+
+bool verify_from_env() {
+  const char *value = std::getenv("COMP_OPT_VERIFY");
+  return value && std::strcmp(value, "1") == 0;
+}
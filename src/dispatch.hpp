@@ -0,0 +1,231 @@
+#ifndef DISPATCH_HPP
+#define DISPATCH_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include "format.hpp"
+#include "logreg.hpp"
+#include "logreg_fused.hpp"
+#include "logreg_tiled.hpp"
+#include "stats.hpp"
+#include "structures.hpp"
+#include "tuning.hpp"
+#include "verbose.hpp"
+#include "workspace.hpp"
+
+// Engines that implement forward_and_gradient. Picked at runtime through the
+// COMP_OPT_KERNEL environment variable ("mkl", "fused" or "tiled"), MKL by
+// default. "tiled" partitions wide data over rows and columns and falls back
+// to "fused" for narrow shapes (see logreg_tiled.hpp).
+enum class Kernel { mkl, fused, tiled };
+
+Kernel kernel_from_env();
+
+const char *kernel_name(Kernel kernel);
+
+// Feature storage for the reduced-precision run of main, from the
+// COMP_OPT_STORAGE environment variable ("f32", "bf16", "f16" or "i8"); f32
+// when unset or unknown. Compressed storage is read by the fused kernel only.
+format::DType storage_from_env();
+
+// Number of models of the batched multi-model run of main
+// (logreg_multi.hpp), from the COMP_OPT_MODELS environment variable; 0 (no
+// run) when unset.
+size_t models_from_env();
+
+// Number of classes of the softmax run of main (logreg_softmax.hpp), from
+// the COMP_OPT_CLASSES environment variable; 0 (no run) when unset.
+size_t classes_from_env();
+
+// Serving latency run of main (serving.hpp), on with COMP_OPT_SERVING=1.
+bool serving_from_env();
+
+// Out-of-core run of main (streaming.hpp), on with COMP_OPT_STREAM=1.
+bool stream_from_env();
+
+// Checksum verification of the data files main maps (format.hpp), on with
+// COMP_OPT_VERIFY=1.
+bool verify_from_env();
+
+template <typename FPType>
+void accumulate_forward_and_gradient(const Kernel kernel, const Meta &meta,
+                                     const FPType *data, const FPType *weights,
+                                     const float *groundTruth,
+                                     const FPType beta_weight,
+                                     const size_t first_row,
+                                     LogRegWorkspace<FPType> &workspace) {
+  switch (kernel) {
+  case Kernel::fused:
+    logreg_fused::accumulate_forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, first_row, workspace);
+    break;
+  case Kernel::tiled:
+    logreg_tiled::accumulate_forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, first_row, workspace);
+    break;
+  case Kernel::mkl:
+  default:
+    logreg_opt::accumulate_forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, first_row, workspace);
+    break;
+  }
+}
+
+// Picks the fastest block size and partitioner for the shape, kernel and
+// thread count and configures the workspace with it. The first call for a
+// key times every candidate twice on a prefix of the rows (at least 1/16 of
+// them); later calls reuse the stored winner.
+template <typename FPType>
+void autotune(const Kernel kernel, const Meta &meta, const FPType *data,
+              const FPType *weights, const float *groundTruth,
+              const FPType beta_weight, LogRegWorkspace<FPType> &workspace,
+              const bool verbosity) {
+  const tuning::Key key{meta.rows_count, meta.columns_count, sizeof(FPType),
+                        static_cast<int>(kernel),
+                        tbb::this_task_arena::max_concurrency()};
+  tuning::Config best = workspace.config();
+  if (!tuning::find(key, best)) {
+    const std::vector<size_t> candidates = tuning::candidate_block_rows(
+        meta.l2_cache_size, meta.columns_count, sizeof(FPType));
+    Meta sample = meta;
+    sample.rows_count =
+        std::min(meta.rows_count,
+                 std::max(meta.rows_count / 16,
+                          16 * key.threads * candidates.back()));
+    double best_time = std::numeric_limits<double>::infinity();
+    for (const size_t rows_in_block : candidates) {
+      for (const auto partitioner : {tuning::Partitioner::static_partitioner,
+                                     tuning::Partitioner::affinity,
+                                     tuning::Partitioner::automatic}) {
+        workspace.configure(tuning::Config{rows_in_block, partitioner});
+        for (int repeat = 0; repeat < 2; ++repeat) {
+          workspace.reset();
+          const auto start = std::chrono::steady_clock::now();
+          accumulate_forward_and_gradient<FPType>(kernel, sample, data,
+                                                  weights, groundTruth,
+                                                  beta_weight, 0, workspace);
+          const std::chrono::duration<double> time =
+              std::chrono::steady_clock::now() - start;
+          if (time.count() < best_time) {
+            best_time = time.count();
+            best = workspace.config();
+          }
+        }
+      }
+    }
+    tuning::store(key, best);
+    verbose_print(verbosity, "Autotuned: ", best.rows_in_block,
+                  " rows per block, ",
+                  tuning::partitioner_name(best.partitioner), " partitioner");
+  }
+  workspace.configure(best);
+}
+
+// Autotunes the workspace on its first call unless COMP_OPT_AUTOTUNE=0 or
+// the workspace reduces deterministically: timing-based block sizes would
+// make the results differ between runs. The 2D path of the tiled kernel has
+// its own layout and reads neither the block size nor the partitioner, so
+// it is not tuned either.
+template <typename FPType>
+void prepare_workspace(const Kernel kernel, const Meta &meta,
+                       const FPType *data, const FPType *weights,
+                       const float *groundTruth, const FPType beta_weight,
+                       LogRegWorkspace<FPType> &workspace,
+                       const bool verbosity) {
+  const bool tiled_2d =
+      kernel == Kernel::tiled &&
+      logreg_tiled::prefers_2d(meta, sizeof(FPType),
+                               workspace.deterministic());
+  // Thread-local gradients for the kernels that accumulate into them only;
+  // turns them back on after a 2D pass on the same workspace.
+  workspace.use_thread_gradients(!tiled_2d);
+  if (!workspace.tuned && tuning::enabled() && !workspace.deterministic() &&
+      !tiled_2d) {
+    autotune<FPType>(kernel, meta, data, weights, groundTruth, beta_weight,
+                     workspace, verbosity);
+  }
+}
+
+template <typename FPType>
+void forward_and_gradient(const Kernel kernel, const Meta &meta,
+                          const FPType *data, const FPType *weights,
+                          const float *groundTruth, const FPType beta_weight,
+                          LogRegWorkspace<FPType> &workspace,
+                          const bool verbosity) {
+  prepare_workspace<FPType>(kernel, meta, data, weights, groundTruth,
+                            beta_weight, workspace, verbosity);
+  switch (kernel) {
+  case Kernel::fused:
+    logreg_fused::forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, workspace, verbosity);
+    break;
+  case Kernel::tiled:
+    logreg_tiled::forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, workspace, verbosity);
+    break;
+  case Kernel::mkl:
+  default:
+    logreg_opt::forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, workspace, verbosity);
+    break;
+  }
+}
+
+// forward_and_gradient that also runs column_update(index, value) with the
+// gradient of every column inside the gradient reduction
+// (LogRegWorkspace::reduce_gradient), e.g. the optimizer step of
+// training::Trainer. The weights are no longer read at that point, so the
+// update may write them. The beta gradient is left in workspace.gradient.
+template <typename FPType, typename ColumnUpdate>
+void forward_and_gradient(const Kernel kernel, const Meta &meta,
+                          const FPType *data, const FPType *weights,
+                          const float *groundTruth, const FPType beta_weight,
+                          LogRegWorkspace<FPType> &workspace,
+                          const bool verbosity,
+                          const ColumnUpdate &column_update) {
+  prepare_workspace<FPType>(kernel, meta, data, weights, groundTruth,
+                            beta_weight, workspace, verbosity);
+  stats::PassTimer pass;
+  workspace.reset();
+  accumulate_forward_and_gradient<FPType>(kernel, meta, data, weights,
+                                          groundTruth, beta_weight, 0,
+                                          workspace);
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce_forward();
+  workspace.reduce_gradient(column_update);
+}
+
+template <typename FPType>
+void forward_and_gradient(const Kernel kernel, const DataView<FPType> &data,
+                          const FPType *weights, const float *groundTruth,
+                          const FPType beta_weight,
+                          LogRegWorkspace<FPType> &workspace,
+                          const bool verbosity) {
+  forward_and_gradient<FPType>(kernel, data.meta, data.data, weights,
+                               groundTruth, beta_weight, workspace, verbosity);
+}
+
+template <typename FPType>
+std::pair<ForwardResult<FPType>, GradientResult<FPType>>
+forward_and_gradient(const Kernel kernel, const Meta &meta,
+                     const std::vector<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth,
+                     const FPType beta_weight, const bool verbosity) {
+  switch (kernel) {
+  case Kernel::fused:
+    return logreg_fused::forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, verbosity);
+  case Kernel::tiled:
+    return logreg_tiled::forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, verbosity);
+  case Kernel::mkl:
+  default:
+    return logreg_opt::forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, verbosity);
+  }
+}
+
+#endif
@@ -0,0 +1,386 @@
+#include "format.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <tbb/tbb.h>
+
+namespace format {
+
+namespace {
+
+constexpr uint64_t checksum_seed = 0x9E3779B97F4A7C15ull;
+
+uint64_t mix(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xFF51AFD7ED558CCDull;
+  value ^= value >> 33;
+  value *= 0xC4CEB9FE1A85EC53ull;
+  value ^= value >> 33;
+  return value;
+}
+
+uint64_t chunk_checksum(const unsigned char *data, size_t size) {
+  uint64_t lanes[4] = {checksum_seed, checksum_seed + 1, checksum_seed + 2,
+                       checksum_seed + 3};
+  size_t index = 0;
+  for (; index + 32 <= size; index += 32) {
+    for (size_t lane = 0; lane < 4; ++lane) {
+      uint64_t word;
+      std::memcpy(&word, data + index + lane * 8, sizeof(word));
+      lanes[lane] = (lanes[lane] ^ word) * 0x100000001B3ull;
+    }
+  }
+  uint64_t result = size;
+  for (size_t lane = 0; lane < 4; ++lane) {
+    result = mix(result ^ lanes[lane]);
+  }
+  for (; index < size; ++index) {
+    result = (result ^ data[index]) * 0x100000001B3ull;
+  }
+  return mix(result);
+}
+
+uint64_t header_checksum(const Header &header) {
+  return chunk_checksum(reinterpret_cast<const unsigned char *>(&header),
+                        offsetof(Header, header_checksum));
+}
+
+size_t align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Largest section validate() accepts: four sections and their padding stay
+// far below 2^64, so no offset computed by make_header overflows.
+constexpr uint64_t max_section_bytes = uint64_t(1) << 60;
+
+bool section_fits(uint64_t count, uint64_t element_size) {
+  return count <= max_section_bytes / element_size;
+}
+
+Status validate(const Header &header, size_t size) {
+  if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+    return Status::bad_magic;
+  }
+  if (header.version != version) {
+    return Status::bad_version;
+  }
+  if (header.header_checksum != header_checksum(header) ||
+      header.layout != static_cast<uint32_t>(Layout::row_major) ||
+      dtype_size(static_cast<DType>(header.dtype)) == 0) {
+    return Status::bad_header;
+  }
+  // make_header divides by the alignment and adds the section sizes. Below
+  // min_alignment the labels of an i8 file could start at an odd offset.
+  const uint64_t element_size = dtype_size(static_cast<DType>(header.dtype));
+  if (header.alignment < min_alignment ||
+      (header.alignment & (header.alignment - 1)) != 0 ||
+      !section_fits(header.rows_count, sizeof(float)) ||
+      !section_fits(header.columns_count, sizeof(float)) ||
+      (header.columns_count &&
+       !section_fits(header.rows_count,
+                     header.columns_count * element_size))) {
+    return Status::bad_header;
+  }
+  const Header expected =
+      make_header(static_cast<DType>(header.dtype), header.rows_count,
+                  header.columns_count, header.sample_weights_offset != 0,
+                  header.alignment);
+  if (expected.features_offset != header.features_offset ||
+      expected.features_bytes != header.features_bytes ||
+      expected.labels_offset != header.labels_offset ||
+      expected.labels_bytes != header.labels_bytes ||
+      expected.sample_weights_offset != header.sample_weights_offset ||
+      expected.sample_weights_bytes != header.sample_weights_bytes ||
+      expected.scales_offset != header.scales_offset ||
+      expected.scales_bytes != header.scales_bytes) {
+    return Status::bad_header;
+  }
+  if (file_size(header) != size) {
+    return Status::bad_size;
+  }
+  return Status::ok;
+}
+
+// Calls body(offset, size) for every checksum chunk of [0, size) in
+// parallel and combines the returned chunk checksums in order.
+template <typename Body>
+uint64_t for_each_chunk(size_t size, const Body &body) {
+  const size_t chunks_count =
+      size / checksum_chunk_bytes + !!(size % checksum_chunk_bytes);
+  std::vector<uint64_t> chunk_sums(chunks_count);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, chunks_count),
+                    [&](tbb::blocked_range<size_t> r) {
+                      for (size_t index = r.begin(); index < r.end();
+                           ++index) {
+                        const size_t offset = index * checksum_chunk_bytes;
+                        chunk_sums[index] = body(
+                            offset,
+                            std::min(checksum_chunk_bytes, size - offset));
+                      }
+                    });
+  uint64_t result = mix(size ^ checksum_seed);
+  for (const auto value : chunk_sums) {
+    result = mix(result ^ value) + checksum_seed;
+  }
+  return result;
+}
+
+bool write_all(int descriptor, const void *data, size_t size, size_t offset) {
+  const char *ptr = static_cast<const char *>(data);
+  while (size) {
+    const ssize_t result = pwrite(descriptor, ptr, size, offset);
+    if (result <= 0) {
+      return false;
+    }
+    ptr += result;
+    offset += result;
+    size -= result;
+  }
+  return true;
+}
+
+} // namespace
+
+size_t dtype_size(DType dtype) {
+  switch (dtype) {
+  case DType::f32:
+    return 4;
+  case DType::f64:
+    return 8;
+  case DType::bf16:
+  case DType::f16:
+    return 2;
+  case DType::i8:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+const char *dtype_name(DType dtype) {
+  switch (dtype) {
+  case DType::f32:
+    return precision::storage_name<float>();
+  case DType::f64:
+    return precision::storage_name<double>();
+  case DType::bf16:
+    return precision::storage_name<precision::bf16>();
+  case DType::f16:
+    return precision::storage_name<precision::fp16>();
+  case DType::i8:
+    return precision::storage_name<int8_t>();
+  default:
+    return "unknown";
+  }
+}
+
+bool dtype_from_name(const char *name, DType &dtype) {
+  for (const DType value :
+       {DType::f32, DType::f64, DType::bf16, DType::f16, DType::i8}) {
+    if (std::strcmp(name, dtype_name(value)) == 0) {
+      dtype = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *status_name(Status status) {
+  switch (status) {
+  case Status::ok:
+    return "ok";
+  case Status::io_error:
+    return "I/O error";
+  case Status::bad_magic:
+    return "not a dataset file";
+  case Status::bad_version:
+    return "unsupported version";
+  case Status::bad_header:
+    return "corrupted header";
+  case Status::bad_size:
+    return "file size does not match the header";
+  case Status::bad_checksum:
+    return "checksum mismatch";
+  case Status::dtype_mismatch:
+    return "unexpected data type";
+  default:
+    return "unknown";
+  }
+}
+
+Header make_header(DType dtype, size_t rows_count, size_t columns_count,
+                   bool has_sample_weights, size_t alignment) {
+  Header header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.dtype = static_cast<uint32_t>(dtype);
+  header.rows_count = rows_count;
+  header.columns_count = columns_count;
+  header.layout = static_cast<uint32_t>(Layout::row_major);
+  header.alignment = alignment;
+  size_t offset = align_up(sizeof(Header), alignment);
+  if (dtype == DType::i8) {
+    header.scales_offset = offset;
+    header.scales_bytes = columns_count * sizeof(float);
+    offset = align_up(offset + header.scales_bytes, alignment);
+  }
+  header.features_offset = offset;
+  header.features_bytes = rows_count * columns_count * dtype_size(dtype);
+  header.labels_offset =
+      align_up(header.features_offset + header.features_bytes, alignment);
+  header.labels_bytes = rows_count * sizeof(float);
+  if (has_sample_weights) {
+    header.sample_weights_offset =
+        align_up(header.labels_offset + header.labels_bytes, alignment);
+    header.sample_weights_bytes = rows_count * sizeof(float);
+  }
+  return header;
+}
+
+size_t file_size(const Header &header) {
+  return header.sample_weights_offset
+             ? header.sample_weights_offset + header.sample_weights_bytes
+             : header.labels_offset + header.labels_bytes;
+}
+
+uint64_t checksum(const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  return for_each_chunk(size, [&](size_t offset, size_t chunk_size) {
+    return chunk_checksum(bytes + offset, chunk_size);
+  });
+}
+
+Status write(const char *filename, DType dtype, size_t rows_count,
+             size_t columns_count, const void *features, const float *labels,
+             const float *sample_weights, const float *scales) {
+  Header header = make_header(dtype, rows_count, columns_count,
+                              sample_weights != nullptr);
+  if (header.scales_offset && !scales) {
+    return Status::bad_header;
+  }
+  const int descriptor = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (descriptor < 0) {
+    return Status::io_error;
+  }
+  std::atomic<bool> ok{ftruncate(descriptor, file_size(header)) == 0};
+
+  const auto write_section = [&](const void *data, size_t size,
+                                 size_t offset) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    return for_each_chunk(size, [&](size_t chunk_offset, size_t chunk_size) {
+      if (!write_all(descriptor, bytes + chunk_offset, chunk_size,
+                     offset + chunk_offset)) {
+        ok = false;
+      }
+      return chunk_checksum(bytes + chunk_offset, chunk_size);
+    });
+  };
+  if (ok) {
+    header.features_checksum = write_section(
+        features, header.features_bytes, header.features_offset);
+    header.labels_checksum =
+        write_section(labels, header.labels_bytes, header.labels_offset);
+    if (sample_weights) {
+      header.sample_weights_checksum =
+          write_section(sample_weights, header.sample_weights_bytes,
+                        header.sample_weights_offset);
+    }
+    if (header.scales_offset) {
+      header.scales_checksum =
+          write_section(scales, header.scales_bytes, header.scales_offset);
+    }
+    header.header_checksum = header_checksum(header);
+    if (!write_all(descriptor, &header, sizeof(header), 0)) {
+      ok = false;
+    }
+  }
+  if (close(descriptor) != 0) {
+    ok = false;
+  }
+  return ok ? Status::ok : Status::io_error;
+}
+
+Status read_header(const char *filename, Header &header) {
+  const int descriptor = open(filename, O_RDONLY);
+  if (descriptor < 0) {
+    return Status::io_error;
+  }
+  struct stat file_stat;
+  const bool ok = fstat(descriptor, &file_stat) == 0 &&
+                  pread(descriptor, &header, sizeof(header), 0) ==
+                      static_cast<ssize_t>(sizeof(header));
+  close(descriptor);
+  if (!ok) {
+    return Status::bad_magic;
+  }
+  return validate(header, file_stat.st_size);
+}
+
+Status File::open(const char *filename, const MapOptions &options,
+                  bool verify) {
+  const Status status = read_header(filename, file_header);
+  if (status != Status::ok) {
+    return status;
+  }
+  mapping = MappedFile(filename, options);
+  if (!mapping.good()) {
+    return Status::io_error;
+  }
+  // The file may have changed between read_header and mmap.
+  std::memcpy(&file_header, mapping.data(), sizeof(file_header));
+  const Status mapped_status = validate(file_header, mapping.size());
+  if (mapped_status != Status::ok) {
+    mapping = MappedFile();
+    return mapped_status;
+  }
+  if (verify &&
+      (checksum(features(), file_header.features_bytes) !=
+           file_header.features_checksum ||
+       checksum(labels(), file_header.labels_bytes) !=
+           file_header.labels_checksum ||
+       (sample_weights() &&
+        checksum(sample_weights(), file_header.sample_weights_bytes) !=
+            file_header.sample_weights_checksum) ||
+       (scales() && checksum(scales(), file_header.scales_bytes) !=
+                        file_header.scales_checksum))) {
+    mapping = MappedFile();
+    return Status::bad_checksum;
+  }
+  return Status::ok;
+}
+
+Status File::create(const char *filename, DType dtype, size_t rows_count,
+                    size_t columns_count, bool has_sample_weights) {
+  file_header =
+      make_header(dtype, rows_count, columns_count, has_sample_weights);
+  mapping = MappedFile::create(filename, file_size(file_header));
+  return mapping.good() ? Status::ok : Status::io_error;
+}
+
+Status File::finalize() {
+  if (!mapping.good()) {
+    return Status::io_error;
+  }
+  file_header.features_checksum =
+      checksum(features(), file_header.features_bytes);
+  file_header.labels_checksum = checksum(labels(), file_header.labels_bytes);
+  if (sample_weights()) {
+    file_header.sample_weights_checksum =
+        checksum(sample_weights(), file_header.sample_weights_bytes);
+  }
+  if (scales()) {
+    file_header.scales_checksum = checksum(scales(), file_header.scales_bytes);
+  }
+  file_header.header_checksum = header_checksum(file_header);
+  std::memcpy(mapping.data(), &file_header, sizeof(file_header));
+  return mapping.sync() ? Status::ok : Status::io_error;
+}
+
+} // namespace format
@@ -0,0 +1,203 @@
+#ifndef FORMAT_HPP
+#define FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dataset.hpp"
+#include "precision.hpp"
+#include "structures.hpp"
+
+// Self-describing binary dataset file:
+//
+//   [header][pad][scales (int8 only)][pad][features][pad][labels]
+//   [pad][sample weights (optional)]
+//
+// Every section starts at a multiple of header.alignment, so it can be
+// mapped and read with O_DIRECT. Features are rows x cols values of `dtype`
+// in `layout` order, labels and sample weights are float32. int8 features
+// come with one float32 scale per column (see precision.hpp). Each section
+// has a checksum computed over fixed-size chunks in parallel and combined
+// in chunk order, so the value does not depend on the thread count.
+namespace format {
+
+constexpr char magic[8] = {'L', 'O', 'G', 'R', 'E', 'G', 'D', 'S'};
+constexpr uint32_t version = 2;
+constexpr uint64_t default_alignment = 4096;
+// Smallest alignment a file may declare: one cache line, which keeps every
+// section, and the float32 sections of i8 files in particular, aligned for
+// the vector loads of the kernels.
+constexpr uint64_t min_alignment = 64;
+constexpr uint64_t checksum_chunk_bytes = 1 << 20;
+
+enum class DType : uint32_t { f32 = 1, f64 = 2, bf16 = 3, f16 = 4, i8 = 5 };
+enum class Layout : uint32_t { row_major = 1 };
+
+template <typename FPType> constexpr DType dtype_of();
+template <> constexpr DType dtype_of<float>() { return DType::f32; }
+template <> constexpr DType dtype_of<double>() { return DType::f64; }
+template <> constexpr DType dtype_of<precision::bf16>() { return DType::bf16; }
+template <> constexpr DType dtype_of<precision::fp16>() { return DType::f16; }
+template <> constexpr DType dtype_of<int8_t>() { return DType::i8; }
+
+// 0 for unknown types.
+size_t dtype_size(DType dtype);
+
+const char *dtype_name(DType dtype);
+
+// Parses a dtype_name() value; returns false for unknown names.
+bool dtype_from_name(const char *name, DType &dtype);
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t dtype;
+  uint64_t rows_count;
+  uint64_t columns_count;
+  uint32_t layout;
+  uint32_t alignment;
+  uint64_t features_offset;
+  uint64_t features_bytes;
+  uint64_t labels_offset;
+  uint64_t labels_bytes;
+  uint64_t sample_weights_offset; // 0 when there are no sample weights
+  uint64_t sample_weights_bytes;
+  uint64_t features_checksum;
+  uint64_t labels_checksum;
+  uint64_t sample_weights_checksum;
+  uint64_t scales_offset; // 0 unless dtype is i8
+  uint64_t scales_bytes;
+  uint64_t scales_checksum;
+  uint64_t header_checksum; // Of all the fields above
+};
+
+enum class Status {
+  ok,
+  io_error,
+  bad_magic,
+  bad_version,
+  bad_header,
+  bad_size,
+  bad_checksum,
+  dtype_mismatch
+};
+
+const char *status_name(Status status);
+
+// Fills magic, version, shape and section offsets; checksums are zero.
+// alignment is a power of two of at least min_alignment.
+Header make_header(DType dtype, size_t rows_count, size_t columns_count,
+                   bool has_sample_weights,
+                   size_t alignment = default_alignment);
+
+size_t file_size(const Header &header);
+
+// Checksum of a buffer, computed over checksum_chunk_bytes chunks in
+// parallel. Not cryptographic: it detects truncation, corruption and
+// misinterpreted files.
+uint64_t checksum(const void *data, size_t size);
+
+// Writes a complete file: sections are split into chunks written with
+// pwrite in parallel, checksums are computed on the same pass. The header
+// goes last, so an interrupted write leaves an invalid file.
+// sample_weights may be null; scales are required for i8 and ignored
+// otherwise.
+Status write(const char *filename, DType dtype, size_t rows_count,
+             size_t columns_count, const void *features, const float *labels,
+             const float *sample_weights, const float *scales = nullptr);
+
+template <typename FPType>
+Status write(const char *filename, const DataView<FPType> &data,
+             const float *labels, const float *sample_weights = nullptr) {
+  return write(filename, dtype_of<FPType>(), data.meta.rows_count,
+               data.meta.columns_count, data.data, labels, sample_weights);
+}
+
+template <typename Storage>
+Status write(const char *filename,
+             const precision::QuantizedView<Storage> &data,
+             const float *labels, const float *sample_weights = nullptr) {
+  return write(filename, dtype_of<Storage>(), data.meta.rows_count,
+               data.meta.columns_count, data.data, labels, sample_weights,
+               data.scales);
+}
+
+// Reads and validates the header against the file size.
+Status read_header(const char *filename, Header &header);
+
+// A validated file mapped into memory.
+class File {
+public:
+  File() = default;
+
+  // Maps filename and validates the header; with verify == true the
+  // section checksums are checked too (in parallel, this reads the file).
+  Status open(const char *filename, const MapOptions &options = {},
+              bool verify = true);
+
+  // Creates a file of the given shape mapped for writing. Fill features(),
+  // labels() and sample_weights(), then call finalize().
+  Status create(const char *filename, DType dtype, size_t rows_count,
+                size_t columns_count, bool has_sample_weights);
+  // Computes the checksums, writes the header and syncs the mapping.
+  Status finalize();
+
+  const Header &header() const { return file_header; }
+  bool good() const { return mapping.good(); }
+
+  const void *features() const { return section(file_header.features_offset); }
+  void *features() { return section(file_header.features_offset); }
+  const float *labels() const {
+    return static_cast<const float *>(section(file_header.labels_offset));
+  }
+  float *labels() {
+    return static_cast<float *>(section(file_header.labels_offset));
+  }
+  // Null when the file has no sample weights.
+  const float *sample_weights() const {
+    return static_cast<const float *>(
+        section(file_header.sample_weights_offset));
+  }
+  float *sample_weights() {
+    return static_cast<float *>(section(file_header.sample_weights_offset));
+  }
+  // Column scales of i8 features, null for other types.
+  const float *scales() const {
+    return static_cast<const float *>(section(file_header.scales_offset));
+  }
+  float *scales() {
+    return static_cast<float *>(section(file_header.scales_offset));
+  }
+
+  template <typename FPType> DataView<FPType> view(const Meta &meta) const {
+    Meta result = meta;
+    result.rows_count = file_header.rows_count;
+    result.columns_count = file_header.columns_count;
+    return DataView<FPType>{static_cast<const FPType *>(features()), result};
+  }
+
+  template <typename Storage>
+  precision::QuantizedView<Storage> quantized_view(const Meta &meta) const {
+    Meta result = meta;
+    result.rows_count = file_header.rows_count;
+    result.columns_count = file_header.columns_count;
+    return precision::QuantizedView<Storage>{
+        static_cast<const Storage *>(features()), scales(), result};
+  }
+
+private:
+  const void *section(uint64_t offset) const {
+    return offset ? static_cast<const char *>(mapping.data()) + offset
+                  : nullptr;
+  }
+  void *section(uint64_t offset) {
+    return offset ? static_cast<char *>(mapping.data()) + offset : nullptr;
+  }
+
+  Header file_header{};
+  MappedFile mapping{};
+};
+
+} // namespace format
+
+#endif
@@ -11,3 +11,36 @@ void call_gemv<float>(const CBLAS_TRANSPOSE trans, const MKL_INT m,
   cblas_sgemv(CBLAS_LAYOUT::CblasRowMajor, trans, m, n, alpha, a, lda, x, incx,
               beta, y, incy);
 }
+
+template <>
+void call_gemv<double>(const CBLAS_TRANSPOSE trans, const MKL_INT m,
+                       const MKL_INT n, const double alpha, const double *a,
+                       const MKL_INT lda, const double *x, const double beta,
+                       double *y) {
+  MKL_INT incx = 1;
+  MKL_INT incy = 1;
+  cblas_dgemv(CBLAS_LAYOUT::CblasRowMajor, trans, m, n, alpha, a, lda, x, incx,
+              beta, y, incy);
+}
+
+template <>
+void call_gemm<float>(const CBLAS_TRANSPOSE trans_a,
+                      const CBLAS_TRANSPOSE trans_b, const MKL_INT m,
+                      const MKL_INT n, const MKL_INT k, const float alpha,
+                      const float *a, const MKL_INT lda, const float *b,
+                      const MKL_INT ldb, const float beta, float *c,
+                      const MKL_INT ldc) {
+  cblas_sgemm(CBLAS_LAYOUT::CblasRowMajor, trans_a, trans_b, m, n, k, alpha, a,
+              lda, b, ldb, beta, c, ldc);
+}
+
+template <>
+void call_gemm<double>(const CBLAS_TRANSPOSE trans_a,
+                       const CBLAS_TRANSPOSE trans_b, const MKL_INT m,
+                       const MKL_INT n, const MKL_INT k, const double alpha,
+                       const double *a, const MKL_INT lda, const double *b,
+                       const MKL_INT ldb, const double beta, double *c,
+                       const MKL_INT ldc) {
+  cblas_dgemm(CBLAS_LAYOUT::CblasRowMajor, trans_a, trans_b, m, n, k, alpha, a,
+              lda, b, ldb, beta, c, ldc);
+}
@@ -1,13 +1,17 @@
 #ifndef LOGREG_HPP
 #define LOGREG_HPP
 
+#include <algorithm>
 #include <cmath>
 
 #include <mkl.h>
 #include <tbb/tbb.h>
 
+#include "stats.hpp"
 #include "structures.hpp"
 #include "verbose.hpp"
+#include "vmath.hpp"
+#include "workspace.hpp"
 
 constexpr double eps = 1e-7;
 
@@ -16,6 +20,14 @@ void call_gemv(const CBLAS_TRANSPOSE trans, const MKL_INT m, const MKL_INT n,
                const FPType alpha, const FPType *a, const MKL_INT lda,
                const FPType *x, const FPType beta, FPType *y);
 
+// Row-major C = alpha * op(A) * op(B) + beta * C, op(A): m x k, op(B): k x n.
+template <typename FPType>
+void call_gemm(const CBLAS_TRANSPOSE trans_a, const CBLAS_TRANSPOSE trans_b,
+               const MKL_INT m, const MKL_INT n, const MKL_INT k,
+               const FPType alpha, const FPType *a, const MKL_INT lda,
+               const FPType *b, const MKL_INT ldb, const FPType beta,
+               FPType *c, const MKL_INT ldc);
+
 template <typename FPType> inline FPType sigmoid(FPType value) {
   return 1. / (1. + std::exp(-value));
 }
@@ -24,39 +36,40 @@ namespace logreg_noopt {
 
 // Dimensions note. Data: rows x cols, weights: cols
 template <typename FPType>
-ForwardResult<FPType> forward(const Meta &meta, const std::vector<FPType> &data,
-                              const std::vector<FPType> &weights,
-                              const std::vector<float> &groundTruth,
-                              const FPType beta_weight, const bool verbosity) {
-  ForwardResult<FPType> result(meta.rows_count);
-  const size_t rows_in_block =
-      meta.l2_cache_size * 0.8 / (meta.columns_count * sizeof(FPType));
+void forward(const Meta &meta, const FPType *data, const FPType *weights,
+             const float *groundTruth, const FPType beta_weight,
+             LogRegWorkspace<FPType> &workspace, const bool verbosity) {
+  using Workspace = LogRegWorkspace<FPType>;
+  stats::PassTimer pass;
+  workspace.reset_forward();
+  const size_t rows_in_block = workspace.rows_in_block;
   const size_t blocks_count =
       meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
-  using TLS = tbb::enumerable_thread_specific<FPType>;
-  TLS tls(static_cast<FPType>(0.));
 
-  tbb::parallel_for(
+  workspace.parallel_for(
       tbb::blocked_range<int>(0, blocks_count),
       [&](tbb::blocked_range<int> r) {
-        typename TLS::reference local_logloss = tls.local();
+        typename Workspace::ThreadLocal &local = workspace.tls.local();
+        auto &local_logloss = local.logloss;
         for (int block_index = r.begin(); block_index < r.end();
              ++block_index) {
           const size_t start_row = rows_in_block * block_index;
-          const FPType *data_ptr = data.data() + start_row * meta.columns_count;
-          FPType *result_ptr = result.sigm.data() + start_row;
-          const FPType *gt_ptr = groundTruth.data() + start_row;
+          const FPType *data_ptr = data + start_row * meta.columns_count;
+          FPType *result_ptr = workspace.sigm_block(local, start_row);
+          const float *gt_ptr = groundTruth + start_row;
           const size_t rows_to_process =
               block_index + 1 == blocks_count
                   ? meta.rows_count - rows_in_block * block_index
                   : rows_in_block;
+          stats::BlockTimer timer(rows_to_process);
 
           constexpr CBLAS_TRANSPOSE trans = CBLAS_TRANSPOSE::CblasNoTrans;
           constexpr FPType alpha = 1.;
           const MKL_INT lda = meta.columns_count;
           constexpr FPType beta = 0.;
           call_gemv<FPType>(trans, rows_to_process, meta.columns_count, alpha,
-                            data_ptr, lda, weights.data(), beta, result_ptr);
+                            data_ptr, lda, weights, beta, result_ptr);
+          timer.lap(stats::Phase::gemv_n);
 
           for (size_t row_index = 0; row_index < rows_to_process; ++row_index) {
             result_ptr[row_index] += beta_weight;
@@ -66,39 +79,56 @@ ForwardResult<FPType> forward(const Meta &meta, const std::vector<FPType> &data,
                 (-gt_ptr[row_index] * std::log(local_value + eps) -
                  (1 - gt_ptr[row_index]) * std::log(1 - local_value + eps));
           }
+          timer.lap(stats::Phase::elementwise);
         }
-      },
-      tbb::static_partitioner());
+      });
 
-  for (auto &value : tls) {
-    result.logloss += value;
-  }
-  return result;
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce_forward();
 }
 
 template <typename FPType>
-GradientResult<FPType>
-gradient(const Meta &meta, const std::vector<FPType> &data,
-         const std::vector<FPType> &weights,
-         const std::vector<float> &groundTruth, const FPType beta,
-         const ForwardResult<FPType> &forward_result, bool verbosity) {
-  GradientResult<FPType> result(meta.columns_count);
-  const size_t rows_in_block =
-      meta.l2_cache_size * 0.8 / (meta.columns_count * sizeof(FPType));
+ForwardResult<FPType> forward(const Meta &meta, const std::vector<FPType> &data,
+                              const std::vector<FPType> &weights,
+                              const std::vector<float> &groundTruth,
+                              const FPType beta_weight, const bool verbosity) {
+  LogRegWorkspace<FPType> workspace(meta);
+  forward<FPType>(meta, data.data(), weights.data(), groundTruth.data(),
+                  beta_weight, workspace, verbosity);
+  return std::move(workspace.forward);
+}
+
+template <typename FPType>
+ForwardResult<FPType> forward(const DataView<FPType> &data,
+                              const std::vector<FPType> &weights,
+                              const std::vector<float> &groundTruth,
+                              const FPType beta_weight, const bool verbosity) {
+  LogRegWorkspace<FPType> workspace(data.meta);
+  forward<FPType>(data.meta, data.data, weights.data(), groundTruth.data(),
+                  beta_weight, workspace, verbosity);
+  return std::move(workspace.forward);
+}
+
+// sigm holds the forward() output for all rows, e.g. workspace.forward.sigm
+// of a workspace that materializes it.
+template <typename FPType>
+void gradient(const Meta &meta, const FPType *data, const FPType *weights,
+              const float *groundTruth, const FPType beta, const FPType *sigm,
+              LogRegWorkspace<FPType> &workspace, bool verbosity) {
+  using Workspace = LogRegWorkspace<FPType>;
+  stats::PassTimer pass;
+  workspace.reset_gradient();
+  const size_t rows_in_block = workspace.rows_in_block;
   const size_t blocks_count =
       meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
 
-  using TLS = tbb::enumerable_thread_specific<
-      std::tuple<std::vector<FPType>, std::vector<FPType>, FPType>>;
-  TLS tls_local_grad(std::make_tuple(std::vector<FPType>(meta.columns_count),
-                                     std::vector<FPType>(rows_in_block),
-                                     static_cast<FPType>(0)));
-  tbb::parallel_for(
+  workspace.parallel_for(
       tbb::blocked_range<int>(0, blocks_count),
       [&](tbb::blocked_range<int> r) {
-        typename TLS::reference local_tls = tls_local_grad.local();
-        auto &[local_grad, local_sigm_logloss_derivatives, local_beta] =
-            local_tls;
+        typename Workspace::ThreadLocal &local = workspace.tls.local();
+        auto &local_grad = local.gradient;
+        auto &local_sigm_logloss_derivatives = local.derivatives;
+        auto &local_beta = local.beta_gradient;
 
         for (int block_index = r.begin(); block_index < r.end();
              ++block_index) {
@@ -107,16 +137,19 @@ gradient(const Meta &meta, const std::vector<FPType> &data,
               block_index + 1 == blocks_count
                   ? meta.rows_count - rows_in_block * block_index
                   : rows_in_block;
-          const FPType *data_ptr = data.data() + start_row * meta.columns_count;
+          stats::BlockTimer timer(rows_to_process);
+          const FPType *data_ptr = data + start_row * meta.columns_count;
           for (size_t index = 0; index < rows_to_process; ++index) {
             const auto abs_index = start_row + index;
-            const auto &sigm = forward_result.sigm[abs_index];
+            const auto &sigm_value = sigm[abs_index];
             const auto &gt = groundTruth[abs_index];
             local_sigm_logloss_derivatives[index] =
-                sigm * (1 - sigm) *                   // Sigm derivative
-                (-gt / sigm - (1 - gt) / (1 - sigm)); // LogLoss derivative
+                sigm_value * (1 - sigm_value) * // Sigm derivative
+                (-gt / sigm_value +
+                 (1 - gt) / (1 - sigm_value)); // LogLoss derivative
             local_beta += local_sigm_logloss_derivatives[index];
           }
+          timer.lap(stats::Phase::elementwise);
 
           constexpr CBLAS_TRANSPOSE trans = CBLAS_TRANSPOSE::CblasTrans;
           constexpr FPType alpha = 1.;
@@ -125,112 +158,199 @@ gradient(const Meta &meta, const std::vector<FPType> &data,
           call_gemv<FPType>(
               trans, rows_to_process, meta.columns_count, alpha, data_ptr, lda,
               local_sigm_logloss_derivatives.data(), beta, local_grad.data());
+          timer.lap(stats::Phase::gemv_t);
         }
-      },
-      tbb::static_partitioner());
-
-  for (auto &[local_grad, local_sigm_logloss_derivatives, local_beta] :
-       tls_local_grad) {
-    for (size_t index = 0; index < meta.columns_count; ++index) {
-      result.weights_gradient[index] += local_grad[index];
-    }
-    result.beta_gradient += local_beta;
-  }
-  return result;
+      });
+
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce_gradient();
+}
+
+template <typename FPType>
+GradientResult<FPType>
+gradient(const Meta &meta, const std::vector<FPType> &data,
+         const std::vector<FPType> &weights,
+         const std::vector<float> &groundTruth, const FPType beta,
+         const ForwardResult<FPType> &forward_result, bool verbosity) {
+  LogRegWorkspace<FPType> workspace(meta, false);
+  gradient<FPType>(meta, data.data(), weights.data(), groundTruth.data(), beta,
+                   forward_result.sigm.data(), workspace, verbosity);
+  return std::move(workspace.gradient);
+}
+
+template <typename FPType>
+GradientResult<FPType>
+gradient(const DataView<FPType> &data, const std::vector<FPType> &weights,
+         const std::vector<float> &groundTruth, const FPType beta,
+         const ForwardResult<FPType> &forward_result, bool verbosity) {
+  LogRegWorkspace<FPType> workspace(data.meta, false);
+  gradient<FPType>(data.meta, data.data, weights.data(), groundTruth.data(),
+                   beta, forward_result.sigm.data(), workspace, verbosity);
+  return std::move(workspace.gradient);
 }
 
 } // namespace logreg_noopt
 
 namespace logreg_opt {
 
+// Adds the rows of `meta` to the thread-local accumulators of the workspace
+// without resetting or reducing them, so a pass can be split into chunks.
+// first_row is the index of the first row of data in the whole dataset and
+// selects where materialized sigmoid values go.
 template <typename FPType>
-std::pair<ForwardResult<FPType>, GradientResult<FPType>>
-forward_and_gradient(const Meta &meta, const std::vector<FPType> &data,
-                     const std::vector<FPType> &weights,
-                     const std::vector<float> &groundTruth,
-                     const FPType beta_weight, const bool verbosity) {
-  ForwardResult<FPType> result_forward(meta.rows_count);
-  GradientResult<FPType> result_gradient(meta.columns_count);
-  const size_t rows_in_block =
-      meta.l2_cache_size * 0.8 / (meta.columns_count * sizeof(FPType));
+void accumulate_forward_and_gradient(const Meta &meta, const FPType *data,
+                                     const FPType *weights,
+                                     const float *groundTruth,
+                                     const FPType beta_weight,
+                                     const size_t first_row,
+                                     LogRegWorkspace<FPType> &workspace) {
+  using Workspace = LogRegWorkspace<FPType>;
+  const size_t rows_in_block = workspace.rows_in_block;
   const size_t blocks_count =
       meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
-  using TLS = tbb::enumerable_thread_specific<
-      std::tuple<std::vector<FPType>, std::vector<FPType>, FPType, FPType>>;
-  TLS tls(std::make_tuple(std::vector<FPType>(meta.columns_count),
-                          std::vector<FPType>(rows_in_block),
-                          static_cast<FPType>(0.), static_cast<FPType>(.0)));
 
-  tbb::parallel_for(
-      tbb::blocked_range<int>(0, blocks_count),
-      [&](tbb::blocked_range<int> r) {
-        typename TLS::reference local_tls = tls.local();
-        auto &[local_grad, local_sigm_logloss_derivatives, local_beta,
-               local_logloss] = local_tls;
-        for (int block_index = r.begin(); block_index < r.end();
-             ++block_index) {
+  workspace.for_each_block(
+      blocks_count,
+      [&](size_t block_index, typename Workspace::ThreadLocal &local,
+          FPType *gradient, double &logloss, double &beta_gradient) {
+        auto &local_sigm_logloss_derivatives = local.derivatives;
 
-          // Calculate forward
-          const size_t start_row = rows_in_block * block_index;
-          const FPType *data_ptr = data.data() + start_row * meta.columns_count;
-          FPType *result_ptr = result_forward.sigm.data() + start_row;
-          const FPType *gt_ptr = groundTruth.data() + start_row;
-          const size_t rows_to_process =
-              block_index + 1 == blocks_count
-                  ? meta.rows_count - rows_in_block * block_index
-                  : rows_in_block;
+        // Calculate forward
+        const size_t start_row = rows_in_block * block_index;
+        const FPType *data_ptr = data + start_row * meta.columns_count;
+        FPType *result_ptr = workspace.sigm_block(local, first_row + start_row);
+        const float *gt_ptr = groundTruth + start_row;
+        const size_t rows_to_process =
+            block_index + 1 == blocks_count
+                ? meta.rows_count - rows_in_block * block_index
+                : rows_in_block;
+        stats::BlockTimer timer(rows_to_process);
 
-          {
-            constexpr CBLAS_TRANSPOSE trans = CBLAS_TRANSPOSE::CblasNoTrans;
-            constexpr FPType alpha = 1.;
-            const MKL_INT lda = meta.columns_count;
-            constexpr FPType beta = 0.;
-            call_gemv<FPType>(trans, rows_to_process, meta.columns_count, alpha,
-                              data_ptr, lda, weights.data(), beta, result_ptr);
-          }
+        {
+          constexpr CBLAS_TRANSPOSE trans = CBLAS_TRANSPOSE::CblasNoTrans;
+          constexpr FPType alpha = 1.;
+          const MKL_INT lda = meta.columns_count;
+          constexpr FPType beta = 0.;
+          call_gemv<FPType>(trans, rows_to_process, meta.columns_count, alpha,
+                            data_ptr, lda, weights, beta, result_ptr);
+        }
+        timer.lap(stats::Phase::gemv_n);
 
-          for (size_t row_index = 0; row_index < rows_to_process; ++row_index) {
-            result_ptr[row_index] += beta_weight;
-            result_ptr[row_index] = sigmoid(result_ptr[row_index]);
-            const FPType local_value = result_ptr[row_index];
-            local_logloss +=
-                (-gt_ptr[row_index] * std::log(local_value + eps) -
-                 (1 - gt_ptr[row_index]) * std::log(1 - local_value + eps));
-          }
+        // Sigmoid, loss and derivatives (vmath.hpp); the sigmoid values
+        // overwrite the logits.
+        vmath::logistic(rows_to_process, result_ptr, beta_weight, gt_ptr,
+                        result_ptr, local_sigm_logloss_derivatives.data(),
+                        logloss, beta_gradient);
+        if (workspace.track_quality) {
+          local.quality.add(rows_to_process, result_ptr, gt_ptr);
+        }
+        timer.lap(stats::Phase::elementwise);
 
-          // Calculate gradient
-          for (size_t index = 0; index < rows_to_process; ++index) {
-            const auto &sigm = result_ptr[index];
-            const auto &gt = gt_ptr[index];
-            local_sigm_logloss_derivatives[index] =
-                sigm * (1 - sigm) *                   // Sigm derivative
-                (-gt / sigm - (1 - gt) / (1 - sigm)); // LogLoss derivative
-            local_beta += local_sigm_logloss_derivatives[index];
-          }
-          {
-            constexpr CBLAS_TRANSPOSE trans = CBLAS_TRANSPOSE::CblasTrans;
-            constexpr FPType alpha = 1.;
-            const MKL_INT lda = meta.columns_count;
-            constexpr FPType beta = 1.;
-            call_gemv<FPType>(trans, rows_to_process, meta.columns_count, alpha,
-                              data_ptr, lda,
-                              local_sigm_logloss_derivatives.data(), beta,
-                              local_grad.data());
-          }
+        // Calculate gradient
+        {
+          constexpr CBLAS_TRANSPOSE trans = CBLAS_TRANSPOSE::CblasTrans;
+          constexpr FPType alpha = 1.;
+          const MKL_INT lda = meta.columns_count;
+          constexpr FPType beta = 1.;
+          call_gemv<FPType>(trans, rows_to_process, meta.columns_count, alpha,
+                            data_ptr, lda,
+                            local_sigm_logloss_derivatives.data(), beta,
+                            gradient);
         }
-      },
-      tbb::static_partitioner());
-
-  for (auto &[local_grad, local_sigm_logloss_derivatives, local_beta,
-              local_logloss] : tls) {
-    for (size_t index = 0; index < meta.columns_count; ++index) {
-      result_gradient.weights_gradient[index] += local_grad[index];
-    }
-    result_gradient.beta_gradient += local_beta;
-    result_forward.logloss += local_logloss;
-  }
-
-  return std::make_pair(result_forward, result_gradient);
+        timer.lap(stats::Phase::gemv_t);
+      });
+}
+
+// In-place variant: the results are left in workspace.forward and
+// workspace.gradient. Lets outer loops (see trainer.hpp) reuse all buffers
+// and run over a sub-range of rows.
+template <typename FPType>
+void forward_and_gradient(const Meta &meta, const FPType *data,
+                          const FPType *weights, const float *groundTruth,
+                          const FPType beta_weight,
+                          LogRegWorkspace<FPType> &workspace,
+                          const bool verbosity) {
+  stats::PassTimer pass;
+  workspace.reset();
+  accumulate_forward_and_gradient<FPType>(meta, data, weights, groundTruth,
+                                          beta_weight, 0, workspace);
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce();
+}
+
+// Loss (and quality, with workspace.track_quality) without the gradient:
+// the gemv-N half of the pass, e.g. for a validation split. Leaves the
+// thread-local gradient accumulators untouched.
+template <typename FPType>
+void forward(const Meta &meta, const FPType *data, const FPType *weights,
+             const float *groundTruth, const FPType beta_weight,
+             LogRegWorkspace<FPType> &workspace, const bool verbosity) {
+  using Workspace = LogRegWorkspace<FPType>;
+  const size_t rows_in_block = workspace.rows_in_block;
+  const size_t blocks_count =
+      meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
+
+  stats::PassTimer pass;
+  workspace.reset_forward();
+  workspace.for_each_block(
+      blocks_count,
+      [&](size_t block_index, typename Workspace::ThreadLocal &local,
+          FPType *, double &logloss, double &) {
+        const size_t start_row = rows_in_block * block_index;
+        const FPType *data_ptr = data + start_row * meta.columns_count;
+        FPType *result_ptr = workspace.sigm_block(local, start_row);
+        const float *gt_ptr = groundTruth + start_row;
+        const size_t rows_to_process =
+            block_index + 1 == blocks_count
+                ? meta.rows_count - rows_in_block * block_index
+                : rows_in_block;
+        stats::BlockTimer timer(rows_to_process);
+
+        call_gemv<FPType>(CblasNoTrans, rows_to_process, meta.columns_count,
+                          1., data_ptr, meta.columns_count, weights, 0.,
+                          result_ptr);
+        timer.lap(stats::Phase::gemv_n);
+
+        // The beta gradient goes nowhere: reset_forward() does not clear it.
+        double unused_beta = 0;
+        vmath::logistic(rows_to_process, result_ptr, beta_weight, gt_ptr,
+                        result_ptr, local.derivatives.data(), logloss,
+                        unused_beta);
+        if (workspace.track_quality) {
+          local.quality.add(rows_to_process, result_ptr, gt_ptr);
+        }
+        timer.lap(stats::Phase::elementwise);
+      });
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce_forward();
+}
+
+template <typename FPType>
+std::pair<ForwardResult<FPType>, GradientResult<FPType>>
+forward_and_gradient(const Meta &meta, const std::vector<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth,
+                     const FPType beta_weight, const bool verbosity) {
+  LogRegWorkspace<FPType> workspace(meta);
+  forward_and_gradient<FPType>(meta, data.data(), weights.data(),
+                               groundTruth.data(), beta_weight, workspace,
+                               verbosity);
+  return std::make_pair(std::move(workspace.forward),
+                        std::move(workspace.gradient));
+}
+
+template <typename FPType>
+std::pair<ForwardResult<FPType>, GradientResult<FPType>>
+forward_and_gradient(const DataView<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth,
+                     const FPType beta_weight, const bool verbosity) {
+  LogRegWorkspace<FPType> workspace(data.meta);
+  forward_and_gradient<FPType>(data.meta, data.data, weights.data(),
+                               groundTruth.data(), beta_weight, workspace,
+                               verbosity);
+  return std::make_pair(std::move(workspace.forward),
+                        std::move(workspace.gradient));
 }
 
 } // namespace logreg_opt
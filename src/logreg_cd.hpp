@@ -0,0 +1,460 @@
+#ifndef LOGREG_CD_HPP
+#define LOGREG_CD_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <tbb/tbb.h>
+
+#include "optimizers.hpp"
+#include "sparse.hpp"
+#include "structures.hpp"
+#include "verbose.hpp"
+#include "workspace.hpp"
+
+// Coordinate descent for elastic-net logistic regression:
+//
+//   mean logloss + l1 * |w|_1 + l2 / 2 * |w|^2   (beta is not penalized)
+//
+// in the style of glmnet. An outer iteration fixes the quadratic
+// approximation of the loss at the current logits z (weights
+// W = sigm * (1 - sigm), residuals y - sigm); coordinate sweeps then solve
+// the penalized quadratic problem. Every coordinate update reads one column:
+// a dot product for its gradient and, when the weight moves, one update of
+// the weighted residuals and of z. z is kept up to date incrementally, so
+// the exp of every row is recomputed once per outer iteration, not per
+// coordinate. The data is held column-major (DenseColumns) or as CSC
+// (SparseColumns), so a column is a contiguous read.
+//
+// Only a few columns are touched per sweep:
+//   - sequential strong rule: columns with |gradient| < 2 * l1 - lambda,
+//     lambda the largest |gradient| at the start, are left out of the
+//     sweeps;
+//   - active set: after a sweep over the strong set, sweeps run over the
+//     non-zero weights only until they converge, then the strong set is
+//     swept again;
+//   - at convergence the KKT conditions of all the excluded columns are
+//     checked with one read of them; violators join the strong set and the
+//     iterations go on.
+// Report::passes counts the values read over the values of the data, so it
+// compares directly with the one pass per epoch of full-batch methods.
+namespace logreg_cd {
+
+// Column-major copy of dense rows: column c is values[c * rows_count ...].
+template <typename FPType> struct DenseColumns {
+  size_t rows_count = 0;
+  size_t columns_count = 0;
+  aligned_vector<FPType> values{};
+
+  // Transposed by 64 x 64 tiles, in parallel.
+  static DenseColumns from(const DataView<FPType> &data) {
+    constexpr size_t tile = 64;
+    DenseColumns result;
+    result.rows_count = data.meta.rows_count;
+    result.columns_count = data.meta.columns_count;
+    result.values.resize(result.rows_count * result.columns_count);
+    tbb::parallel_for(
+        tbb::blocked_range2d<size_t>(0, result.rows_count, tile, 0,
+                                     result.columns_count, tile),
+        [&](const tbb::blocked_range2d<size_t> &r) {
+          for (size_t row = r.rows().begin(); row < r.rows().end(); ++row) {
+            const FPType *row_ptr = data.row(row);
+            for (size_t column = r.cols().begin(); column < r.cols().end();
+                 ++column) {
+              result.values[column * result.rows_count + row] =
+                  row_ptr[column];
+            }
+          }
+        });
+    return result;
+  }
+
+  size_t nnz() const { return values.size(); }
+  size_t nonzeros(size_t) const { return rows_count; }
+
+  double dot(const size_t column, const FPType *vector) const {
+    const FPType *column_ptr = values.data() + column * rows_count;
+    double sum = 0;
+    for (size_t row = 0; row < rows_count; ++row) {
+      sum += column_ptr[row] * vector[row];
+    }
+    return sum;
+  }
+
+  // sum of weights * x^2 over the column.
+  double weighted_squares(const size_t column, const FPType *weights) const {
+    const FPType *column_ptr = values.data() + column * rows_count;
+    double sum = 0;
+    for (size_t row = 0; row < rows_count; ++row) {
+      sum += weights[row] * column_ptr[row] * column_ptr[row];
+    }
+    return sum;
+  }
+
+  // residuals -= delta * weights * x, logits += delta * x.
+  void update(const size_t column, const FPType delta, const FPType *weights,
+              FPType *residuals, FPType *logits) const {
+    const FPType *column_ptr = values.data() + column * rows_count;
+    for (size_t row = 0; row < rows_count; ++row) {
+      const FPType step = delta * column_ptr[row];
+      residuals[row] -= step * weights[row];
+      logits[row] += step;
+    }
+  }
+};
+
+// Compressed sparse columns: the non-zeros of column c are
+// values[offsets[c] ... offsets[c + 1]) in the rows `rows`, sorted.
+template <typename FPType> struct SparseColumns {
+  size_t rows_count = 0;
+  size_t columns_count = 0;
+  std::vector<size_t> offsets{};
+  std::vector<uint32_t> rows{};
+  std::vector<FPType> values{};
+
+  // Counting sort of the CSR entries by column; rows stay sorted.
+  static SparseColumns from(const CSRView<FPType> &data) {
+    SparseColumns result;
+    result.rows_count = data.meta.rows_count;
+    result.columns_count = data.meta.columns_count;
+    result.offsets.assign(result.columns_count + 1, 0);
+    for (size_t index = 0; index < data.nnz(); ++index) {
+      ++result.offsets[data.columns[index] + 1];
+    }
+    for (size_t column = 0; column < result.columns_count; ++column) {
+      result.offsets[column + 1] += result.offsets[column];
+    }
+    result.rows.resize(data.nnz());
+    result.values.resize(data.nnz());
+    std::vector<size_t> position(result.offsets.begin(),
+                                 result.offsets.end() - 1);
+    for (size_t row = 0; row < result.rows_count; ++row) {
+      for (size_t index = data.row_offsets[row];
+           index < data.row_offsets[row + 1]; ++index) {
+        const size_t target = position[data.columns[index]]++;
+        result.rows[target] = row;
+        result.values[target] = data.values[index];
+      }
+    }
+    return result;
+  }
+
+  size_t nnz() const { return values.size(); }
+  size_t nonzeros(size_t column) const {
+    return offsets[column + 1] - offsets[column];
+  }
+
+  double dot(const size_t column, const FPType *vector) const {
+    double sum = 0;
+    for (size_t index = offsets[column]; index < offsets[column + 1];
+         ++index) {
+      sum += values[index] * vector[rows[index]];
+    }
+    return sum;
+  }
+
+  double weighted_squares(const size_t column, const FPType *weights) const {
+    double sum = 0;
+    for (size_t index = offsets[column]; index < offsets[column + 1];
+         ++index) {
+      sum += weights[rows[index]] * values[index] * values[index];
+    }
+    return sum;
+  }
+
+  void update(const size_t column, const FPType delta, const FPType *weights,
+              FPType *residuals, FPType *logits) const {
+    for (size_t index = offsets[column]; index < offsets[column + 1];
+         ++index) {
+      const size_t row = rows[index];
+      const FPType step = delta * values[index];
+      residuals[row] -= step * weights[row];
+      logits[row] += step;
+    }
+  }
+};
+
+template <typename FPType> struct Options {
+  optimizers::ElasticNet<FPType> penalty{};
+  size_t max_iterations = 100;
+  // A sweep converged when max h_j * delta_j^2 is below this (glmnet's
+  // criterion: the change of the quadratic objective); the fit converged
+  // when the first sweep of an outer iteration does.
+  FPType tolerance = 1e-7;
+  size_t max_sweeps = 10000;
+  // Strong rule and KKT check; off sweeps all the columns.
+  bool screening = true;
+};
+
+template <typename FPType> struct Report {
+  size_t iterations = 0; // Outer iterations
+  size_t sweeps = 0;
+  size_t updates = 0; // Coordinates whose weight moved
+  double passes = 0;  // Values read / values of the data
+  size_t nonzeros = 0;
+  size_t strong_count = 0; // Columns in the strong set at the end
+  size_t kkt_violations = 0;
+  double objective = 0;
+  bool converged = false;
+  double seconds = 0;
+};
+
+// Per-row IRLS weights below this are clamped, as in glmnet, so saturated
+// rows keep a little curvature.
+constexpr double min_row_weight = 1e-5;
+
+template <typename FPType, typename Columns> class Solver {
+public:
+  Solver(const Columns &columns, Options<FPType> options = {})
+      : columns(columns), options(options), logits(columns.rows_count),
+        row_weights(columns.rows_count), residuals(columns.rows_count),
+        curvature(columns.columns_count),
+        curvature_stamp(columns.columns_count, 0),
+        strong(columns.columns_count, 0) {
+    strong_list.reserve(columns.columns_count);
+    active_list.reserve(columns.columns_count);
+  }
+
+  Report<FPType> fit(const float *groundTruth, std::vector<FPType> &weights,
+                     FPType &beta, const bool verbosity) {
+    const auto start = std::chrono::steady_clock::now();
+    Report<FPType> report;
+    touched = 0;
+    const size_t columns_count = columns.columns_count;
+    const FPType l1 = options.penalty.l1;
+
+    std::fill(logits.begin(), logits.end(), beta);
+    for (size_t column = 0; column < columns_count; ++column) {
+      if (weights[column] != 0) {
+        columns.update(column, weights[column], row_weights.data(),
+                       residuals.data(), logits.data());
+        touched += columns.nonzeros(column);
+      }
+    }
+    double loss = refresh(groundTruth);
+
+    // Strong set from the gradients at the starting point.
+    std::fill(strong.begin(), strong.end(), !options.screening);
+    if (options.screening) {
+      std::vector<FPType> &gradient = curvature;
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, columns_count),
+                        [&](tbb::blocked_range<size_t> r) {
+                          for (size_t column = r.begin(); column < r.end();
+                               ++column) {
+                            gradient[column] = std::abs(
+                                this->gradient(column, weights[column]));
+                          }
+                        });
+      touched += columns.nnz();
+      const FPType lambda =
+          columns_count
+              ? *std::max_element(gradient.begin(), gradient.end())
+              : FPType(0);
+      for (size_t column = 0; column < columns_count; ++column) {
+        strong[column] =
+            weights[column] != 0 || gradient[column] >= 2 * l1 - lambda;
+      }
+    }
+    std::fill(curvature_stamp.begin(), curvature_stamp.end(), 0);
+
+    for (; report.iterations < options.max_iterations; ++report.iterations) {
+      ++stamp;
+      fill_list(strong_list, weights, false);
+      double change = sweep(strong_list, weights, beta, report);
+      const bool quadratic_converged = change <= options.tolerance;
+      while (change > options.tolerance &&
+             report.sweeps < options.max_sweeps) {
+        do {
+          fill_list(active_list, weights, true);
+          change = sweep(active_list, weights, beta, report);
+        } while (change > options.tolerance &&
+                 report.sweeps < options.max_sweeps);
+        change = sweep(strong_list, weights, beta, report);
+      }
+      loss = refresh(groundTruth);
+      report.objective = loss / columns.rows_count +
+                         options.penalty.value(weights);
+      verbose_print(verbosity, "CD iteration ", report.iterations,
+                    ": objective ", report.objective, ", passes ",
+                    static_cast<double>(touched) / columns.nnz());
+
+      if (quadratic_converged) {
+        const size_t violations = check_kkt(weights);
+        report.kkt_violations += violations;
+        if (violations == 0) {
+          report.converged = true;
+          ++report.iterations;
+          break;
+        }
+      }
+    }
+
+    report.passes = static_cast<double>(touched) / columns.nnz();
+    report.nonzeros = std::count_if(weights.begin(), weights.end(),
+                                    [](FPType value) { return value != 0; });
+    report.strong_count = std::count(strong.begin(), strong.end(), 1);
+    report.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    verbose_print(verbosity, "CD ", report.converged ? "converged" : "stopped",
+                  " after ", report.iterations, " iterations, ",
+                  report.passes, " passes, ", report.nonzeros,
+                  " non-zero weights, time (sec) ", report.seconds);
+    return report;
+  }
+
+private:
+  // Row weights and residuals of the quadratic approximation at the current
+  // logits; returns the summed logloss there.
+  double refresh(const float *groundTruth) {
+    return tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, columns.rows_count), 0.,
+        [&](tbb::blocked_range<size_t> r, double loss) {
+          for (size_t row = r.begin(); row < r.end(); ++row) {
+            const FPType z = logits[row];
+            const FPType t = std::exp(-std::abs(z));
+            const FPType sigm = z >= 0 ? 1 / (1 + t) : t / (1 + t);
+            row_weights[row] =
+                std::max<double>(sigm * (1 - sigm), min_row_weight);
+            residuals[row] = groundTruth[row] - sigm;
+            loss += std::max(z, FPType(0)) + std::log1p(t) -
+                    groundTruth[row] * z;
+          }
+          return loss;
+        },
+        std::plus<double>());
+  }
+
+  // Gradient of the smooth part (quadratic model + L2) for one column.
+  FPType gradient(const size_t column, const FPType weight) const {
+    return -columns.dot(column, residuals.data()) / columns.rows_count +
+           options.penalty.l2 * weight;
+  }
+
+  // Strong columns, or with only_active the strong non-zero ones.
+  void fill_list(std::vector<uint32_t> &list,
+                 const std::vector<FPType> &weights, const bool only_active) {
+    list.clear();
+    for (size_t column = 0; column < columns.columns_count; ++column) {
+      if (strong[column] && (!only_active || weights[column] != 0)) {
+        list.push_back(column);
+      }
+    }
+  }
+
+  // One pass of coordinate updates over list (and beta). Returns the largest
+  // h_j * delta_j^2.
+  double sweep(const std::vector<uint32_t> &list, std::vector<FPType> &weights,
+               FPType &beta, Report<FPType> &report) {
+    const size_t rows_count = columns.rows_count;
+    const FPType l1 = options.penalty.l1;
+    const FPType l2 = options.penalty.l2;
+    double change = 0;
+    ++report.sweeps;
+
+    // Intercept: a Newton step on the quadratic model.
+    double residual_sum = 0, weight_sum = 0;
+    for (size_t row = 0; row < rows_count; ++row) {
+      residual_sum += residuals[row];
+      weight_sum += row_weights[row];
+    }
+    const FPType beta_delta = residual_sum / weight_sum;
+    if (beta_delta != 0) {
+      for (size_t row = 0; row < rows_count; ++row) {
+        residuals[row] -= beta_delta * row_weights[row];
+        logits[row] += beta_delta;
+      }
+      beta += beta_delta;
+      change = std::max(change, weight_sum / rows_count * beta_delta *
+                                    beta_delta);
+    }
+
+    for (const uint32_t column : list) {
+      if (curvature_stamp[column] != stamp) {
+        curvature[column] =
+            columns.weighted_squares(column, row_weights.data()) / rows_count;
+        curvature_stamp[column] = stamp;
+        touched += columns.nonzeros(column);
+      }
+      const FPType h = curvature[column];
+      if (!(h + l2 > 0)) {
+        // An empty column: no curvature and no gradient.
+        continue;
+      }
+      const FPType weight = weights[column];
+      const FPType g = -columns.dot(column, residuals.data()) / rows_count;
+      touched += columns.nonzeros(column);
+      const FPType updated =
+          optimizers::ElasticNet<FPType>::soft_threshold(h * weight - g, l1) /
+          (h + l2);
+      const FPType delta = updated - weight;
+      if (delta != 0) {
+        columns.update(column, delta, row_weights.data(), residuals.data(),
+                       logits.data());
+        touched += columns.nonzeros(column);
+        weights[column] = updated;
+        ++report.updates;
+        change = std::max(change, static_cast<double>(h) * delta * delta);
+      }
+    }
+    return change;
+  }
+
+  // Columns outside the strong set whose zero weight violates the
+  // optimality condition |gradient| <= l1 join it. Returns their count.
+  size_t check_kkt(const std::vector<FPType> &weights) {
+    if (!options.screening) {
+      return 0;
+    }
+    const FPType l1 = options.penalty.l1;
+    std::vector<uint8_t> violated(columns.columns_count, 0);
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, columns.columns_count),
+        [&](tbb::blocked_range<size_t> r) {
+          for (size_t column = r.begin(); column < r.end(); ++column) {
+            if (!strong[column]) {
+              violated[column] =
+                  std::abs(gradient(column, weights[column])) > l1;
+            }
+          }
+        });
+    size_t violations = 0;
+    for (size_t column = 0; column < columns.columns_count; ++column) {
+      if (!strong[column]) {
+        touched += columns.nonzeros(column);
+      }
+      if (violated[column]) {
+        strong[column] = 1;
+        ++violations;
+      }
+    }
+    return violations;
+  }
+
+  const Columns &columns;
+  const Options<FPType> options;
+  std::vector<FPType> logits, row_weights, residuals;
+  // h_j of the current quadratic model, valid when its stamp is current.
+  std::vector<FPType> curvature;
+  std::vector<size_t> curvature_stamp;
+  size_t stamp = 0;
+  std::vector<uint8_t> strong;
+  std::vector<uint32_t> strong_list, active_list;
+  size_t touched = 0;
+};
+
+template <typename FPType, typename Columns>
+Report<FPType> fit(const Columns &columns, const float *groundTruth,
+                   std::vector<FPType> &weights, FPType &beta,
+                   const Options<FPType> &options, const bool verbosity) {
+  Solver<FPType, Columns> solver(columns, options);
+  return solver.fit(groundTruth, weights, beta, verbosity);
+}
+
+} // namespace logreg_cd
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef LOGREG_FUSED_HPP
+#define LOGREG_FUSED_HPP
+
+#include <algorithm>
+#include <cmath>
+
+#include <tbb/tbb.h>
+
+#include "logreg.hpp"
+#include "precision.hpp"
+#include "simd.hpp"
+#include "stats.hpp"
+#include "structures.hpp"
+#include "verbose.hpp"
+#include "vmath.hpp"
+#include "workspace.hpp"
+
+namespace logreg_fused {
+
+// Single pass over the data: every tile of simd::tile_rows rows is used for
+// the logits and, while it is still in registers/L1, for the gradient update.
+// logreg_opt::forward_and_gradient reads each row block twice (gemv-N and
+// gemv-T), this kernel reads it once.
+//
+// Adds the rows of `meta` to the thread-local accumulators of the workspace
+// without resetting or reducing them, so a pass can be split into chunks.
+// first_row is the index of the first row of data in the whole dataset and
+// selects where materialized sigmoid values go. Storage is the element type
+// of data: FPType itself or a compressed type from precision.hpp.
+template <typename FPType, typename Storage = FPType>
+void accumulate_forward_and_gradient(const Meta &meta, const Storage *data,
+                                     const FPType *weights,
+                                     const float *groundTruth,
+                                     const FPType beta_weight,
+                                     const size_t first_row,
+                                     LogRegWorkspace<FPType> &workspace) {
+  using Workspace = LogRegWorkspace<FPType>;
+  const size_t rows_in_block = workspace.rows_in_block;
+  const size_t blocks_count =
+      meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
+
+  workspace.for_each_block(
+      blocks_count,
+      [&](size_t block_index, typename Workspace::ThreadLocal &local,
+          FPType *gradient, double &logloss, double &beta_gradient) {
+        const size_t start_row = rows_in_block * block_index;
+        const Storage *data_ptr = data + start_row * meta.columns_count;
+        FPType *result_ptr = workspace.sigm_block(local, first_row + start_row);
+        const float *gt_ptr = groundTruth + start_row;
+        const size_t rows_to_process =
+            block_index + 1 == blocks_count
+                ? meta.rows_count - rows_in_block * block_index
+                : rows_in_block;
+        stats::BlockTimer timer(rows_to_process);
+
+        FPType derivatives[simd::tile_rows];
+        for (size_t tile_start = 0; tile_start < rows_to_process;
+             tile_start += simd::tile_rows) {
+          const size_t tile =
+              std::min(simd::tile_rows, rows_to_process - tile_start);
+          const Storage *tile_ptr = data_ptr + tile_start * meta.columns_count;
+          FPType *sigm_ptr = result_ptr + tile_start;
+
+          simd::dot_tile(tile, tile_ptr, meta.columns_count, weights,
+                         meta.columns_count, sigm_ptr);
+          vmath::logistic(tile, sigm_ptr, beta_weight, gt_ptr + tile_start,
+                          sigm_ptr, derivatives, logloss, beta_gradient);
+          simd::axpy_tile(tile, tile_ptr, meta.columns_count, derivatives,
+                          meta.columns_count, gradient);
+        }
+        if (workspace.track_quality) {
+          local.quality.add(rows_to_process, result_ptr, gt_ptr);
+        }
+        timer.lap(stats::Phase::fused);
+      });
+}
+
+template <typename FPType>
+void forward_and_gradient(const Meta &meta, const FPType *data,
+                          const FPType *weights, const float *groundTruth,
+                          const FPType beta_weight,
+                          LogRegWorkspace<FPType> &workspace,
+                          const bool verbosity) {
+  stats::PassTimer pass;
+  workspace.reset();
+  accumulate_forward_and_gradient<FPType>(meta, data, weights, groundTruth,
+                                          beta_weight, 0, workspace);
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce();
+}
+
+template <typename FPType>
+std::pair<ForwardResult<FPType>, GradientResult<FPType>>
+forward_and_gradient(const Meta &meta, const std::vector<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth,
+                     const FPType beta_weight, const bool verbosity) {
+  LogRegWorkspace<FPType> workspace(meta);
+  forward_and_gradient<FPType>(meta, data.data(), weights.data(),
+                               groundTruth.data(), beta_weight, workspace,
+                               verbosity);
+  return std::make_pair(std::move(workspace.forward),
+                        std::move(workspace.gradient));
+}
+
+template <typename FPType>
+std::pair<ForwardResult<FPType>, GradientResult<FPType>>
+forward_and_gradient(const DataView<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth,
+                     const FPType beta_weight, const bool verbosity) {
+  LogRegWorkspace<FPType> workspace(data.meta);
+  forward_and_gradient<FPType>(data.meta, data.data, weights.data(),
+                               groundTruth.data(), beta_weight, workspace,
+                               verbosity);
+  return std::make_pair(std::move(workspace.forward),
+                        std::move(workspace.gradient));
+}
+
+// Compressed features (bf16, fp16 or per-column scaled int8), float math.
+// For int8 the weights are multiplied by the column scales once per call and
+// the gradient is scaled back after the reduction, so the inner loops only
+// convert and never multiply by the scale.
+template <typename Storage>
+void forward_and_gradient(const precision::QuantizedView<Storage> &data,
+                          const float *weights, const float *groundTruth,
+                          const float beta_weight,
+                          LogRegWorkspace<float> &workspace,
+                          const bool verbosity) {
+  const size_t columns_count = data.meta.columns_count;
+  const float *kernel_weights = weights;
+  if (data.scales) {
+    for (size_t index = 0; index < columns_count; ++index) {
+      workspace.scaled_weights[index] = weights[index] * data.scales[index];
+    }
+    kernel_weights = workspace.scaled_weights.data();
+  }
+  stats::PassTimer pass;
+  workspace.reset();
+  accumulate_forward_and_gradient<float, Storage>(
+      data.meta, data.data, kernel_weights, groundTruth, beta_weight, 0,
+      workspace);
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce();
+  if (data.scales) {
+    for (size_t index = 0; index < columns_count; ++index) {
+      workspace.gradient.weights_gradient[index] *= data.scales[index];
+    }
+  }
+}
+
+} // namespace logreg_fused
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef LOGREG_HESSIAN_HPP
+#define LOGREG_HESSIAN_HPP
+
+#include <mkl.h>
+#include <tbb/tbb.h>
+
+#include "logreg.hpp"
+#include "stats.hpp"
+#include "structures.hpp"
+#include "workspace.hpp"
+
+// Products of the logloss Hessian with a vector, for the second-order
+// solvers of solvers.hpp. With the rows extended by a constant 1 for beta,
+// the Hessian of the summed loss is X^T D X, D = diag(sigm * (1 - sigm)).
+// Per row block of logreg_opt's structure:
+//
+//   1. u = X_b v + v_beta (gemv);
+//   2. u *= sigm * (1 - sigm), from the sigmoid values materialized by the
+//      last forward_and_gradient at the same weights, so the curvature costs
+//      no exp;
+//   3. X_b^T u (gemv-T) into the thread-local gradient and sum(u) into the
+//      thread-local beta gradient.
+//
+// One read of the data per product. The product is left in
+// workspace.gradient: weights_gradient holds the weights part, beta_gradient
+// the beta part. The workspace needs no materialized sigmoid of its own.
+namespace logreg_hessian {
+
+// Adds the rows of `meta` to the block accumulators. sigm holds the
+// sigmoid values of these rows. When projections is not null, X_b v + v_beta
+// of every row is also written there (the solvers keep X p for their line
+// searches).
+template <typename FPType>
+void accumulate_hessian_vector(const Meta &meta, const FPType *data,
+                               const FPType *sigm, const FPType *vector,
+                               const FPType vector_beta,
+                               FPType *projections,
+                               LogRegWorkspace<FPType> &workspace) {
+  using Workspace = LogRegWorkspace<FPType>;
+  const size_t rows_in_block = workspace.rows_in_block;
+  const size_t blocks_count =
+      meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
+
+  workspace.for_each_block(
+      blocks_count,
+      [&](size_t block_index, typename Workspace::ThreadLocal &local,
+          FPType *gradient, double &, double &beta_gradient) {
+        FPType *products = local.derivatives.data();
+        const size_t start_row = rows_in_block * block_index;
+        const FPType *data_ptr = data + start_row * meta.columns_count;
+        const FPType *sigm_ptr = sigm + start_row;
+        const size_t rows_to_process =
+            block_index + 1 == blocks_count
+                ? meta.rows_count - rows_in_block * block_index
+                : rows_in_block;
+        stats::BlockTimer timer(rows_to_process);
+
+        call_gemv<FPType>(CblasNoTrans, rows_to_process, meta.columns_count,
+                          1., data_ptr, meta.columns_count, vector, 0.,
+                          products);
+        timer.lap(stats::Phase::gemv_n);
+
+        double beta_product = 0;
+        for (size_t row = 0; row < rows_to_process; ++row) {
+          const FPType projection = products[row] + vector_beta;
+          if (projections) {
+            projections[start_row + row] = projection;
+          }
+          products[row] = projection * sigm_ptr[row] * (1 - sigm_ptr[row]);
+          beta_product += products[row];
+        }
+        beta_gradient += beta_product;
+        timer.lap(stats::Phase::elementwise);
+
+        call_gemv<FPType>(CblasTrans, rows_to_process, meta.columns_count, 1.,
+                          data_ptr, meta.columns_count, products, 1., gradient);
+        timer.lap(stats::Phase::gemv_t);
+      });
+}
+
+template <typename FPType>
+void hessian_vector(const Meta &meta, const FPType *data, const FPType *sigm,
+                    const FPType *vector, const FPType vector_beta,
+                    FPType *projections, LogRegWorkspace<FPType> &workspace) {
+  stats::PassTimer pass;
+  workspace.reset_gradient();
+  accumulate_hessian_vector<FPType>(meta, data, sigm, vector, vector_beta,
+                                    projections, workspace);
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce_gradient();
+}
+
+// logits[row] = X_row weights + beta for all rows: the gemv-N half of a
+// pass, with the block partition of the workspace.
+template <typename FPType>
+void compute_logits(const Meta &meta, const FPType *data,
+                    const FPType *weights, const FPType beta, FPType *logits,
+                    LogRegWorkspace<FPType> &workspace) {
+  const size_t rows_in_block = workspace.rows_in_block;
+  const size_t blocks_count =
+      meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
+
+  workspace.parallel_for(
+      tbb::blocked_range<int>(0, blocks_count),
+      [&](tbb::blocked_range<int> r) {
+        for (int block_index = r.begin(); block_index < r.end();
+             ++block_index) {
+          const size_t start_row = rows_in_block * block_index;
+          const size_t rows_to_process =
+              block_index + 1 == blocks_count
+                  ? meta.rows_count - rows_in_block * block_index
+                  : rows_in_block;
+          FPType *logits_ptr = logits + start_row;
+          call_gemv<FPType>(CblasNoTrans, rows_to_process, meta.columns_count,
+                            1., data + start_row * meta.columns_count,
+                            meta.columns_count, weights, 0., logits_ptr);
+          for (size_t row = 0; row < rows_to_process; ++row) {
+            logits_ptr[row] += beta;
+          }
+        }
+      });
+}
+
+} // namespace logreg_hessian
+
+#endif
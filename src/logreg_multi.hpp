@@ -0,0 +1,145 @@
+#ifndef LOGREG_MULTI_HPP
+#define LOGREG_MULTI_HPP
+
+#include <cmath>
+#include <vector>
+
+#include <mkl.h>
+#include <tbb/tbb.h>
+
+#include "logreg.hpp"
+#include "structures.hpp"
+#include "verbose.hpp"
+#include "vmath.hpp"
+#include "workspace.hpp"
+
+// K independent binary models over the same rows in one pass, e.g. a
+// hyperparameter sweep, one-vs-rest labels or a bootstrap ensemble. Per row
+// block the logits of all models are one gemm (rows x columns times
+// columns x K) and the gradients another (columns x rows times rows x K), so
+// the block is read from memory once and reused K times from cache.
+//
+// Layouts, all row-major:
+//   weights:     columns x K, model k in column k;
+//   betas:       K intercepts;
+//   groundTruth: rows x labels_stride, the label of model k in column k;
+//                labels_stride == 0 gives all models the same labels.
+// The results are in MultiWorkspace::result (see structures.hpp).
+namespace logreg_multi {
+
+// Adds the rows of `meta` to the accumulators of the workspace
+// (MultiWorkspace::for_each_block).
+template <typename FPType>
+void accumulate_forward_and_gradient(const Meta &meta, const FPType *data,
+                                     const FPType *weights,
+                                     const float *groundTruth,
+                                     const size_t labels_stride,
+                                     const FPType *betas,
+                                     MultiWorkspace<FPType> &workspace) {
+  using Workspace = MultiWorkspace<FPType>;
+  const size_t models_count = workspace.outputs_count;
+  const size_t rows_in_block = workspace.rows_in_block;
+  const size_t blocks_count =
+      meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
+  // Shared labels: one value per row for every model.
+  const size_t row_stride = labels_stride ? labels_stride : 1;
+  const size_t model_stride = labels_stride ? 1 : 0;
+
+  workspace.for_each_block(
+      blocks_count,
+      [&](size_t block_index, typename Workspace::ThreadLocal &local,
+          FPType *gradient, double *logloss, double *beta_gradient) {
+        FPType *logits = local.logits.data();
+        const size_t start_row = rows_in_block * block_index;
+        const FPType *data_ptr = data + start_row * meta.columns_count;
+        const float *gt_ptr = groundTruth + start_row * row_stride;
+        const size_t rows_to_process =
+            block_index + 1 == blocks_count
+                ? meta.rows_count - rows_in_block * block_index
+                : rows_in_block;
+
+        call_gemm<FPType>(CblasNoTrans, CblasNoTrans, rows_to_process,
+                          models_count, meta.columns_count, 1., data_ptr,
+                          meta.columns_count, weights, models_count, 0.,
+                          logits, models_count);
+
+        // Logits are replaced by the derivatives in place.
+        for (size_t row = 0; row < rows_to_process; ++row) {
+          FPType *row_logits = logits + row * models_count;
+          const float *row_gt = gt_ptr + row * row_stride;
+          for (size_t model = 0; model < models_count; ++model) {
+            FPType sigm;
+            vmath::logistic_row(row_logits[model] + betas[model],
+                                row_gt[model * model_stride], sigm,
+                                row_logits[model], logloss[model]);
+            beta_gradient[model] += row_logits[model];
+          }
+        }
+
+        call_gemm<FPType>(CblasTrans, CblasNoTrans, meta.columns_count,
+                          models_count, rows_to_process, 1., data_ptr,
+                          meta.columns_count, logits, models_count, 1.,
+                          gradient, models_count);
+      });
+}
+
+template <typename FPType>
+void forward_and_gradient(const Meta &meta, const FPType *data,
+                          const FPType *weights, const float *groundTruth,
+                          const size_t labels_stride, const FPType *betas,
+                          MultiWorkspace<FPType> &workspace,
+                          const bool verbosity) {
+  workspace.reset();
+  accumulate_forward_and_gradient<FPType>(meta, data, weights, groundTruth,
+                                          labels_stride, betas, workspace);
+  workspace.reduce();
+}
+
+template <typename FPType>
+MultiResult<FPType>
+forward_and_gradient(const DataView<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth,
+                     const size_t labels_stride,
+                     const std::vector<FPType> &betas, const bool verbosity) {
+  MultiWorkspace<FPType> workspace(data.meta, betas.size());
+  forward_and_gradient<FPType>(data.meta, data.data, weights.data(),
+                               groundTruth.data(), labels_stride, betas.data(),
+                               workspace, verbosity);
+  return std::move(workspace.result);
+}
+
+// K vectors of the same length n to the n x K row-major layout above.
+template <typename T>
+std::vector<T> interleave(const std::vector<std::vector<T>> &vectors) {
+  const size_t count = vectors.size();
+  const size_t length = count ? vectors.front().size() : 0;
+  std::vector<T> result(length * count);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, length),
+                    [&](tbb::blocked_range<size_t> r) {
+                      for (size_t index = r.begin(); index < r.end();
+                           ++index) {
+                        for (size_t column = 0; column < count; ++column) {
+                          result[index * count + column] =
+                              vectors[column][index];
+                        }
+                      }
+                    });
+  return result;
+}
+
+// Column `column` of an n x count row-major matrix, e.g. the gradient of
+// one model.
+template <typename T>
+std::vector<T> extract_column(const std::vector<T> &matrix,
+                              const size_t count, const size_t column) {
+  std::vector<T> result(matrix.size() / count);
+  for (size_t index = 0; index < result.size(); ++index) {
+    result[index] = matrix[index * count + column];
+  }
+  return result;
+}
+
+} // namespace logreg_multi
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef LOGREG_SOFTMAX_HPP
+#define LOGREG_SOFTMAX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <mkl.h>
+#include <tbb/tbb.h>
+
+#include "logreg.hpp"
+#include "structures.hpp"
+#include "verbose.hpp"
+#include "vmath.hpp"
+#include "workspace.hpp"
+
+// Multinomial (softmax) regression over K classes with the row-block / TLS
+// structure of logreg_opt. Per row block:
+//
+//   1. logits of all classes with one gemm (rows x columns times
+//      columns x K);
+//   2. stable log-softmax and cross-entropy of every row: the row maximum is
+//      subtracted before exp, so no logit overflows, and the loss is
+//      log(sum exp(z - max)) - (z_label - max). The exp runs over the whole
+//      rows x K block with vmath::exp, the log once per row;
+//   3. derivatives softmax - one_hot(label), written over the logits, and
+//      the gradient of all classes with a second gemm.
+//
+// So the data is read once per update of the whole class matrix.
+//
+// Layouts, all row-major: weights columns x K (class k in column k), betas K
+// values, groundTruth one class index 0 .. K - 1 per row (binary 0/1 labels
+// are valid with K = 2). Rows with other labels (negative, fractional, NaN
+// or >= K) are skipped: they add nothing to the results and are counted in
+// MultiWorkspace::invalid_rows, and forward_and_gradient returns false.
+// Results are in MultiWorkspace::result: logloss[k] is the cross-entropy
+// summed over the rows of class k, so the total loss is the sum over k.
+namespace logreg_softmax {
+
+// Class of a label, classes_count for labels that are not class indices.
+inline size_t class_index(const float label, const size_t classes_count) {
+  if (!(label >= 0) || label >= classes_count || label != std::floor(label)) {
+    return classes_count;
+  }
+  return static_cast<size_t>(label);
+}
+
+// Adds the rows of `meta` to the accumulators of the workspace
+// (MultiWorkspace::for_each_block). Rows with invalid labels are counted in
+// the thread-local invalid_rows.
+template <typename FPType>
+void accumulate_forward_and_gradient(const Meta &meta, const FPType *data,
+                                     const FPType *weights,
+                                     const float *groundTruth,
+                                     const FPType *betas,
+                                     MultiWorkspace<FPType> &workspace) {
+  using Workspace = MultiWorkspace<FPType>;
+  const size_t classes_count = workspace.outputs_count;
+  const size_t rows_in_block = workspace.rows_in_block;
+  const size_t blocks_count =
+      meta.rows_count / rows_in_block + !!(meta.rows_count % rows_in_block);
+
+  workspace.for_each_block(
+      blocks_count,
+      [&](size_t block_index, typename Workspace::ThreadLocal &local,
+          FPType *gradient, double *logloss, double *beta_gradient) {
+        FPType *logits = local.logits.data();
+        const size_t start_row = rows_in_block * block_index;
+        const FPType *data_ptr = data + start_row * meta.columns_count;
+        const float *gt_ptr = groundTruth + start_row;
+        const size_t rows_to_process =
+            block_index + 1 == blocks_count
+                ? meta.rows_count - rows_in_block * block_index
+                : rows_in_block;
+
+        call_gemm<FPType>(CblasNoTrans, CblasNoTrans, rows_to_process,
+                          classes_count, meta.columns_count, 1., data_ptr,
+                          meta.columns_count, weights, classes_count, 0.,
+                          logits, classes_count);
+
+        // z - max of every row; the -(z_label - max) part of the loss.
+        for (size_t row = 0; row < rows_to_process; ++row) {
+          FPType *row_logits = logits + row * classes_count;
+          FPType max_logit = row_logits[0] + betas[0];
+          for (size_t index = 0; index < classes_count; ++index) {
+            row_logits[index] += betas[index];
+            max_logit = std::max(max_logit, row_logits[index]);
+          }
+          for (size_t index = 0; index < classes_count; ++index) {
+            row_logits[index] -= max_logit;
+          }
+          const size_t label = class_index(gt_ptr[row], classes_count);
+          if (label < classes_count) {
+            logloss[label] -= row_logits[label];
+          }
+        }
+
+        vmath::exp(rows_to_process * classes_count, logits);
+
+        // log(sum) part of the loss, softmax - one_hot(label).
+        for (size_t row = 0; row < rows_to_process; ++row) {
+          FPType *row_logits = logits + row * classes_count;
+          const size_t label = class_index(gt_ptr[row], classes_count);
+          if (label == classes_count) {
+            std::fill(row_logits, row_logits + classes_count, FPType(0));
+            ++local.invalid_rows;
+            continue;
+          }
+          FPType sum = 0;
+          for (size_t index = 0; index < classes_count; ++index) {
+            sum += row_logits[index];
+          }
+          logloss[label] += std::log(sum);
+          const FPType inverse_sum = 1 / sum;
+          for (size_t index = 0; index < classes_count; ++index) {
+            row_logits[index] *= inverse_sum;
+          }
+          row_logits[label] -= 1;
+          for (size_t index = 0; index < classes_count; ++index) {
+            beta_gradient[index] += row_logits[index];
+          }
+        }
+
+        call_gemm<FPType>(CblasTrans, CblasNoTrans, meta.columns_count,
+                          classes_count, rows_to_process, 1., data_ptr,
+                          meta.columns_count, logits, classes_count, 1.,
+                          gradient, classes_count);
+      });
+}
+
+// False when some labels were not class indices; the results then cover
+// the other rows only.
+template <typename FPType>
+bool forward_and_gradient(const Meta &meta, const FPType *data,
+                          const FPType *weights, const float *groundTruth,
+                          const FPType *betas,
+                          MultiWorkspace<FPType> &workspace,
+                          const bool verbosity) {
+  workspace.reset();
+  accumulate_forward_and_gradient<FPType>(meta, data, weights, groundTruth,
+                                          betas, workspace);
+  workspace.reduce();
+  if (workspace.invalid_rows) {
+    verbose_print(verbosity, "!!! Softmax skipped ", workspace.invalid_rows,
+                  " rows with labels that are not class indices");
+    return false;
+  }
+  return true;
+}
+
+// Rows with invalid labels are skipped silently; the in-place variant
+// reports them.
+template <typename FPType>
+MultiResult<FPType>
+forward_and_gradient(const DataView<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth,
+                     const std::vector<FPType> &betas, const bool verbosity) {
+  MultiWorkspace<FPType> workspace(data.meta, betas.size());
+  forward_and_gradient<FPType>(data.meta, data.data, weights.data(),
+                               groundTruth.data(), betas.data(), workspace,
+                               verbosity);
+  return std::move(workspace.result);
+}
+
+} // namespace logreg_softmax
+
+#endif
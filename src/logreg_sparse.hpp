@@ -0,0 +1,222 @@
+#ifndef LOGREG_SPARSE_HPP
+#define LOGREG_SPARSE_HPP
+
+#include <algorithm>
+#include <cmath>
+
+#include <tbb/tbb.h>
+
+#include "logreg.hpp"
+#include "sparse.hpp"
+#include "stats.hpp"
+#include "structures.hpp"
+#include "tuning.hpp"
+#include "verbose.hpp"
+#include "vmath.hpp"
+#include "workspace.hpp"
+
+// Kernels for CSR features (sparse.hpp) with the same results and workspace
+// as the dense ones. Work is split into nnz-balanced row blocks; the logits
+// are a gather SpMV, the gradient a scatter into the thread-local gradient.
+// Each row is handled start to end, so no row-block buffers are needed, and
+// the phases are timed per block (stats.hpp): gemv-N for forward(), gemv-T
+// for gradient(), fused for the single pass.
+namespace logreg_sparse {
+
+// Enough blocks for load balancing (8 per thread), each small enough for its
+// values and indices to stay in L2. The deterministic reductions need blocks
+// that do not depend on the thread count and assume
+// LogRegWorkspace::deterministic_chunks threads.
+template <typename FPType>
+sparse::BalancedBlocks blocks(const CSRView<FPType> &data,
+                              const LogRegWorkspace<FPType> &workspace) {
+  const size_t threads =
+      workspace.deterministic()
+          ? LogRegWorkspace<FPType>::deterministic_chunks
+          : tbb::this_task_arena::max_concurrency();
+  const size_t l2 = data.meta.l2_cache_size ? data.meta.l2_cache_size
+                                            : tuning::cache_info().l2;
+  const size_t l2_nnz = l2 * 0.8 / (sizeof(FPType) + sizeof(uint32_t));
+  const size_t nnz_per_block =
+      std::clamp<size_t>(data.nnz() / (8 * threads), 1024, l2_nnz);
+  return sparse::BalancedBlocks(data.row_offsets, data.meta.rows_count,
+                                nnz_per_block);
+}
+
+template <typename FPType>
+inline FPType row_dot(const CSRView<FPType> &data, const size_t row,
+                      const FPType *weights) {
+  FPType acc = 0;
+  for (size_t index = data.row_offsets[row]; index < data.row_offsets[row + 1];
+       ++index) {
+    acc += data.values[index] * weights[data.columns[index]];
+  }
+  return acc;
+}
+
+template <typename FPType>
+inline void row_axpy(const CSRView<FPType> &data, const size_t row,
+                     const FPType coeff, FPType *gradient) {
+  for (size_t index = data.row_offsets[row]; index < data.row_offsets[row + 1];
+       ++index) {
+    gradient[data.columns[index]] += coeff * data.values[index];
+  }
+}
+
+// Writes sigm only when the workspace materializes it; otherwise computes
+// the loss alone, like the dense forward().
+template <typename FPType>
+void forward(const CSRView<FPType> &data, const FPType *weights,
+             const float *groundTruth, const FPType beta_weight,
+             LogRegWorkspace<FPType> &workspace, const bool verbosity) {
+  using Workspace = LogRegWorkspace<FPType>;
+  stats::PassTimer pass;
+  workspace.reset_forward();
+  const sparse::BalancedBlocks row_blocks = blocks(data, workspace);
+  FPType *sigm =
+      workspace.materialize_sigm ? workspace.forward.sigm.data() : nullptr;
+
+  workspace.for_each_block(
+      row_blocks.blocks_count,
+      [&](size_t block_index, typename Workspace::ThreadLocal &, FPType *,
+          double &logloss, double &) {
+        const size_t start_row = row_blocks.block_start(block_index);
+        const size_t end_row = row_blocks.block_start(block_index + 1);
+        stats::BlockTimer timer(end_row - start_row);
+        for (size_t row = start_row; row < end_row; ++row) {
+          FPType value, derivative;
+          vmath::logistic_row(row_dot(data, row, weights) + beta_weight,
+                              groundTruth[row], value, derivative, logloss);
+          if (sigm) {
+            sigm[row] = value;
+          }
+        }
+        timer.lap(stats::Phase::gemv_n);
+      });
+
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce_forward();
+}
+
+template <typename FPType>
+ForwardResult<FPType> forward(const CSRView<FPType> &data,
+                              const std::vector<FPType> &weights,
+                              const std::vector<float> &groundTruth,
+                              const FPType beta_weight, const bool verbosity) {
+  LogRegWorkspace<FPType> workspace(data.meta);
+  forward<FPType>(data, weights.data(), groundTruth.data(), beta_weight,
+                  workspace, verbosity);
+  return std::move(workspace.forward);
+}
+
+// sigm holds the forward() output for all rows.
+template <typename FPType>
+void gradient(const CSRView<FPType> &data, const FPType *weights,
+              const float *groundTruth, const FPType beta, const FPType *sigm,
+              LogRegWorkspace<FPType> &workspace, bool verbosity) {
+  using Workspace = LogRegWorkspace<FPType>;
+  stats::PassTimer pass;
+  workspace.reset_gradient();
+  const sparse::BalancedBlocks row_blocks = blocks(data, workspace);
+
+  workspace.for_each_block(
+      row_blocks.blocks_count,
+      [&](size_t block_index, typename Workspace::ThreadLocal &,
+          FPType *gradient, double &, double &beta_gradient) {
+        const size_t start_row = row_blocks.block_start(block_index);
+        const size_t end_row = row_blocks.block_start(block_index + 1);
+        stats::BlockTimer timer(end_row - start_row);
+        for (size_t row = start_row; row < end_row; ++row) {
+          // Closed form of the logloss derivative (vmath.hpp), finite for
+          // saturated sigmoid values.
+          const FPType derivative = sigm[row] - groundTruth[row];
+          beta_gradient += derivative;
+          row_axpy(data, row, derivative, gradient);
+        }
+        timer.lap(stats::Phase::gemv_t);
+      });
+
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce_gradient();
+}
+
+template <typename FPType>
+GradientResult<FPType>
+gradient(const CSRView<FPType> &data, const std::vector<FPType> &weights,
+         const std::vector<float> &groundTruth, const FPType beta,
+         const ForwardResult<FPType> &forward_result, bool verbosity) {
+  LogRegWorkspace<FPType> workspace(data.meta, false);
+  gradient<FPType>(data, weights.data(), groundTruth.data(), beta,
+                   forward_result.sigm.data(), workspace, verbosity);
+  return std::move(workspace.gradient);
+}
+
+// One pass: every row is read once for its logit and its gradient update.
+// Adds to the thread-local accumulators like the dense kernels; first_row
+// selects where materialized sigmoid values go.
+template <typename FPType>
+void accumulate_forward_and_gradient(const CSRView<FPType> &data,
+                                     const FPType *weights,
+                                     const float *groundTruth,
+                                     const FPType beta_weight,
+                                     const size_t first_row,
+                                     LogRegWorkspace<FPType> &workspace) {
+  using Workspace = LogRegWorkspace<FPType>;
+  const sparse::BalancedBlocks row_blocks = blocks(data, workspace);
+  FPType *sigm = workspace.materialize_sigm
+                     ? workspace.forward.sigm.data() + first_row
+                     : nullptr;
+
+  workspace.for_each_block(
+      row_blocks.blocks_count,
+      [&](size_t block_index, typename Workspace::ThreadLocal &local,
+          FPType *gradient, double &logloss, double &beta_gradient) {
+        const size_t start_row = row_blocks.block_start(block_index);
+        const size_t end_row = row_blocks.block_start(block_index + 1);
+        stats::BlockTimer timer(end_row - start_row);
+        for (size_t row = start_row; row < end_row; ++row) {
+          FPType value, derivative;
+          vmath::logistic_row(row_dot(data, row, weights) + beta_weight,
+                              groundTruth[row], value, derivative, logloss);
+          if (sigm) {
+            sigm[row] = value;
+          }
+          if (workspace.track_quality) {
+            local.quality.add(1, &value, groundTruth + row);
+          }
+          beta_gradient += derivative;
+          row_axpy(data, row, derivative, gradient);
+        }
+        timer.lap(stats::Phase::fused);
+      });
+}
+
+template <typename FPType>
+void forward_and_gradient(const CSRView<FPType> &data, const FPType *weights,
+                          const float *groundTruth, const FPType beta_weight,
+                          LogRegWorkspace<FPType> &workspace,
+                          const bool verbosity) {
+  stats::PassTimer pass;
+  workspace.reset();
+  accumulate_forward_and_gradient<FPType>(data, weights, groundTruth,
+                                          beta_weight, 0, workspace);
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce();
+}
+
+template <typename FPType>
+std::pair<ForwardResult<FPType>, GradientResult<FPType>>
+forward_and_gradient(const CSRView<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth,
+                     const FPType beta_weight, const bool verbosity) {
+  LogRegWorkspace<FPType> workspace(data.meta);
+  forward_and_gradient<FPType>(data, weights.data(), groundTruth.data(),
+                               beta_weight, workspace, verbosity);
+  return std::make_pair(std::move(workspace.forward),
+                        std::move(workspace.gradient));
+}
+
+} // namespace logreg_sparse
+
+#endif
@@ -0,0 +1,287 @@
+#ifndef LOGREG_TILED_HPP
+#define LOGREG_TILED_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <tbb/tbb.h>
+
+#include "logreg.hpp"
+#include "logreg_fused.hpp"
+#include "reproducible.hpp"
+#include "simd.hpp"
+#include "stats.hpp"
+#include "structures.hpp"
+#include "tuning.hpp"
+#include "verbose.hpp"
+#include "vmath.hpp"
+#include "workspace.hpp"
+
+namespace logreg_tiled {
+
+// 2D partitioning for wide data. Rows are processed in blocks one after
+// another; inside a block the columns are split into tiles:
+//
+//   1. partial logits of every tile, summed into per-thread row buffers
+//      of the workspace;
+//   2. sigmoid, loss and derivatives of the block rows;
+//   3. gradient columns of every tile, written straight into
+//      workspace.gradient: tiles own disjoint columns, so there are no
+//      per-thread gradient copies and nothing to reduce.
+//
+// Both tile loops share an affinity_partitioner, so a tile tends to go to
+// the thread that still has its block x tile cell in L2 from step 1.
+//
+// The steps are timed as the gemv-N, elementwise and gemv-T phases (stats.hpp)
+// on the calling thread, which runs the blocks; the tile loops' own threads
+// are not timed.
+struct Layout {
+  size_t tile_columns;
+  size_t tiles_count;
+  size_t rows_in_block;
+};
+
+// Narrow data keeps the row-partitioned fused kernel: 2D partitioning pays
+// off when an L2 block holds fewer than min_block_rows rows, or when there
+// are fewer row blocks than threads and enough tiles to occupy them.
+constexpr size_t min_block_rows = 16;
+
+// Thread count the layout is sized for. The deterministic modes use a fixed
+// count, so that the tiles and row blocks, and with them the summation
+// order, do not change with the machine.
+constexpr size_t deterministic_threads = 64;
+
+inline size_t layout_threads(const bool deterministic) {
+  return deterministic ? deterministic_threads
+                       : tbb::this_task_arena::max_concurrency();
+}
+
+// About 4 tiles per thread, at least 256 columns each and a multiple of 16,
+// and as many rows as fit a tile into 80% of L2.
+inline Layout layout(const Meta &meta, const size_t element_size,
+                     const size_t threads = layout_threads(false)) {
+  const size_t l2 =
+      meta.l2_cache_size ? meta.l2_cache_size : tuning::cache_info().l2;
+  size_t tile_columns = meta.columns_count / (4 * threads) + 1;
+  tile_columns = std::max<size_t>(256, (tile_columns + 15) / 16 * 16);
+  tile_columns = std::min(tile_columns, meta.columns_count);
+  Layout result;
+  result.tile_columns = std::max<size_t>(tile_columns, 1);
+  result.tiles_count = meta.columns_count / result.tile_columns +
+                       !!(meta.columns_count % result.tile_columns);
+  result.rows_in_block = std::min(
+      tuning::block_rows(l2, result.tile_columns, element_size),
+      std::max<size_t>(meta.rows_count, 1));
+  return result;
+}
+
+// The deterministic modes decide on the block size alone: the fused
+// kernel's fixed chunks are already independent of the thread count, and
+// a choice sized for deterministic_threads would run short inputs on one
+// tile.
+inline bool prefers_2d(const Meta &meta, const size_t element_size,
+                       const bool deterministic = false) {
+  const size_t l2 =
+      meta.l2_cache_size ? meta.l2_cache_size : tuning::cache_info().l2;
+  const size_t rows_in_block =
+      tuning::block_rows(l2, meta.columns_count, element_size);
+  if (rows_in_block < min_block_rows) {
+    return true;
+  }
+  if (deterministic) {
+    return false;
+  }
+  const size_t threads = layout_threads(false);
+  return meta.rows_count / rows_in_block < threads &&
+         layout(meta, element_size, threads).tiles_count >= threads;
+}
+
+// Adds the rows of `meta` to the workspace accumulators: the gradient goes
+// to workspace.gradient directly, the loss and beta gradient to the
+// thread-local accumulators of the calling thread. Blocks are processed in
+// order and every gradient column by one tile, so the deterministic modes
+// only need a layout that does not depend on the thread count and a fixed
+// logit reduction. Narrow shapes run
+// logreg_fused::accumulate_forward_and_gradient.
+template <typename FPType>
+void accumulate_forward_and_gradient(const Meta &meta, const FPType *data,
+                                     const FPType *weights,
+                                     const float *groundTruth,
+                                     const FPType beta_weight,
+                                     const size_t first_row,
+                                     LogRegWorkspace<FPType> &workspace) {
+  if (!prefers_2d(meta, sizeof(FPType), workspace.deterministic())) {
+    logreg_fused::accumulate_forward_and_gradient<FPType>(
+        meta, data, weights, groundTruth, beta_weight, first_row, workspace);
+    return;
+  }
+  const Layout shape =
+      layout(meta, sizeof(FPType), layout_threads(workspace.deterministic()));
+  const size_t columns_count = meta.columns_count;
+  const size_t blocks_count = meta.rows_count / shape.rows_in_block +
+                              !!(meta.rows_count % shape.rows_in_block);
+  if (workspace.shared_sigm.size() < shape.rows_in_block) {
+    workspace.shared_sigm.resize(shape.rows_in_block);
+    workspace.shared_derivatives.resize(shape.rows_in_block);
+  }
+  if (workspace.deterministic() &&
+      workspace.tile_logits.size() < shape.tiles_count * shape.rows_in_block) {
+    workspace.tile_logits.resize(shape.tiles_count * shape.rows_in_block);
+  }
+  // The reduction reads every thread buffer, including those of threads
+  // that last ran a shorter block and run no tile of this one.
+  for (aligned_vector<FPType> &partial : workspace.thread_logits) {
+    if (partial.size() < shape.rows_in_block) {
+      partial.resize(shape.rows_in_block, 0);
+    }
+  }
+  using Workspace = LogRegWorkspace<FPType>;
+  typename Workspace::ThreadLocal &local = workspace.tls.local();
+  FPType *gradient = workspace.gradient.weights_gradient.data();
+  const tbb::blocked_range<size_t> tiles(0, shape.tiles_count);
+
+  for (size_t block_index = 0; block_index < blocks_count; ++block_index) {
+    const size_t start_row = shape.rows_in_block * block_index;
+    const size_t rows_to_process =
+        block_index + 1 == blocks_count
+            ? meta.rows_count - shape.rows_in_block * block_index
+            : shape.rows_in_block;
+    stats::BlockTimer timer(rows_to_process);
+    const FPType *data_ptr = data + start_row * columns_count;
+    const float *gt_ptr = groundTruth + start_row;
+    FPType *sigm_ptr = workspace.materialize_sigm
+                           ? workspace.forward.sigm.data() + first_row +
+                                 start_row
+                           : workspace.shared_sigm.data();
+    FPType *derivatives = workspace.shared_derivatives.data();
+    // Replaced by the derivatives in step 2.
+    FPType *logits = derivatives;
+
+    // 1. Logits: per-tile partial dot products, into the buffer of the
+    // thread in fast mode and summed over the threads. The deterministic
+    // modes keep one buffer per tile and add them in a fixed tree.
+    const auto add_tile_logits = [&](const size_t tile_index, FPType *partial) {
+      FPType out[simd::tile_rows];
+      const size_t column = tile_index * shape.tile_columns;
+      const size_t width = std::min(shape.tile_columns, columns_count - column);
+      for (size_t row = 0; row < rows_to_process; row += simd::tile_rows) {
+        const size_t tile = std::min(simd::tile_rows, rows_to_process - row);
+        simd::dot_tile(tile, data_ptr + row * columns_count + column,
+                       columns_count, weights + column, width, out);
+        for (size_t index = 0; index < tile; ++index) {
+          partial[row + index] += out[index];
+        }
+      }
+    };
+    if (workspace.deterministic()) {
+      FPType *tile_logits = workspace.tile_logits.data();
+      tbb::parallel_for(
+          tiles,
+          [&](const tbb::blocked_range<size_t> &r) {
+            for (size_t tile_index = r.begin(); tile_index < r.end();
+                 ++tile_index) {
+              FPType *partial = tile_logits + tile_index * shape.rows_in_block;
+              std::fill(partial, partial + rows_to_process, FPType(0));
+              add_tile_logits(tile_index, partial);
+            }
+          },
+          workspace.affinity);
+      for (size_t row = 0; row < rows_to_process; ++row) {
+        logits[row] = reproducible::pairwise_sum(
+            0, shape.tiles_count, [&](size_t tile_index) -> double {
+              return tile_logits[tile_index * shape.rows_in_block + row];
+            });
+      }
+    } else {
+      tbb::parallel_for(
+          tiles,
+          [&](const tbb::blocked_range<size_t> &r) {
+            aligned_vector<FPType> &partial = workspace.thread_logits.local();
+            if (partial.size() < shape.rows_in_block) {
+              partial.resize(shape.rows_in_block, 0);
+            }
+            for (size_t tile_index = r.begin(); tile_index < r.end();
+                 ++tile_index) {
+              add_tile_logits(tile_index, partial.data());
+            }
+          },
+          workspace.affinity);
+      std::fill(logits, logits + rows_to_process, FPType(0));
+      for (aligned_vector<FPType> &partial : workspace.thread_logits) {
+        for (size_t row = 0; row < rows_to_process; ++row) {
+          logits[row] += partial[row];
+          partial[row] = 0;
+        }
+      }
+    }
+
+    timer.lap(stats::Phase::gemv_n);
+
+    // 2. Sigmoid, loss and derivatives of the block rows.
+    vmath::logistic(rows_to_process, logits, beta_weight, gt_ptr,
+                    sigm_ptr, derivatives, local.logloss,
+                    local.beta_gradient);
+    if (workspace.track_quality) {
+      local.quality.add(rows_to_process, sigm_ptr, gt_ptr);
+    }
+    timer.lap(stats::Phase::elementwise);
+
+    // 3. Gradient: every tile owns its columns.
+    tbb::parallel_for(
+        tiles,
+        [&](const tbb::blocked_range<size_t> &r) {
+          for (size_t tile_index = r.begin(); tile_index < r.end();
+               ++tile_index) {
+            const size_t column = tile_index * shape.tile_columns;
+            const size_t width =
+                std::min(shape.tile_columns, columns_count - column);
+            for (size_t row = 0; row < rows_to_process;
+                 row += simd::tile_rows) {
+              const size_t tile =
+                  std::min(simd::tile_rows, rows_to_process - row);
+              simd::axpy_tile(tile,
+                              data_ptr + row * columns_count + column,
+                              columns_count, derivatives + row, width,
+                              gradient + column);
+            }
+          }
+        },
+        workspace.affinity);
+    timer.lap(stats::Phase::gemv_t);
+  }
+}
+
+template <typename FPType>
+void forward_and_gradient(const Meta &meta, const FPType *data,
+                          const FPType *weights, const float *groundTruth,
+                          const FPType beta_weight,
+                          LogRegWorkspace<FPType> &workspace,
+                          const bool verbosity) {
+  workspace.use_thread_gradients(
+      !prefers_2d(meta, sizeof(FPType), workspace.deterministic()));
+  stats::PassTimer pass;
+  workspace.reset();
+  accumulate_forward_and_gradient<FPType>(meta, data, weights, groundTruth,
+                                          beta_weight, 0, workspace);
+  stats::PhaseTimer reduction(stats::Phase::reduction);
+  workspace.reduce();
+}
+
+template <typename FPType>
+std::pair<ForwardResult<FPType>, GradientResult<FPType>>
+forward_and_gradient(const Meta &meta, const std::vector<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth,
+                     const FPType beta_weight, const bool verbosity) {
+  LogRegWorkspace<FPType> workspace(meta);
+  forward_and_gradient<FPType>(meta, data.data(), weights.data(),
+                               groundTruth.data(), beta_weight, workspace,
+                               verbosity);
+  return std::make_pair(std::move(workspace.forward),
+                        std::move(workspace.gradient));
+}
+
+} // namespace logreg_tiled
+
+#endif
@@ -1,14 +1,29 @@
+#include <algorithm>
 #include <chrono>
+#include <thread>
 
 #include <ittnotify.h>
 #include <mkl.h>
 #include <tbb/tbb.h>
 
 #include "data_gen.hpp"
+#include "dispatch.hpp"
+#include "format.hpp"
 #include "logreg.hpp"
+#include "logreg_multi.hpp"
+#include "logreg_softmax.hpp"
 #include "metrics.hpp"
+#include "numa.hpp"
+#include "precision.hpp"
+#include "reproducible.hpp"
+#include "serving.hpp"
+#include "simd.hpp"
+#include "stats.hpp"
+#include "streaming.hpp"
 #include "structures.hpp"
+#include "tuning.hpp"
 #include "verbose.hpp"
+#include "workspace.hpp"
 
 __itt_domain *domain = __itt_domain_create("LogReg.Domain.Global");
 __itt_string_handle *handle_data_gen =
@@ -18,45 +33,341 @@ __itt_string_handle *handle_opt = __itt_string_handle_create("Optimal");
 
 using FPType = float;
 
+// Times the fused kernel on a compressed copy of the data and reports how far
+// its results are from the float ones in `reference`.
+template <typename Storage>
+void run_reduced_precision(const DataView<FPType> &data,
+                           const std::vector<FPType> &weights,
+                           const std::vector<float> &groundTruth,
+                           const FPType beta,
+                           const LogRegWorkspace<FPType> &reference,
+                           const size_t runs, const bool verbosity) {
+  const char *name = precision::storage_name<Storage>();
+  verbose_print(verbosity, "# Start reduced precision solution (", name, ")");
+  const auto quantized = precision::quantize<Storage>(data);
+  LogRegWorkspace<FPType> workspace(data.meta);
+  auto start = std::chrono::system_clock::now();
+  for (size_t index = 0; index < runs; ++index) {
+    logreg_fused::forward_and_gradient<Storage>(
+        quantized.view(), weights.data(), groundTruth.data(), beta, workspace,
+        verbosity);
+  }
+  auto finish = std::chrono::system_clock::now();
+  std::cout << "Reduced precision (" << name << ") time (sec): "
+            << std::chrono::duration_cast<std::chrono::microseconds>(finish -
+                                                                     start)
+                       .count() /
+                   1e6 / runs
+            << std::endl;
+  const metrics::PrecisionReport report =
+      metrics::compare_results(reference.forward, reference.gradient,
+                               workspace.forward, workspace.gradient);
+  verbose_print(true, "# ", name, " sigm error: ", report.sigm);
+  verbose_print(true, "# ", name, " logloss error: ", report.logloss);
+  verbose_print(true, "# ", name,
+                " weights gradient error: ", report.weights_gradient);
+  verbose_print(true, "# ", name,
+                " beta gradient error: ", report.beta_gradient);
+}
+
+// Times models_count copies of the model trained in one batched pass and
+// checks every copy against the single-model results in `reference`.
+void run_multi_model(const DataView<FPType> &data,
+                     const std::vector<FPType> &weights,
+                     const std::vector<float> &groundTruth, const FPType beta,
+                     const LogRegWorkspace<FPType> &reference,
+                     const size_t models_count, const size_t runs,
+                     const bool verbosity) {
+  verbose_print(verbosity, "# Start multi-model solution (", models_count,
+                " models)");
+  const std::vector<FPType> weights_matrix = logreg_multi::interleave(
+      std::vector<std::vector<FPType>>(models_count, weights));
+  const std::vector<FPType> betas(models_count, beta);
+  MultiWorkspace<FPType> workspace(data.meta, models_count);
+  auto start = std::chrono::system_clock::now();
+  for (size_t index = 0; index < runs; ++index) {
+    logreg_multi::forward_and_gradient<FPType>(
+        data.meta, data.data, weights_matrix.data(), groundTruth.data(), 0,
+        betas.data(), workspace, verbosity);
+  }
+  auto finish = std::chrono::system_clock::now();
+  std::cout << "Multi-model (" << models_count << ") time (sec): "
+            << std::chrono::duration_cast<std::chrono::microseconds>(finish -
+                                                                     start)
+                       .count() /
+                   1e6 / runs
+            << std::endl;
+
+  bool equality = true;
+  for (size_t model = 0; model < models_count; ++model) {
+    equality = equality &&
+               metrics::check_multi_equality(reference.forward,
+                                             reference.gradient,
+                                             workspace.result, model);
+  }
+  if (!equality) {
+    verbose_print(true, "!!! Multi-model results are not equal");
+  } else {
+    verbose_print(true, "# Multi-model results are equal");
+  }
+}
+
+// Times the softmax pass on labels of classes_count classes drawn for the
+// features of `data`.
+void run_softmax(const DataView<FPType> &data, const size_t classes_count,
+                 const size_t runs, const bool verbosity) {
+  verbose_print(verbosity, "# Start softmax solution (", classes_count,
+                " classes)");
+  const std::vector<float> labels = data_gen::softmax_labels(
+      data, classes_count, GenerationOptions{}.seed);
+  std::vector<FPType> weights(data.meta.columns_count * classes_count);
+  rng::fill_uniform<FPType>(weights.data(), weights.size(),
+                            GenerationOptions{}.seed, data_gen::initial_stream,
+                            0, -1, 1);
+  const std::vector<FPType> betas(classes_count, 0);
+  MultiWorkspace<FPType> workspace(data.meta, classes_count);
+  bool labels_valid = true;
+  auto start = std::chrono::system_clock::now();
+  for (size_t index = 0; index < runs; ++index) {
+    labels_valid = logreg_softmax::forward_and_gradient<FPType>(
+        data.meta, data.data, weights.data(), labels.data(), betas.data(),
+        workspace, verbosity);
+  }
+  auto finish = std::chrono::system_clock::now();
+  if (!labels_valid) {
+    verbose_print(true, "!!! Softmax labels are not class indices");
+  }
+  std::cout << "Softmax (" << classes_count << ") time (sec): "
+            << std::chrono::duration_cast<std::chrono::microseconds>(finish -
+                                                                     start)
+                       .count() /
+                   1e6 / runs
+            << std::endl;
+  double loss = 0;
+  for (const auto value : workspace.result.logloss) {
+    loss += value;
+  }
+  verbose_print(verbosity, "Softmax mean cross-entropy: ",
+                loss / data.meta.rows_count);
+}
+
+// Times the node-local pass (numa.hpp) after moving the rows of every node
+// to its memory, and checks it against the results in `reference`.
+void run_numa(const Kernel kernel, const DataView<FPType> &data,
+              const std::vector<FPType> &weights,
+              const std::vector<float> &groundTruth, const FPType beta,
+              const LogRegWorkspace<FPType> &reference, const size_t runs,
+              const bool verbosity) {
+  verbose_print(verbosity, "# Start NUMA solution (", numa::nodes().size(),
+                " nodes)");
+  numa::Workspace<FPType> workspace(data.meta);
+  for (size_t node = 0; node < numa::nodes().size(); ++node) {
+    verbose_print(verbosity, "Node ", numa::nodes()[node].id, ": ",
+                  numa::nodes()[node].cpus.size(), " CPUs, rows ",
+                  workspace.bounds[node], " - ", workspace.bounds[node + 1]);
+  }
+  if (!numa::place_rows(data.data, data.meta.columns_count * sizeof(FPType),
+                        workspace.bounds)) {
+    verbose_print(verbosity, "Can't move the rows to their nodes");
+  }
+  auto start = std::chrono::system_clock::now();
+  for (size_t index = 0; index < runs; ++index) {
+    numa::forward_and_gradient<FPType>(kernel, data, weights.data(),
+                                       groundTruth.data(), beta, workspace,
+                                       verbosity);
+  }
+  auto finish = std::chrono::system_clock::now();
+  std::cout << "NUMA time (sec): "
+            << std::chrono::duration_cast<std::chrono::microseconds>(finish -
+                                                                     start)
+                       .count() /
+                   1e6 / runs
+            << std::endl;
+
+  // The node workspaces keep no sigmoid: compare the loss only.
+  ForwardResult<FPType> reference_loss(0);
+  reference_loss.logloss = reference.forward.logloss;
+  if (!metrics::check_forward_equality(reference_loss, workspace.forward) ||
+      !metrics::check_gradient_equality(reference.gradient,
+                                        workspace.gradient)) {
+    verbose_print(true, "!!! NUMA results are not equal");
+  } else {
+    verbose_print(true, "# NUMA results are equal");
+  }
+}
+
+// Times the pass over `filename` read from disk in chunks, labels included
+// (streaming.hpp), and checks it against the results in `reference`.
+void run_streaming(const Kernel kernel, const char *filename, const Meta &meta,
+                   const std::vector<FPType> &weights, const FPType beta,
+                   const LogRegWorkspace<FPType> &reference, const size_t runs,
+                   const bool verbosity) {
+  verbose_print(verbosity, "# Start streaming solution");
+  format::Header header;
+  format::Status status = format::read_header(filename, header);
+  if (status == format::Status::ok &&
+      header.dtype != static_cast<uint32_t>(format::dtype_of<FPType>())) {
+    status = format::Status::dtype_mismatch;
+  }
+  if (status != format::Status::ok) {
+    verbose_print(true, "!!! Can't stream ", filename, ": ",
+                  format::status_name(status));
+    return;
+  }
+  StreamOptions options;
+  options.data_offset = header.features_offset;
+  options.labels_offset = header.labels_offset;
+  ChunkReader reader(filename, header.columns_count * sizeof(FPType),
+                     header.rows_count, options);
+  verbose_print(verbosity, "Chunks: ", reader.chunks_count(), " of ",
+                reader.rows_per_chunk(), " rows");
+  LogRegWorkspace<FPType> workspace(meta, false);
+  bool read_ok = reader.good();
+  auto start = std::chrono::system_clock::now();
+  for (size_t index = 0; index < runs && read_ok; ++index) {
+    read_ok = logreg_stream::forward_and_gradient<FPType>(
+        kernel, meta, reader, weights.data(), nullptr, beta, workspace,
+        verbosity);
+  }
+  auto finish = std::chrono::system_clock::now();
+  if (!read_ok) {
+    verbose_print(true, "!!! Can't read ", filename);
+    return;
+  }
+  std::cout << "Streaming time (sec): "
+            << std::chrono::duration_cast<std::chrono::microseconds>(finish -
+                                                                     start)
+                       .count() /
+                   1e6 / runs
+            << std::endl;
+
+  // The streaming workspace keeps no sigmoid: compare the loss only.
+  ForwardResult<FPType> reference_loss(0);
+  reference_loss.logloss = reference.forward.logloss;
+  if (!metrics::check_forward_equality(reference_loss, workspace.forward) ||
+      !metrics::check_gradient_equality(reference.gradient,
+                                        workspace.gradient)) {
+    verbose_print(true, "!!! Streaming results are not equal");
+  } else {
+    verbose_print(true, "# Streaming results are equal");
+  }
+}
+
+// Latency of predict calls of a few request sizes on the calling thread, and
+// the throughput of concurrent one-row requests through the micro-batcher.
+void run_serving(const DataView<FPType> &data,
+                 const std::vector<FPType> &weights, const FPType beta,
+                 const bool verbosity) {
+  verbose_print(verbosity, "# Start serving");
+  const serving::Model<FPType> model(weights, beta);
+  constexpr size_t requests = 10000;
+  constexpr size_t max_request_rows = 1000;
+  if (data.meta.rows_count <= max_request_rows) {
+    return;
+  }
+  const size_t last_row = data.meta.rows_count - max_request_rows;
+  std::vector<FPType> probabilities(max_request_rows);
+  std::vector<double> latencies(requests);
+  for (const size_t rows : {size_t(1), size_t(16), max_request_rows}) {
+    for (size_t index = 0; index < requests; ++index) {
+      const size_t first_row = index * rows % last_row;
+      const auto start = std::chrono::steady_clock::now();
+      serving::predict(model, data.row(first_row), rows,
+                       probabilities.data());
+      latencies[index] = std::chrono::duration<double, std::micro>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "Predict " << rows << " rows p50 / p99 (usec): "
+              << latencies[requests / 2] << " / "
+              << latencies[requests * 99 / 100] << std::endl;
+  }
+
+  serving::MicroBatcher<FPType> batcher(model);
+  constexpr size_t clients = 4;
+  std::vector<std::thread> threads;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t client = 0; client < clients; ++client) {
+    threads.emplace_back([&, client] {
+      FPType probability;
+      for (size_t index = 0; index < requests; ++index) {
+        batcher.predict(data.row((client * requests + index) % last_row), 1,
+                        &probability);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  const std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Micro-batched requests per second: "
+            << clients * requests / time.count() << " (" << batcher.batches()
+            << " batches)" << std::endl;
+}
+
 int main() {
   tbb::task_arena arena(5);
   arena.execute([] {
     mkl_set_num_threads(1);
+    const tuning::CacheInfo &caches = tuning::cache_info();
     Meta meta{
-        static_cast<size_t>(1.5 * 1024 * 1024), // Cache size
-        100,                                    // Columns number
-        10000000                                // Rows number
+        caches.l2, // Cache size
+        100,       // Columns number
+        10000000   // Rows number
     };
     bool verbosity = check_verbosity();
+    const Kernel kernel = kernel_from_env();
 
     __itt_task_begin(domain, __itt_null, __itt_null, handle_data_gen);
     verbose_print(verbosity, "Rows: ", meta.rows_count,
                   ", Columns: ", meta.columns_count);
     verbose_print(verbosity, "Number of threads: ",
                   tbb::this_task_arena::max_concurrency());
+    verbose_print(verbosity, "Caches (KB): L1d ", caches.l1d / 1024, ", L2 ",
+                  caches.l2 / 1024, ", L3 ", caches.l3 / 1024);
+    verbose_print(verbosity, "Optimal kernel: ", kernel_name(kernel),
+                  ", SIMD: ", simd::isa_name(), ", reduction: ",
+                  reproducible::mode_name(reproducible::mode_from_env()));
     verbose_print(verbosity, "# Start data generation");
-    auto [data, weights, beta, groundTruth] =
-        generate_data<FPType>(meta, "data.dat");
+    MapOptions map_options;
+    map_options.populate = true;
+    GenerationOptions generation;
+    generation.verify = verify_from_env();
+    auto [dataset, weights, beta, groundTruth] = generate_data<FPType>(
+        meta, "data.dat", map_options, verbosity, generation);
     __itt_task_end(domain);
 
-    auto [data_extra, weights_extra, beta_extra, groundTruth_extra] =
-        generate_data<FPType>(meta, "extra.dat");
+    auto [dataset_extra, weights_extra, beta_extra, groundTruth_extra] =
+        generate_data<FPType>(meta, "extra.dat", map_options, verbosity,
+                              generation);
+    if (!dataset.good() || !dataset_extra.good()) {
+      verbose_print(true, "!!! Can't map data files");
+      return;
+    }
+    const DataView<FPType> data = dataset.view<FPType>(meta);
+    const DataView<FPType> data_extra = dataset_extra.view<FPType>(meta);
 
     constexpr size_t real_runs = 100;
 
     verbose_print(verbosity, "# Start no optimal solution");
+    stats::reset();
     auto start_noopt = std::chrono::system_clock::now();
     __itt_task_begin(domain, __itt_null, __itt_null, handle_noopt);
     for (size_t index = 0; index < real_runs; ++index) {
       auto result_forward_noopt = logreg_noopt::forward<FPType>(
-          meta, data, weights, groundTruth, beta, verbosity);
+          data, weights, groundTruth, beta, verbosity);
       auto result_gradient_noopt =
-          logreg_noopt::gradient<FPType>(meta, data, weights, groundTruth, beta,
+          logreg_noopt::gradient<FPType>(data, weights, groundTruth, beta,
                                          result_forward_noopt, verbosity);
     }
     __itt_task_end(domain);
     auto finish_noopt = std::chrono::system_clock::now();
     verbose_print(verbosity, "# No optimal solution finished");
+    if (verbosity) {
+      stats::print(std::cout, stats::report());
+    }
     std::cout << "No opt time (sec): "
               << std::chrono::duration_cast<std::chrono::microseconds>(
                      finish_noopt - start_noopt)
@@ -64,9 +375,9 @@ int main() {
                      1e6 / real_runs
               << std::endl;
     auto result_forward_noopt = logreg_noopt::forward<FPType>(
-        meta, data, weights, groundTruth, beta, verbosity);
+        data, weights, groundTruth, beta, verbosity);
     auto result_gradient_noopt =
-        logreg_noopt::gradient<FPType>(meta, data, weights, groundTruth, beta,
+        logreg_noopt::gradient<FPType>(data, weights, groundTruth, beta,
                                        result_forward_noopt, verbosity);
 
     std::this_thread::sleep_for(std::chrono::seconds(3));
@@ -74,9 +385,9 @@ int main() {
     constexpr size_t extra_runs = 10;
     for (size_t run_index = 0; run_index < extra_runs; ++run_index) {
       auto result_forward_extra =
-          logreg_noopt::forward<FPType>(meta, data_extra, weights_extra,
+          logreg_noopt::forward<FPType>(data_extra, weights_extra,
                                         groundTruth_extra, beta_extra, false);
-      logreg_noopt::gradient<FPType>(meta, data_extra, weights_extra,
+      logreg_noopt::gradient<FPType>(data_extra, weights_extra,
                                      groundTruth_extra, beta_extra,
                                      result_forward_extra, false);
     }
@@ -84,25 +395,36 @@ int main() {
     std::this_thread::sleep_for(std::chrono::seconds(3));
 
     verbose_print(verbosity, "# Start optimal solution");
+    LogRegWorkspace<FPType> workspace(meta);
+    stats::reset();
     auto start_opt = std::chrono::system_clock::now();
     __itt_task_begin(domain, __itt_null, __itt_null, handle_opt);
     for (size_t index = 0; index < real_runs; ++index) {
-      auto [result_forward_opt, result_gradient_opt] =
-          logreg_opt::forward_and_gradient<FPType>(
-              meta, data, weights, groundTruth, beta, verbosity);
+      forward_and_gradient<FPType>(kernel, data, weights.data(),
+                                   groundTruth.data(), beta, workspace,
+                                   verbosity);
     }
     __itt_task_end(domain);
     auto finish_opt = std::chrono::system_clock::now();
     verbose_print(verbosity, "# Optimal solution finished");
+    if (verbosity) {
+      stats::print(std::cout, stats::report());
+    }
     std::cout << "Opt time (sec): "
               << std::chrono::duration_cast<std::chrono::microseconds>(
                      finish_opt - start_opt)
                          .count() /
                      1e6 / real_runs
               << std::endl;
-    auto [result_forward_opt, result_gradient_opt] =
-        logreg_opt::forward_and_gradient<FPType>(meta, data, weights,
-                                                 groundTruth, beta, verbosity);
+    // The check pass also collects the model quality, inside the pass.
+    workspace.track_quality = verbosity;
+    forward_and_gradient<FPType>(kernel, data, weights.data(),
+                                 groundTruth.data(), beta, workspace,
+                                 verbosity);
+    workspace.track_quality = false;
+    verbose_print(verbosity, "# Quality: ", workspace.quality);
+    const auto &result_forward_opt = workspace.forward;
+    const auto &result_gradient_opt = workspace.gradient;
 
     bool forward_equality = metrics::check_forward_equality(
         result_forward_noopt, result_forward_opt);
@@ -118,6 +440,44 @@ int main() {
     } else {
       verbose_print(true, "# Gradient results are equal");
     }
+
+    if (numa::enabled()) {
+      run_numa(kernel, data, weights, groundTruth, beta, workspace, real_runs,
+               verbosity);
+    }
+
+    switch (storage_from_env()) {
+    case format::DType::bf16:
+      run_reduced_precision<precision::bf16>(data, weights, groundTruth, beta,
+                                             workspace, real_runs, verbosity);
+      break;
+    case format::DType::f16:
+      run_reduced_precision<precision::fp16>(data, weights, groundTruth, beta,
+                                             workspace, real_runs, verbosity);
+      break;
+    case format::DType::i8:
+      run_reduced_precision<int8_t>(data, weights, groundTruth, beta,
+                                    workspace, real_runs, verbosity);
+      break;
+    default:
+      break;
+    }
+    const size_t models_count = models_from_env();
+    if (models_count > 0) {
+      run_multi_model(data, weights, groundTruth, beta, workspace,
+                      models_count, real_runs, verbosity);
+    }
+    const size_t classes_count = classes_from_env();
+    if (classes_count > 1) {
+      run_softmax(data, classes_count, real_runs, verbosity);
+    }
+    if (stream_from_env()) {
+      run_streaming(kernel, "data.dat", meta, weights, beta, workspace,
+                    extra_runs, verbosity);
+    }
+    if (serving_from_env()) {
+      run_serving(data, weights, beta, verbosity);
+    }
     verbose_print(verbosity, "# Finished!");
   });
   return 0;
@@ -1,7 +1,11 @@
 #ifndef METRICS_HPP
 #define METRICS_HPP
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <vector>
 
 #include "structures.hpp"
 
@@ -25,8 +29,13 @@ template <typename FPType>
 bool check_forward_equality(const ForwardResult<FPType> &lhs,
                             const ForwardResult<FPType> &rhs) {
   constexpr double eps = 1e-1;
+  // The loss is a sum over all rows: the eps-clamped logs of the reference
+  // and the exact softplus form (vmath.hpp) differ by more than eps on large
+  // inputs, so it is compared relative to its magnitude.
+  constexpr double loss_rtol = 1e-4;
   return check_containers_eq(lhs.sigm, rhs.sigm, eps) &&
-         (std::abs(lhs.logloss - rhs.logloss) < eps);
+         (std::abs(lhs.logloss - rhs.logloss) <
+          std::max(eps, loss_rtol * std::abs(lhs.logloss)));
 }
 
 template <typename FPType>
@@ -37,6 +46,234 @@ bool check_gradient_equality(const GradientResult<FPType> &lhs,
          (std::abs(lhs.beta_gradient - rhs.beta_gradient) < eps);
 }
 
+// Output `output` of a multi-model result (logreg_multi.hpp) against the
+// single-model results of the same model.
+template <typename FPType>
+bool check_multi_equality(const ForwardResult<FPType> &forward,
+                          const GradientResult<FPType> &gradient,
+                          const MultiResult<FPType> &multi,
+                          const size_t output) {
+  constexpr double forward_eps = 1e-1;
+  constexpr double gradient_eps = 1;
+  const size_t outputs_count = multi.logloss.size();
+  if (multi.weights_gradient.size() !=
+      gradient.weights_gradient.size() * outputs_count) {
+    return false;
+  }
+  for (size_t index = 0; index < gradient.weights_gradient.size(); ++index) {
+    if (std::abs(gradient.weights_gradient[index] -
+                 multi.weights_gradient[index * outputs_count + output]) >=
+        gradient_eps) {
+      return false;
+    }
+  }
+  constexpr double loss_rtol = 1e-4;
+  return std::abs(forward.logloss - multi.logloss[output]) <
+             std::max(forward_eps, loss_rtol * std::abs(forward.logloss)) &&
+         std::abs(gradient.beta_gradient - multi.beta_gradient[output]) <
+             gradient_eps;
+}
+
+// Deviation of a result from a reference, e.g. of a reduced-precision run
+// from the float one.
+struct ErrorStats {
+  double max_abs = 0;
+  double max_rel = 0; // Relative to max(|reference|, 1e-12)
+  double mean_abs = 0;
+};
+
+inline void add_error(ErrorStats &stats, double reference, double value) {
+  const double error = std::abs(value - reference);
+  stats.max_abs = std::max(stats.max_abs, error);
+  stats.max_rel =
+      std::max(stats.max_rel, error / std::max(std::abs(reference), 1e-12));
+  stats.mean_abs += error;
+}
+
+template <typename Container>
+ErrorStats compare_containers(const Container &reference,
+                              const Container &value) {
+  ErrorStats stats;
+  const size_t size = std::min(reference.size(), value.size());
+  for (size_t index = 0; index < size; ++index) {
+    add_error(stats, reference[index], value[index]);
+  }
+  if (size) {
+    stats.mean_abs /= size;
+  }
+  return stats;
+}
+
+struct PrecisionReport {
+  ErrorStats sigm;
+  ErrorStats logloss;
+  ErrorStats weights_gradient;
+  ErrorStats beta_gradient;
+};
+
+template <typename FPType>
+PrecisionReport
+compare_results(const ForwardResult<FPType> &forward_reference,
+                const GradientResult<FPType> &gradient_reference,
+                const ForwardResult<FPType> &forward,
+                const GradientResult<FPType> &gradient) {
+  PrecisionReport report;
+  report.sigm = compare_containers(forward_reference.sigm, forward.sigm);
+  add_error(report.logloss, forward_reference.logloss, forward.logloss);
+  report.weights_gradient = compare_containers(
+      gradient_reference.weights_gradient, gradient.weights_gradient);
+  add_error(report.beta_gradient, gradient_reference.beta_gradient,
+            gradient.beta_gradient);
+  return report;
+}
+
+// Model quality of a pass, accumulated by the kernels next to the loss
+// (LogRegWorkspace::track_quality): every row adds one count to a histogram
+// of its sigmoid value, split by label. The rows are read while they are in
+// cache, so the metrics cost no extra pass over the data or the sigmoid.
+//
+// Counts are exact for thresholds on the bin edges, e.g. the 0.5 of
+// accuracy(); auc() is the area under the ROC curve of the binned scores,
+// rows in the same bin counted as ties. With 1024 bins it differs from the
+// exact AUC by less than the share of pairs that share a bin.
+struct Quality {
+  static constexpr size_t bins = 1024;
+
+  // Positive rows are those with a label above 0.5.
+  template <typename FPType>
+  void add(const size_t n, const FPType *sigm, const float *gt) {
+    if (histogram.empty()) {
+      histogram.assign(2 * bins, 0);
+    }
+    for (size_t index = 0; index < n; ++index) {
+      const size_t bin =
+          std::min(static_cast<size_t>(sigm[index] * bins), bins - 1);
+      ++histogram[bin + (gt[index] > 0.5f ? bins : 0)];
+    }
+  }
+
+  void merge(const Quality &other) {
+    if (other.histogram.empty()) {
+      return;
+    }
+    if (histogram.empty()) {
+      histogram.assign(2 * bins, 0);
+    }
+    for (size_t index = 0; index < 2 * bins; ++index) {
+      histogram[index] += other.histogram[index];
+    }
+    logloss += other.logloss;
+  }
+
+  void clear() {
+    std::fill(histogram.begin(), histogram.end(), 0);
+    logloss = 0;
+  }
+
+  // Rows with a score in [first_bin, last_bin) and the given label.
+  uint64_t count(const bool positive, const size_t first_bin,
+                 const size_t last_bin) const {
+    uint64_t sum = 0;
+    if (!histogram.empty()) {
+      const size_t offset = positive ? bins : 0;
+      for (size_t bin = first_bin; bin < last_bin; ++bin) {
+        sum += histogram[offset + bin];
+      }
+    }
+    return sum;
+  }
+
+  uint64_t positives() const { return count(true, 0, bins); }
+  uint64_t negatives() const { return count(false, 0, bins); }
+  uint64_t rows() const { return positives() + negatives(); }
+
+  // Confusion counts of the prediction sigm >= threshold, threshold rounded
+  // down to a bin edge.
+  uint64_t true_positives(const double threshold = 0.5) const {
+    return count(true, threshold_bin(threshold), bins);
+  }
+  uint64_t false_positives(const double threshold = 0.5) const {
+    return count(false, threshold_bin(threshold), bins);
+  }
+  uint64_t false_negatives(const double threshold = 0.5) const {
+    return count(true, 0, threshold_bin(threshold));
+  }
+  uint64_t true_negatives(const double threshold = 0.5) const {
+    return count(false, 0, threshold_bin(threshold));
+  }
+
+  double accuracy(const double threshold = 0.5) const {
+    return ratio(true_positives(threshold) + true_negatives(threshold),
+                 rows());
+  }
+  double precision(const double threshold = 0.5) const {
+    const uint64_t predicted =
+        true_positives(threshold) + false_positives(threshold);
+    return ratio(true_positives(threshold), predicted);
+  }
+  double recall(const double threshold = 0.5) const {
+    return ratio(true_positives(threshold), positives());
+  }
+
+  double mean_logloss() const {
+    const uint64_t total = rows();
+    return total ? logloss / total : 0;
+  }
+
+  // Probability that a random positive row scores above a random negative
+  // one; 0.5 when one of the classes is missing.
+  double auc() const {
+    const uint64_t positive_rows = positives();
+    const uint64_t negative_rows = negatives();
+    if (!positive_rows || !negative_rows) {
+      return 0.5;
+    }
+    double pairs = 0;
+    uint64_t positives_below = 0;
+    for (size_t bin = 0; bin < bins; ++bin) {
+      const uint64_t positive = histogram[bins + bin];
+      const uint64_t negative = histogram[bin];
+      pairs += (positives_below + 0.5 * positive) * negative;
+      positives_below += positive;
+    }
+    return 1 - pairs / (static_cast<double>(positive_rows) * negative_rows);
+  }
+
+  // Summed logloss of the rows, filled in by the workspace reduction.
+  double logloss = 0;
+
+private:
+  static size_t threshold_bin(const double threshold) {
+    return static_cast<size_t>(
+        std::min(std::max(threshold, 0.), 1.) * bins);
+  }
+
+  static double ratio(const uint64_t numerator, const uint64_t denominator) {
+    return denominator ? static_cast<double>(numerator) / denominator : 0;
+  }
+
+  // Negative rows in [0, bins), positive rows in [bins, 2 * bins). Allocated
+  // by the first add() or merge(), so workspaces that do not track quality
+  // do not pay for it.
+  std::vector<uint64_t> histogram;
+};
+
+inline std::ostream &operator<<(std::ostream &stream,
+                                const Quality &quality) {
+  stream << "accuracy " << quality.accuracy() << ", precision "
+         << quality.precision() << ", recall " << quality.recall()
+         << ", AUC " << quality.auc() << ", logloss "
+         << quality.mean_logloss();
+  return stream;
+}
+
+inline std::ostream &operator<<(std::ostream &stream,
+                                const ErrorStats &stats) {
+  stream << "max abs " << stats.max_abs << ", max rel " << stats.max_rel
+         << ", mean abs " << stats.mean_abs;
+  return stream;
+}
+
 } // namespace metrics
 
 #endif
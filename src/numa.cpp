@@ -0,0 +1,235 @@
+#include "numa.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace numa {
+
+namespace {
+
+// <numaif.h> values, so that libnuma is not needed.
+constexpr int mpol_preferred = 1;
+constexpr unsigned mpol_mf_move = 1 << 1;
+
+bool read_line(const std::string &path, std::string &line) {
+  std::ifstream file(path);
+  return static_cast<bool>(std::getline(file, line));
+}
+
+// Parses sysfs lists like "0-3,8-11".
+std::vector<int> parse_list(const std::string &text) {
+  std::vector<int> values;
+  size_t position = 0;
+  while (position < text.size()) {
+    char *end = nullptr;
+    const long first = std::strtol(text.c_str() + position, &end, 10);
+    if (end == text.c_str() + position) {
+      break;
+    }
+    long last = first;
+    if (*end == '-') {
+      const char *next = end + 1;
+      last = std::strtol(next, &end, 10);
+    }
+    for (long value = first; value <= last; ++value) {
+      values.push_back(static_cast<int>(value));
+    }
+    position = end - text.c_str();
+    if (position < text.size() && text[position] == ',') {
+      ++position;
+    } else {
+      break;
+    }
+  }
+  return values;
+}
+
+std::vector<int> all_cpus() {
+  std::vector<int> cpus;
+  const long count = sysconf(_SC_NPROCESSORS_ONLN);
+  for (long cpu = 0; cpu < std::max(count, 1L); ++cpu) {
+    cpus.push_back(static_cast<int>(cpu));
+  }
+  return cpus;
+}
+
+std::vector<Node> detect() {
+  std::vector<Node> result;
+  std::string online;
+  if (read_line("/sys/devices/system/node/online", online)) {
+    for (const int id : parse_list(online)) {
+      std::string cpulist;
+      const std::string path = "/sys/devices/system/node/node" +
+                               std::to_string(id) + "/cpulist";
+      if (!read_line(path, cpulist)) {
+        continue;
+      }
+      Node node{id, parse_list(cpulist)};
+      // Memory-only nodes have no threads to run on.
+      if (!node.cpus.empty()) {
+        result.push_back(std::move(node));
+      }
+    }
+  }
+  if (result.empty()) {
+    result.push_back(Node{0, all_cpus()});
+  }
+  return result;
+}
+
+#if defined(__linux__)
+thread_local cpu_set_t saved_mask;
+thread_local bool mask_saved = false;
+#endif
+
+} // namespace
+
+const std::vector<Node> &nodes() {
+  static const std::vector<Node> instance = detect();
+  return instance;
+}
+
+bool enabled() {
+  const char *value = std::getenv("COMP_OPT_NUMA");
+  return value && std::strcmp(value, "1") == 0;
+}
+
+std::vector<size_t> split_rows(size_t rows_count, size_t granularity) {
+  const std::vector<Node> &all = nodes();
+  granularity = std::max<size_t>(granularity, 1);
+  size_t cpus_count = 0;
+  for (const Node &node : all) {
+    cpus_count += node.cpus.size();
+  }
+  std::vector<size_t> bounds(all.size() + 1, 0);
+  size_t cpus_before = 0;
+  for (size_t index = 0; index + 1 < all.size(); ++index) {
+    cpus_before += all[index].cpus.size();
+    const size_t row = rows_count * cpus_before / cpus_count;
+    bounds[index + 1] =
+        std::max(bounds[index], std::min(rows_count, row / granularity *
+                                                         granularity));
+  }
+  bounds.back() = rows_count;
+  return bounds;
+}
+
+bool bind(const void *address, size_t bytes, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  if (bytes == 0) {
+    return true;
+  }
+  const uintptr_t page = sysconf(_SC_PAGESIZE);
+  const uintptr_t start = reinterpret_cast<uintptr_t>(address) / page * page;
+  const uintptr_t end =
+      (reinterpret_cast<uintptr_t>(address) + bytes + page - 1) / page * page;
+  constexpr size_t mask_bits = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(node / mask_bits + 1, 0);
+  mask[node / mask_bits] |= 1UL << (node % mask_bits);
+  // The kernel reads maxnode - 1 bits.
+  return syscall(SYS_mbind, start, end - start, mpol_preferred, mask.data(),
+                 mask.size() * mask_bits + 1, mpol_mf_move) == 0;
+#else
+  return false;
+#endif
+}
+
+bool place_rows(const void *data, size_t row_bytes,
+                const std::vector<size_t> &bounds) {
+#if defined(__linux__)
+  const uintptr_t page = sysconf(_SC_PAGESIZE);
+  const uintptr_t base = reinterpret_cast<uintptr_t>(data);
+  const std::vector<Node> &all = nodes();
+  bool placed = true;
+  for (size_t index = 0; index + 1 < bounds.size() && index < all.size();
+       ++index) {
+    // Ranges are cut at page starts: the page of a boundary row belongs to
+    // the range after it.
+    const uintptr_t begin =
+        index == 0 ? base : (base + bounds[index] * row_bytes) / page * page;
+    const uintptr_t end =
+        index + 2 == bounds.size()
+            ? base + bounds[index + 1] * row_bytes
+            : (base + bounds[index + 1] * row_bytes) / page * page;
+    if (end > begin) {
+      placed = bind(reinterpret_cast<const void *>(begin), end - begin,
+                    all[index].id) &&
+               placed;
+    }
+  }
+  return placed;
+#else
+  return false;
+#endif
+}
+
+bool pin_thread(const std::vector<int> &cpus) {
+#if defined(__linux__)
+  if (cpus.empty()) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+Pinner::Pinner(tbb::task_arena &arena, const std::vector<int> &cpus)
+    : tbb::task_scheduler_observer(arena), cpus(cpus) {
+  observe(true);
+}
+
+Pinner::~Pinner() { observe(false); }
+
+void Pinner::on_scheduler_entry(bool) {
+#if defined(__linux__)
+  mask_saved = sched_getaffinity(0, sizeof(saved_mask), &saved_mask) == 0;
+#endif
+  pin_thread(cpus);
+}
+
+void Pinner::on_scheduler_exit(bool) {
+#if defined(__linux__)
+  if (mask_saved) {
+    sched_setaffinity(0, sizeof(saved_mask), &saved_mask);
+    mask_saved = false;
+  }
+#endif
+}
+
+Executor::Executor(int concurrency) {
+  const std::vector<Node> &all = nodes();
+  size_t cpus_count = 0;
+  for (const Node &node : all) {
+    cpus_count += node.cpus.size();
+  }
+  for (const Node &node : all) {
+    const int node_concurrency = std::max<int>(
+        1, static_cast<int>(concurrency * node.cpus.size() / cpus_count));
+    // No slot reserved for the calling thread: the node work is picked up by
+    // workers while the caller starts the other nodes.
+    arenas.push_back(std::make_unique<tbb::task_arena>(node_concurrency, 0));
+    arenas.back()->initialize();
+    pinners.push_back(std::make_unique<Pinner>(*arenas.back(), node.cpus));
+    groups.push_back(std::make_unique<tbb::task_group>());
+  }
+}
+
+} // namespace numa
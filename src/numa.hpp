@@ -0,0 +1,184 @@
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <tbb/tbb.h>
+
+#include "dispatch.hpp"
+#include "structures.hpp"
+#include "workspace.hpp"
+
+// NUMA placement of the rows and node-local execution of the row-block
+// kernels. A pass reads all the data once, so on a machine with several
+// nodes every remote row is read over the interconnect. Here the rows are
+// split into one contiguous range per node (proportional to its CPUs), the
+// pages of each range are moved to its node, and the range is processed in
+// a task_arena whose threads are pinned to the CPUs of the node, into a
+// LogRegWorkspace of the node. Its thread-local accumulators are first
+// touched, so allocated, by those threads. The node results are reduced on
+// the node, then summed over the nodes.
+//
+// Nodes are read from /sys/devices/system/node. Without it there is one
+// node with all the CPUs, and everything works the same on one arena.
+// Pinning uses sched_setaffinity, so no hwloc / tbbbind is needed.
+namespace numa {
+
+struct Node {
+  int id = 0;
+  std::vector<int> cpus{};
+};
+
+// Detected once; never empty.
+const std::vector<Node> &nodes();
+
+// Node-local execution is requested with COMP_OPT_NUMA=1.
+bool enabled();
+
+// nodes().size() + 1 row boundaries: node i owns [bounds[i], bounds[i + 1]).
+// Ranges are proportional to the CPUs of the nodes and, except the last one,
+// multiples of `granularity` rows.
+std::vector<size_t> split_rows(size_t rows_count, size_t granularity = 1);
+
+// Moves the pages of [address, address + bytes) to `node` and prefers it for
+// the pages faulted later (mbind with MPOL_PREFERRED, MPOL_MF_MOVE). The
+// range is extended to whole pages. False when the kernel refuses it.
+bool bind(const void *address, size_t bytes, int node);
+
+// Binds the rows of every node range of `bounds` to its node. Boundary
+// pages go to the node of their first byte, so no page is bound twice.
+bool place_rows(const void *data, size_t row_bytes,
+                const std::vector<size_t> &bounds);
+
+// Restricts the calling thread to `cpus`. False on failure or empty cpus.
+bool pin_thread(const std::vector<int> &cpus);
+
+// Pins every thread that enters `arena` to `cpus` and restores the previous
+// mask when it leaves, so threads shared with other arenas are not left
+// pinned.
+class Pinner : public tbb::task_scheduler_observer {
+public:
+  Pinner(tbb::task_arena &arena, const std::vector<int> &cpus);
+  ~Pinner() override;
+
+  void on_scheduler_entry(bool is_worker) override;
+  void on_scheduler_exit(bool is_worker) override;
+
+private:
+  const std::vector<int> cpus;
+};
+
+// One pinned arena per node. The threads of the calling arena are split
+// over the nodes in proportion to their CPUs, at least one per node.
+class Executor {
+public:
+  explicit Executor(int concurrency = tbb::this_task_arena::max_concurrency());
+
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  size_t nodes_count() const { return arenas.size(); }
+
+  // Runs function(node) for all the nodes at the same time, each in the
+  // arena of its node, and waits for all of them.
+  template <typename Function> void run(const Function &function) {
+    for (size_t node = 0; node < arenas.size(); ++node) {
+      arenas[node]->execute(
+          [&, node] { groups[node]->run([&, node] { function(node); }); });
+    }
+    for (size_t node = 0; node < arenas.size(); ++node) {
+      arenas[node]->execute([&, node] { groups[node]->wait(); });
+    }
+  }
+
+private:
+  std::vector<std::unique_ptr<tbb::task_arena>> arenas;
+  std::vector<std::unique_ptr<Pinner>> pinners;
+  std::vector<std::unique_ptr<tbb::task_group>> groups;
+};
+
+// Per-node workspaces and the summed results of a node-local pass. The
+// workspaces do not materialize the sigmoid, so forward.sigm is empty.
+template <typename FPType> class Workspace {
+public:
+  explicit Workspace(const Meta &meta)
+      : columns_count(meta.columns_count),
+        bounds(split_rows(meta.rows_count)), forward(0),
+        gradient(meta.columns_count), metas(executor.nodes_count(), meta),
+        workspaces(executor.nodes_count()) {
+    executor.run([&](size_t node) {
+      metas[node].rows_count = bounds[node + 1] - bounds[node];
+      workspaces[node] =
+          std::make_unique<LogRegWorkspace<FPType>>(metas[node], false);
+    });
+  }
+
+  // Sums the node results; each node has reduced its threads already.
+  void reduce() {
+    double logloss = 0, beta_gradient = 0;
+    for (const auto &workspace : workspaces) {
+      logloss += workspace->forward.logloss;
+      beta_gradient += workspace->gradient.beta_gradient;
+    }
+    forward.logloss = logloss;
+    gradient.beta_gradient = beta_gradient;
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, columns_count, reduce_grain),
+        [&](tbb::blocked_range<size_t> r) {
+          for (size_t index = r.begin(); index < r.end(); ++index) {
+            double sum = 0;
+            for (const auto &workspace : workspaces) {
+              sum += workspace->gradient.weights_gradient[index];
+            }
+            gradient.weights_gradient[index] = sum;
+          }
+        });
+  }
+
+  static constexpr size_t reduce_grain = 4096;
+
+  const size_t columns_count;
+  Executor executor;
+  const std::vector<size_t> bounds;
+  ForwardResult<FPType> forward;
+  GradientResult<FPType> gradient;
+  std::vector<Meta> metas;
+  std::vector<std::unique_ptr<LogRegWorkspace<FPType>>> workspaces;
+};
+
+// forward_and_gradient of dispatch.hpp on the rows of every node, in the
+// arena of the node. Place the rows with place_rows(..., workspace.bounds)
+// first, otherwise the threads are local but the data may not be.
+template <typename FPType>
+void forward_and_gradient(const Kernel kernel, const Meta &meta,
+                          const FPType *data, const FPType *weights,
+                          const float *groundTruth, const FPType beta_weight,
+                          Workspace<FPType> &workspace, const bool verbosity) {
+  workspace.executor.run([&](size_t node) {
+    const size_t first_row = workspace.bounds[node];
+    if (workspace.metas[node].rows_count == 0) {
+      workspace.workspaces[node]->reset();
+      return;
+    }
+    ::forward_and_gradient<FPType>(
+        kernel, workspace.metas[node], data + first_row * meta.columns_count,
+        weights, groundTruth + first_row, beta_weight,
+        *workspace.workspaces[node], verbosity);
+  });
+  workspace.reduce();
+}
+
+template <typename FPType>
+void forward_and_gradient(const Kernel kernel, const DataView<FPType> &data,
+                          const FPType *weights, const float *groundTruth,
+                          const FPType beta_weight,
+                          Workspace<FPType> &workspace, const bool verbosity) {
+  forward_and_gradient<FPType>(kernel, data.meta, data.data, weights,
+                               groundTruth, beta_weight, workspace, verbosity);
+}
+
+} // namespace numa
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef OPTIMIZERS_HPP
+#define OPTIMIZERS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <tbb/tbb.h>
+
+#include "structures.hpp"
+
+// Update rules used by training::Trainer. An optimizer is any type with
+//   void reset(size_t columns_count);
+//   void begin_step(FPType scale);
+//   void update(size_t index, FPType &weight, FPType gradient);
+//   void update_beta(FPType &beta, FPType gradient);
+// where `scale` turns the summed gradient returned by the kernels into the
+// mean gradient over the rows of the current batch. A step is begin_step(),
+// then update() of every column in any order and from any thread, then
+// update_beta(): Trainer runs the updates inside the gradient reduction
+// (LogRegWorkspace::reduce_gradient). step() does the same on its own.
+// State is allocated once in reset(), a step does not allocate.
+namespace optimizers {
+
+// Columns are updated in chunks so wide models use all threads, narrow ones
+// (a single chunk) are updated inline by the calling thread.
+constexpr size_t columns_grain_size = 4096;
+
+template <typename FPType, typename Optimizer>
+void step(Optimizer &optimizer, std::vector<FPType> &weights, FPType &beta,
+          const GradientResult<FPType> &gradient, const FPType scale) {
+  optimizer.begin_step(scale);
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, weights.size(), columns_grain_size),
+      [&](tbb::blocked_range<size_t> r) {
+        for (size_t index = r.begin(); index < r.end(); ++index) {
+          optimizer.update(index, weights[index],
+                           gradient.weights_gradient[index]);
+        }
+      });
+  optimizer.update_beta(beta, gradient.beta_gradient);
+}
+
+template <typename FPType> struct GradientDescent {
+  FPType learning_rate = 0.1;
+
+  FPType rate = 0;
+
+  void reset(size_t) {}
+
+  void begin_step(const FPType scale) { rate = learning_rate * scale; }
+
+  void update(size_t, FPType &weight, const FPType gradient) const {
+    weight -= rate * gradient;
+  }
+
+  void update_beta(FPType &beta, const FPType gradient) const {
+    beta -= rate * gradient;
+  }
+};
+
+template <typename FPType> struct Momentum {
+  FPType learning_rate = 0.1;
+  FPType momentum = 0.9;
+  bool nesterov = false;
+
+  std::vector<FPType> velocity{};
+  FPType beta_velocity = 0;
+  FPType scale = 0;
+
+  void reset(size_t columns_count) {
+    velocity.assign(columns_count, 0);
+    beta_velocity = 0;
+  }
+
+  void begin_step(const FPType step_scale) { scale = step_scale; }
+
+  void update(const size_t index, FPType &weight, const FPType gradient) {
+    apply(weight, velocity[index], scale * gradient);
+  }
+
+  void update_beta(FPType &beta, const FPType gradient) {
+    apply(beta, beta_velocity, scale * gradient);
+  }
+
+private:
+  void apply(FPType &weight, FPType &velocity_value,
+             const FPType grad) const {
+    velocity_value = momentum * velocity_value - learning_rate * grad;
+    weight += nesterov ? momentum * velocity_value - learning_rate * grad
+                       : velocity_value;
+  }
+};
+
+template <typename FPType> struct Adam {
+  FPType learning_rate = 0.01;
+  FPType beta1 = 0.9;
+  FPType beta2 = 0.999;
+  FPType epsilon = 1e-8;
+
+  std::vector<FPType> first_moment{}, second_moment{};
+  FPType beta_first_moment = 0, beta_second_moment = 0;
+  size_t steps_count = 0;
+  FPType scale = 0, rate = 0;
+
+  void reset(size_t columns_count) {
+    first_moment.assign(columns_count, 0);
+    second_moment.assign(columns_count, 0);
+    beta_first_moment = 0;
+    beta_second_moment = 0;
+    steps_count = 0;
+  }
+
+  void begin_step(const FPType step_scale) {
+    ++steps_count;
+    const FPType first_correction = 1 - std::pow(beta1, steps_count);
+    const FPType second_correction = 1 - std::pow(beta2, steps_count);
+    scale = step_scale;
+    rate = learning_rate * std::sqrt(second_correction) / first_correction;
+  }
+
+  void update(const size_t index, FPType &weight, const FPType gradient) {
+    apply(weight, first_moment[index], second_moment[index],
+          scale * gradient);
+  }
+
+  void update_beta(FPType &beta, const FPType gradient) {
+    apply(beta, beta_first_moment, beta_second_moment, scale * gradient);
+  }
+
+private:
+  void apply(FPType &weight, FPType &first, FPType &second,
+             const FPType grad) const {
+    first = beta1 * first + (1 - beta1) * grad;
+    second = beta2 * second + (1 - beta2) * grad * grad;
+    weight -= rate * first / (std::sqrt(second) + epsilon);
+  }
+};
+
+// Elastic-net penalty l1 * |w|_1 + l2 / 2 * |w|^2 of the weights; beta is
+// never penalized.
+template <typename FPType> struct ElasticNet {
+  FPType l1 = 0;
+  FPType l2 = 0;
+
+  double value(const std::vector<FPType> &weights) const {
+    double absolute = 0, squared = 0;
+    for (const auto weight : weights) {
+      absolute += std::abs(weight);
+      squared += static_cast<double>(weight) * weight;
+    }
+    return l1 * absolute + 0.5 * l2 * squared;
+  }
+
+  // argmin_x (x - value)^2 / (2 * rate) + penalty(x).
+  FPType prox(const FPType value, const FPType rate) const {
+    return soft_threshold(value, rate * l1) / (1 + rate * l2);
+  }
+
+  static FPType soft_threshold(const FPType value, const FPType threshold) {
+    return std::copysign(std::max(std::abs(value) - threshold, FPType(0)),
+                         value);
+  }
+};
+
+// Proximal gradient descent (ISTA): a gradient step on the loss, then the
+// prox of the penalty, so L1 drives weights exactly to 0 instead of
+// oscillating around it. With a zero penalty this is GradientDescent. The
+// loss reported by Trainer does not include the penalty.
+template <typename FPType> struct ProximalGradient {
+  FPType learning_rate = 0.1;
+  ElasticNet<FPType> penalty{};
+
+  FPType rate = 0;
+
+  void reset(size_t) {}
+
+  void begin_step(const FPType scale) { rate = learning_rate * scale; }
+
+  void update(size_t, FPType &weight, const FPType gradient) const {
+    weight = penalty.prox(weight - rate * gradient, learning_rate);
+  }
+
+  void update_beta(FPType &beta, const FPType gradient) const {
+    beta -= rate * gradient;
+  }
+};
+
+} // namespace optimizers
+
+#endif
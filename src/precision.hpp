@@ -0,0 +1,196 @@
+#ifndef PRECISION_HPP
+#define PRECISION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include <tbb/tbb.h>
+
+#include "structures.hpp"
+#include "workspace.hpp"
+
+// Compressed feature storage. The kernels read features as bf16, fp16 or
+// int8 and decode them to float in registers, so a pass moves 2x / 4x fewer
+// bytes; all the math stays in float. int8 values are scaled per column:
+// x[row][col] = q[row][col] * scales[col].
+namespace precision {
+
+struct bf16 {
+  uint16_t bits;
+};
+
+struct fp16 {
+  uint16_t bits;
+};
+
+inline float to_float(const float value) { return value; }
+inline double to_float(const double value) { return value; }
+inline float to_float(const int8_t value) { return value; }
+
+inline float to_float(const bf16 value) {
+  const uint32_t bits = static_cast<uint32_t>(value.bits) << 16;
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+inline float to_float(const fp16 value) {
+  const uint32_t sign = static_cast<uint32_t>(value.bits & 0x8000) << 16;
+  const uint32_t exponent = (value.bits >> 10) & 0x1F;
+  const uint32_t mantissa = value.bits & 0x3FF;
+  uint32_t bits;
+  if (exponent == 0x1F) { // Inf / NaN
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else { // Zero / subnormal: mantissa * 2^-24 is exact in float
+    const float magnitude = mantissa * (1.f / (1 << 24));
+    std::memcpy(&bits, &magnitude, sizeof(bits));
+    bits |= sign;
+  }
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+// Round to nearest even.
+inline bf16 to_bf16(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  if (std::isnan(value)) {
+    return bf16{static_cast<uint16_t>((bits >> 16) | 0x40)};
+  }
+  bits += 0x7FFF + ((bits >> 16) & 1);
+  return bf16{static_cast<uint16_t>(bits >> 16)};
+}
+
+// Round to nearest even, overflow to inf.
+inline fp16 to_fp16(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+  bits &= 0x7FFFFFFF;
+  if (bits >= 0x7F800000) { // Inf / NaN
+    return fp16{static_cast<uint16_t>(sign | 0x7C00 |
+                                      (bits > 0x7F800000 ? 0x200 : 0))};
+  }
+  if (bits >= 0x477FF000) { // Rounds to 65536 or more
+    return fp16{static_cast<uint16_t>(sign | 0x7C00)};
+  }
+  if (bits < 0x38800000) { // Subnormal: let float addition do the rounding
+    float magnitude;
+    std::memcpy(&magnitude, &bits, sizeof(magnitude));
+    magnitude += 0.5f;
+    std::memcpy(&bits, &magnitude, sizeof(bits));
+    return fp16{static_cast<uint16_t>(sign | (bits - 0x3F000000))};
+  }
+  bits += 0xFFF + ((bits >> 13) & 1) - (112u << 23);
+  return fp16{static_cast<uint16_t>(sign | (bits >> 13))};
+}
+
+inline int8_t to_int8(const float value, const float inverse_scale) {
+  return static_cast<int8_t>(
+      std::clamp(std::nearbyint(value * inverse_scale), -127.f, 127.f));
+}
+
+template <typename Storage> constexpr bool is_scaled() {
+  return std::is_same<Storage, int8_t>::value;
+}
+
+// Non-owning row-major matrix of compressed features. scales is null unless
+// Storage is int8_t.
+template <typename Storage> struct QuantizedView {
+  const Storage *data = nullptr;
+  const float *scales = nullptr;
+  Meta meta{};
+};
+
+template <typename Storage> struct Quantized {
+  aligned_vector<Storage> data;
+  std::vector<float> scales;
+  Meta meta{};
+
+  QuantizedView<Storage> view() const {
+    return QuantizedView<Storage>{data.data(),
+                                  scales.empty() ? nullptr : scales.data(),
+                                  meta};
+  }
+};
+
+// scales[col] = max |x[row][col]| / 127 (1 for all-zero columns).
+template <typename FPType>
+std::vector<float> column_scales(const DataView<FPType> &data) {
+  const size_t columns_count = data.meta.columns_count;
+  tbb::enumerable_thread_specific<std::vector<float>> tls(
+      std::vector<float>(columns_count, 0.f));
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, data.meta.rows_count),
+                    [&](tbb::blocked_range<size_t> r) {
+                      auto &local = tls.local();
+                      for (size_t row = r.begin(); row < r.end(); ++row) {
+                        const FPType *row_ptr = data.row(row);
+                        for (size_t col = 0; col < columns_count; ++col) {
+                          local[col] = std::max<float>(
+                              local[col], std::abs(row_ptr[col]));
+                        }
+                      }
+                    });
+  std::vector<float> scales(columns_count, 0.f);
+  for (const auto &local : tls) {
+    for (size_t col = 0; col < columns_count; ++col) {
+      scales[col] = std::max(scales[col], local[col]);
+    }
+  }
+  for (auto &scale : scales) {
+    scale = scale > 0 ? scale / 127 : 1;
+  }
+  return scales;
+}
+
+// Converts a dense matrix to Storage in parallel.
+template <typename Storage, typename FPType>
+Quantized<Storage> quantize(const DataView<FPType> &data) {
+  Quantized<Storage> result;
+  result.meta = data.meta;
+  result.data.resize(data.size());
+  std::vector<float> inverse_scales;
+  if constexpr (is_scaled<Storage>()) {
+    result.scales = column_scales(data);
+    for (const auto scale : result.scales) {
+      inverse_scales.push_back(1 / scale);
+    }
+  }
+  const size_t columns_count = data.meta.columns_count;
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, data.meta.rows_count),
+                    [&](tbb::blocked_range<size_t> r) {
+                      for (size_t row = r.begin(); row < r.end(); ++row) {
+                        const FPType *src = data.row(row);
+                        Storage *dst = result.data.data() + row * columns_count;
+                        for (size_t col = 0; col < columns_count; ++col) {
+                          if constexpr (is_scaled<Storage>()) {
+                            dst[col] = to_int8(src[col], inverse_scales[col]);
+                          } else if constexpr (std::is_same<Storage,
+                                                            bf16>::value) {
+                            dst[col] = to_bf16(src[col]);
+                          } else {
+                            dst[col] = to_fp16(src[col]);
+                          }
+                        }
+                      }
+                    });
+  return result;
+}
+
+template <typename Storage> const char *storage_name();
+template <> inline const char *storage_name<float>() { return "f32"; }
+template <> inline const char *storage_name<double>() { return "f64"; }
+template <> inline const char *storage_name<bf16>() { return "bf16"; }
+template <> inline const char *storage_name<fp16>() { return "f16"; }
+template <> inline const char *storage_name<int8_t>() { return "i8"; }
+
+} // namespace precision
+
+#endif
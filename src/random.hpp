@@ -0,0 +1,213 @@
+#ifndef RANDOM_HPP
+#define RANDOM_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al., SC'11).
+// Value number `index` of stream `stream` is a pure function of
+// (seed, stream, index), so any block of any stream can be generated by any
+// thread in any order and the result is bit-identical for every thread
+// count. No state is shared between threads.
+//
+// Values are produced in batches of batch_values: batch b holds the four
+// output words of the batch_counters counters b * batch_counters + lane,
+// stored word-major (value b * 64 + word * 16 + lane), so a batch is written
+// with plain vector stores.
+namespace rng {
+
+constexpr size_t batch_counters = 16;
+constexpr size_t batch_values = 4 * batch_counters;
+
+constexpr uint32_t philox_m0 = 0xD2511F53u;
+constexpr uint32_t philox_m1 = 0xCD9E8D57u;
+constexpr uint32_t philox_w0 = 0x9E3779B9u;
+constexpr uint32_t philox_w1 = 0xBB67AE85u;
+
+// Scalar Philox4x32-10 of one counter.
+inline void philox(const uint64_t seed, const uint64_t counter,
+                   const uint64_t stream, uint32_t out[4]) {
+  uint32_t c0 = static_cast<uint32_t>(counter);
+  uint32_t c1 = static_cast<uint32_t>(counter >> 32);
+  uint32_t c2 = static_cast<uint32_t>(stream);
+  uint32_t c3 = static_cast<uint32_t>(stream >> 32);
+  uint32_t k0 = static_cast<uint32_t>(seed);
+  uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+  for (int round = 0; round < 10; ++round) {
+    const uint64_t product0 = uint64_t(philox_m0) * c0;
+    const uint64_t product1 = uint64_t(philox_m1) * c2;
+    c0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+    c2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+    c1 = static_cast<uint32_t>(product1);
+    c3 = static_cast<uint32_t>(product0);
+    k0 += philox_w0;
+    k1 += philox_w1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+#if defined(__AVX512F__)
+
+inline void philox_batch(const uint64_t seed, const uint64_t batch,
+                         const uint64_t stream, uint32_t *out) {
+  const uint64_t first = batch * batch_counters;
+  const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                          11, 12, 13, 14, 15);
+  // first is a multiple of 16, so the low word never wraps inside a batch.
+  __m512i c0 = _mm512_add_epi32(
+      _mm512_set1_epi32(static_cast<uint32_t>(first)), lanes);
+  __m512i c1 = _mm512_set1_epi32(static_cast<uint32_t>(first >> 32));
+  __m512i c2 = _mm512_set1_epi32(static_cast<uint32_t>(stream));
+  __m512i c3 = _mm512_set1_epi32(static_cast<uint32_t>(stream >> 32));
+  const __m512i m0 = _mm512_set1_epi32(philox_m0);
+  const __m512i m1 = _mm512_set1_epi32(philox_m1);
+  uint32_t k0 = static_cast<uint32_t>(seed);
+  uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+  constexpr __mmask16 odd = 0xAAAA;
+  for (int round = 0; round < 10; ++round) {
+    const __m512i even0 = _mm512_mul_epu32(c0, m0);
+    const __m512i odd0 = _mm512_mul_epu32(_mm512_srli_epi64(c0, 32), m0);
+    const __m512i even1 = _mm512_mul_epu32(c2, m1);
+    const __m512i odd1 = _mm512_mul_epu32(_mm512_srli_epi64(c2, 32), m1);
+    const __m512i low0 =
+        _mm512_mask_blend_epi32(odd, even0, _mm512_slli_epi64(odd0, 32));
+    const __m512i high0 =
+        _mm512_mask_blend_epi32(odd, _mm512_srli_epi64(even0, 32), odd0);
+    const __m512i low1 =
+        _mm512_mask_blend_epi32(odd, even1, _mm512_slli_epi64(odd1, 32));
+    const __m512i high1 =
+        _mm512_mask_blend_epi32(odd, _mm512_srli_epi64(even1, 32), odd1);
+    c0 = _mm512_xor_si512(_mm512_xor_si512(high1, c1), _mm512_set1_epi32(k0));
+    c2 = _mm512_xor_si512(_mm512_xor_si512(high0, c3), _mm512_set1_epi32(k1));
+    c1 = low1;
+    c3 = low0;
+    k0 += philox_w0;
+    k1 += philox_w1;
+  }
+  _mm512_storeu_si512(out, c0);
+  _mm512_storeu_si512(out + 16, c1);
+  _mm512_storeu_si512(out + 32, c2);
+  _mm512_storeu_si512(out + 48, c3);
+}
+
+#elif defined(__AVX2__)
+
+inline void philox_batch(const uint64_t seed, const uint64_t batch,
+                         const uint64_t stream, uint32_t *out) {
+  const uint64_t first = batch * batch_counters;
+  const __m256i m0 = _mm256_set1_epi32(philox_m0);
+  const __m256i m1 = _mm256_set1_epi32(philox_m1);
+  for (size_t half = 0; half < 2; ++half) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    // first is a multiple of 16, so the low word never wraps inside a batch.
+    __m256i c0 = _mm256_add_epi32(
+        _mm256_set1_epi32(static_cast<uint32_t>(first + half * 8)), lanes);
+    __m256i c1 = _mm256_set1_epi32(static_cast<uint32_t>(first >> 32));
+    __m256i c2 = _mm256_set1_epi32(static_cast<uint32_t>(stream));
+    __m256i c3 = _mm256_set1_epi32(static_cast<uint32_t>(stream >> 32));
+    uint32_t k0 = static_cast<uint32_t>(seed);
+    uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+    for (int round = 0; round < 10; ++round) {
+      const __m256i even0 = _mm256_mul_epu32(c0, m0);
+      const __m256i odd0 = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), m0);
+      const __m256i even1 = _mm256_mul_epu32(c2, m1);
+      const __m256i odd1 = _mm256_mul_epu32(_mm256_srli_epi64(c2, 32), m1);
+      const __m256i low0 =
+          _mm256_blend_epi32(even0, _mm256_slli_epi64(odd0, 32), 0xAA);
+      const __m256i high0 =
+          _mm256_blend_epi32(_mm256_srli_epi64(even0, 32), odd0, 0xAA);
+      const __m256i low1 =
+          _mm256_blend_epi32(even1, _mm256_slli_epi64(odd1, 32), 0xAA);
+      const __m256i high1 =
+          _mm256_blend_epi32(_mm256_srli_epi64(even1, 32), odd1, 0xAA);
+      c0 = _mm256_xor_si256(_mm256_xor_si256(high1, c1),
+                            _mm256_set1_epi32(k0));
+      c2 = _mm256_xor_si256(_mm256_xor_si256(high0, c3),
+                            _mm256_set1_epi32(k1));
+      c1 = low1;
+      c3 = low0;
+      k0 += philox_w0;
+      k1 += philox_w1;
+    }
+    uint32_t *half_out = out + half * 8;
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(half_out), c0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(half_out + 16), c1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(half_out + 32), c2);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(half_out + 48), c3);
+  }
+}
+
+#else
+
+inline void philox_batch(const uint64_t seed, const uint64_t batch,
+                         const uint64_t stream, uint32_t *out) {
+  for (size_t lane = 0; lane < batch_counters; ++lane) {
+    uint32_t words[4];
+    philox(seed, batch * batch_counters + lane, stream, words);
+    for (size_t word = 0; word < 4; ++word) {
+      out[word * batch_counters + lane] = words[word];
+    }
+  }
+}
+
+#endif
+
+// Uniform value in [low, high) from 24 random bits (exact in float).
+template <typename FPType>
+inline FPType uniform(const uint32_t bits, const FPType low,
+                      const FPType high) {
+  const FPType unit = static_cast<FPType>(static_cast<int32_t>(bits >> 8)) *
+                      FPType(1. / (1 << 24));
+  return low + (high - low) * unit;
+}
+
+// Calls body(index, bits) for values first ... first + count - 1 of a
+// stream.
+template <typename Body>
+inline void for_each_value(const uint64_t seed, const uint64_t stream,
+                           const uint64_t first, const size_t count,
+                           const Body &body) {
+  alignas(64) uint32_t words[batch_values];
+  const uint64_t last = first + count;
+  for (uint64_t batch = first / batch_values; batch * batch_values < last;
+       ++batch) {
+    philox_batch(seed, batch, stream, words);
+    const uint64_t begin = std::max(first, batch * batch_values);
+    const uint64_t end = std::min(last, (batch + 1) * batch_values);
+    for (uint64_t index = begin; index < end; ++index) {
+      body(index, words[index - batch * batch_values]);
+    }
+  }
+}
+
+// out[i] = uniform value number first + i of a stream.
+template <typename FPType>
+inline void fill_uniform(FPType *out, const size_t count, const uint64_t seed,
+                         const uint64_t stream, const uint64_t first,
+                         const FPType low, const FPType high) {
+  alignas(64) uint32_t words[batch_values];
+  const uint64_t last = first + count;
+  for (uint64_t batch = first / batch_values; batch * batch_values < last;
+       ++batch) {
+    philox_batch(seed, batch, stream, words);
+    const uint64_t begin = std::max(first, batch * batch_values);
+    const uint64_t end = std::min(last, (batch + 1) * batch_values);
+    const uint32_t *bits = words + (begin - batch * batch_values);
+    FPType *dst = out + (begin - first);
+    for (size_t index = 0; index < end - begin; ++index) {
+      dst[index] = uniform(bits[index], low, high);
+    }
+  }
+}
+
+} // namespace rng
+
+#endif
@@ -0,0 +1,31 @@
+#include "reproducible.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace reproducible {
+
+Mode mode_from_env() {
+  const char *value = std::getenv("COMP_OPT_DETERMINISTIC");
+  if (value && std::strcmp(value, "1") == 0) {
+    return Mode::deterministic;
+  }
+  if (value && std::strcmp(value, "kahan") == 0) {
+    return Mode::compensated;
+  }
+  return Mode::fast;
+}
+
+const char *mode_name(Mode mode) {
+  switch (mode) {
+  case Mode::deterministic:
+    return "deterministic";
+  case Mode::compensated:
+    return "compensated";
+  case Mode::fast:
+  default:
+    return "fast";
+  }
+}
+
+} // namespace reproducible
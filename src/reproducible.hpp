@@ -0,0 +1,94 @@
+#ifndef REPRODUCIBLE_HPP
+#define REPRODUCIBLE_HPP
+
+#include <cmath>
+#include <cstddef>
+
+// Reduction modes of the row-block kernels. The fast mode sums into
+// per-thread accumulators, so which rows end up in which partial sum, and
+// the order the partials are added in, depend on the scheduling: the loss
+// and gradient change in the last bits from run to run and with the thread
+// count.
+//
+// The deterministic modes give every row block a fixed place in a fixed
+// reduction tree instead (LogRegWorkspace::for_each_block,
+// MultiWorkspace::for_each_block): the blocks are
+// split into a constant number of chunks of consecutive blocks, each chunk
+// sums its blocks in order into a partial of its own, and the partials are
+// added pairwise in chunk order. Results are bit-identical for any thread
+// count and partitioner as long as the block size is fixed, so autotuning is
+// skipped. Compensated mode also keeps the partials in double with Neumaier
+// compensation, for sums over very many rows.
+//
+// MKL may pick different code paths on different CPUs; set MKL_CBWR to
+// compare results across machines.
+namespace reproducible {
+
+enum class Mode { fast, deterministic, compensated };
+
+// From the COMP_OPT_DETERMINISTIC environment variable: "1" for
+// deterministic, "kahan" for compensated, fast otherwise.
+Mode mode_from_env();
+
+const char *mode_name(Mode mode);
+
+// Neumaier's variant of Kahan summation: also exact when the added value is
+// larger than the running sum.
+struct Compensated {
+  void add(const double value) {
+    const double total = sum + value;
+    compensation += std::abs(sum) >= std::abs(value)
+                        ? (sum - total) + value
+                        : (value - total) + sum;
+    sum = total;
+  }
+
+  void add(const Compensated &other) {
+    add(other.sum);
+    add(other.compensation);
+  }
+
+  double value() const { return sum + compensation; }
+
+  double sum = 0;
+  double compensation = 0;
+};
+
+// Sum of value(first), ..., value(last - 1) over a balanced binary tree
+// whose shape depends on the count only.
+template <typename Value>
+double pairwise_sum(const size_t first, const size_t last,
+                    const Value &value) {
+  if (last - first <= 2) {
+    return last == first       ? 0.
+           : last - first == 1 ? value(first)
+                               : value(first) + value(first + 1);
+  }
+  const size_t middle = first + (last - first) / 2;
+  return pairwise_sum(first, middle, value) +
+         pairwise_sum(middle, last, value);
+}
+
+// Sum of value(chunk) over the chunks [0, chunks_count): pairwise in
+// Mode::deterministic (value(chunk).sum), compensated in chunk order in
+// Mode::compensated, 0 in Mode::fast.
+template <typename Value>
+double sum_chunks(const Mode mode, const size_t chunks_count,
+                  const Value &value) {
+  if (mode == Mode::compensated) {
+    Compensated total;
+    for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+      total.add(value(chunk));
+    }
+    return total.value();
+  }
+  if (mode == Mode::deterministic) {
+    return pairwise_sum(0, chunks_count,
+                        [&](size_t chunk) { return value(chunk).sum; });
+  }
+  return 0;
+}
+
+} // namespace reproducible
+
+#endif
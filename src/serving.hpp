@@ -0,0 +1,250 @@
+#ifndef SERVING_HPP
+#define SERVING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <mkl.h>
+#include <tbb/tbb.h>
+
+#include "logreg.hpp"
+#include "tuning.hpp"
+#include "vmath.hpp"
+#include "workspace.hpp"
+
+// Scoring of trained models for serving: probabilities of a batch of rows,
+// without labels, loss or gradient. A request of a few rows costs one gemv
+// and one vectorized sigmoid on the calling thread; only batches of at least
+// Model::parallel_values values go through tbb::parallel_for. Nothing is
+// allocated per call: the caller owns the output and the model owns
+// everything else.
+//
+// MicroBatcher combines many small concurrent requests into one predict()
+// call on a thread of its own.
+namespace serving {
+
+// Immutable snapshot of trained weights; training may go on with its own
+// copy while this one is served.
+template <typename FPType> struct Model {
+  Model(const FPType *weights, const size_t columns_count, const FPType beta)
+      : weights(weights, weights + columns_count), beta(beta),
+        rows_in_block(
+            tuning::default_block_rows(0, columns_count, sizeof(FPType))) {}
+
+  Model(const std::vector<FPType> &weights, const FPType beta)
+      : Model(weights.data(), weights.size(), beta) {}
+
+  size_t columns_count() const { return weights.size(); }
+
+  // Batches below this many values (rows x columns) run single-threaded:
+  // 256K floats take tens of microseconds on one core, less than waking up
+  // the TBB workers is worth.
+  static constexpr size_t default_parallel_values = 256 * 1024;
+
+  const aligned_vector<FPType> weights;
+  const FPType beta;
+  const size_t rows_in_block;
+  size_t parallel_values = default_parallel_values;
+};
+
+// Probabilities of rows_count rows on the calling thread. probabilities may
+// not alias rows.
+template <typename FPType>
+void score(const Model<FPType> &model, const FPType *rows,
+           const size_t rows_count, FPType *probabilities) {
+  if (rows_count == 0) {
+    return;
+  }
+  call_gemv<FPType>(CblasNoTrans, rows_count, model.columns_count(), 1.,
+                    rows, model.columns_count(), model.weights.data(), 0.,
+                    probabilities);
+  vmath::sigmoid(rows_count, probabilities, model.beta, probabilities);
+}
+
+// Probabilities of rows_count row-major rows of model.columns_count() values
+// each.
+template <typename FPType>
+void predict(const Model<FPType> &model, const FPType *rows,
+             const size_t rows_count, FPType *probabilities) {
+  const size_t columns_count = model.columns_count();
+  if (rows_count * columns_count < model.parallel_values) {
+    score(model, rows, rows_count, probabilities);
+    return;
+  }
+  const size_t rows_in_block = model.rows_in_block;
+  const size_t blocks_count =
+      rows_count / rows_in_block + !!(rows_count % rows_in_block);
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, blocks_count),
+      [&](tbb::blocked_range<size_t> r) {
+        for (size_t block_index = r.begin(); block_index < r.end();
+             ++block_index) {
+          const size_t start_row = rows_in_block * block_index;
+          const size_t rows_to_process =
+              block_index + 1 == blocks_count
+                  ? rows_count - rows_in_block * block_index
+                  : rows_in_block;
+          score(model, rows + start_row * columns_count, rows_to_process,
+                probabilities + start_row);
+        }
+      },
+      tbb::static_partitioner());
+}
+
+template <typename FPType>
+void predict(const Model<FPType> &model, const DataView<FPType> &data,
+             FPType *probabilities) {
+  predict(model, data.data, data.meta.rows_count, probabilities);
+}
+
+// Collects concurrent predict() calls into batches of up to max_rows rows.
+// A batch is scored as soon as it is full, or max_delay after its first
+// request arrived: the rows of its requests are copied into one staging
+// matrix and scored by a single predict() call, one gemv and one sigmoid
+// over the whole batch. Callers block until their rows are scored. The
+// model must outlive the batcher.
+//
+// Queue and buffers are allocated in the constructor: at most max_requests
+// requests wait at a time, further callers wait for room. Requests of more
+// than max_rows rows are not batched and run predict() on the caller.
+template <typename FPType> class MicroBatcher {
+public:
+  struct Options {
+    size_t max_rows = 1024;
+    size_t max_requests = 256;
+    std::chrono::microseconds max_delay{50};
+  };
+
+  explicit MicroBatcher(const Model<FPType> &model, Options options = {})
+      : model(model), options(options),
+        batch_rows_data(options.max_rows * model.columns_count()),
+        batch_probabilities(options.max_rows) {
+    pending.reserve(options.max_requests);
+    batch.reserve(options.max_requests);
+    worker = std::thread([this] { run(); });
+  }
+
+  // Scores the pending requests, then stops.
+  ~MicroBatcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    pending_condition.notify_one();
+    worker.join();
+  }
+
+  MicroBatcher(const MicroBatcher &) = delete;
+  MicroBatcher &operator=(const MicroBatcher &) = delete;
+
+  void predict(const FPType *rows, const size_t rows_count,
+               FPType *probabilities) {
+    if (rows_count > options.max_rows) {
+      serving::predict(model, rows, rows_count, probabilities);
+      return;
+    }
+    Request request{rows, rows_count, probabilities};
+    std::unique_lock<std::mutex> lock(mutex);
+    room_condition.wait(
+        lock, [&] { return pending.size() < options.max_requests; });
+    pending.push_back(&request);
+    pending_rows += rows_count;
+    if (pending.size() == 1 || pending_rows >= options.max_rows) {
+      pending_condition.notify_one();
+    }
+    done_condition.wait(lock, [&] { return request.done; });
+  }
+
+  // Batches scored so far.
+  size_t batches() const { return batches_count; }
+
+private:
+  struct Request {
+    const FPType *rows;
+    size_t rows_count;
+    FPType *probabilities;
+    bool done = false;
+  };
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      pending_condition.wait(lock,
+                             [&] { return stopping || !pending.empty(); });
+      if (pending.empty()) {
+        return;
+      }
+      const auto deadline = std::chrono::steady_clock::now() +
+                            options.max_delay;
+      pending_condition.wait_until(lock, deadline, [&] {
+        return stopping || pending_rows >= options.max_rows;
+      });
+
+      // Oldest requests first, as many as fit.
+      size_t batch_rows = 0;
+      batch.clear();
+      for (Request *request : pending) {
+        if (batch_rows + request->rows_count > options.max_rows) {
+          break;
+        }
+        batch.push_back(request);
+        batch_rows += request->rows_count;
+      }
+      pending.erase(pending.begin(), pending.begin() + batch.size());
+      pending_rows -= batch_rows;
+      room_condition.notify_all();
+      lock.unlock();
+
+      const size_t columns_count = model.columns_count();
+      size_t offset = 0;
+      for (const Request *request : batch) {
+        std::copy(request->rows,
+                  request->rows + request->rows_count * columns_count,
+                  batch_rows_data.data() + offset * columns_count);
+        offset += request->rows_count;
+      }
+      serving::predict(model, batch_rows_data.data(), batch_rows,
+                       batch_probabilities.data());
+      offset = 0;
+      for (const Request *request : batch) {
+        std::copy(batch_probabilities.data() + offset,
+                  batch_probabilities.data() + offset + request->rows_count,
+                  request->probabilities);
+        offset += request->rows_count;
+      }
+
+      lock.lock();
+      for (Request *request : batch) {
+        request->done = true;
+      }
+      ++batches_count;
+      done_condition.notify_all();
+    }
+  }
+
+  const Model<FPType> &model;
+  const Options options;
+  // Staging matrix of max_rows rows and the probabilities of its rows.
+  aligned_vector<FPType> batch_rows_data;
+  aligned_vector<FPType> batch_probabilities;
+  std::mutex mutex;
+  std::condition_variable pending_condition;
+  std::condition_variable room_condition;
+  std::condition_variable done_condition;
+  std::vector<Request *> pending;
+  std::vector<Request *> batch;
+  size_t pending_rows = 0;
+  std::atomic<size_t> batches_count{0};
+  bool stopping = false;
+  std::thread worker;
+};
+
+} // namespace serving
+
+#endif
@@ -0,0 +1,408 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+#include "precision.hpp"
+
+// Row-tile primitives for the fused kernels. Every function works on a tile of
+// `tile` rows that share a leading dimension, so the weights (or the gradient)
+// are loaded once per tile and the rows stay in registers/L1 between the dot
+// product and the gradient update. The generic templates are the scalar
+// fallback; float gets hand-vectorized AVX-512 / AVX2 overloads depending on
+// the instruction set the translation unit is compiled for. Compressed rows
+// (bf16, fp16, int8, see precision.hpp) are decoded to float on load.
+namespace simd {
+
+constexpr size_t tile_rows = 4;
+
+inline const char *isa_name() {
+#if defined(__AVX512F__)
+  return "AVX-512";
+#elif defined(__AVX2__) && defined(__FMA__)
+  return "AVX2";
+#else
+  return "scalar";
+#endif
+}
+
+// out[r] = dot(rows + r * ld, x) for r in [0, tile)
+template <typename Storage, typename FPType>
+inline void dot_tile(const size_t tile, const Storage *rows, const size_t ld,
+                     const FPType *x, const size_t n, FPType *out) {
+  for (size_t r = 0; r < tile; ++r) {
+    const Storage *row = rows + r * ld;
+    FPType acc = 0;
+    for (size_t index = 0; index < n; ++index) {
+      acc += precision::to_float(row[index]) * x[index];
+    }
+    out[r] = acc;
+  }
+}
+
+// y += sum_r coeffs[r] * (rows + r * ld) for r in [0, tile)
+template <typename Storage, typename FPType>
+inline void axpy_tile(const size_t tile, const Storage *rows, const size_t ld,
+                      const FPType *coeffs, const size_t n, FPType *y) {
+  for (size_t r = 0; r < tile; ++r) {
+    const Storage *row = rows + r * ld;
+    const FPType coeff = coeffs[r];
+    for (size_t index = 0; index < n; ++index) {
+      y[index] += coeff * precision::to_float(row[index]);
+    }
+  }
+}
+
+#if defined(__AVX512F__)
+
+inline void dot_tile(const size_t tile, const float *rows, const size_t ld,
+                     const float *x, const size_t n, float *out) {
+  if (tile != tile_rows) {
+    dot_tile<float>(tile, rows, ld, x, n, out);
+    return;
+  }
+  const float *r0 = rows, *r1 = rows + ld, *r2 = rows + 2 * ld,
+              *r3 = rows + 3 * ld;
+  __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(),
+         acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+  size_t index = 0;
+  for (; index + 16 <= n; index += 16) {
+    const __m512 w = _mm512_loadu_ps(x + index);
+    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(r0 + index), w, acc0);
+    acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(r1 + index), w, acc1);
+    acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(r2 + index), w, acc2);
+    acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(r3 + index), w, acc3);
+  }
+  if (index < n) {
+    const __mmask16 mask = static_cast<__mmask16>((1u << (n - index)) - 1);
+    const __m512 w = _mm512_maskz_loadu_ps(mask, x + index);
+    acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, r0 + index), w, acc0);
+    acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, r1 + index), w, acc1);
+    acc2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, r2 + index), w, acc2);
+    acc3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, r3 + index), w, acc3);
+  }
+  out[0] = _mm512_reduce_add_ps(acc0);
+  out[1] = _mm512_reduce_add_ps(acc1);
+  out[2] = _mm512_reduce_add_ps(acc2);
+  out[3] = _mm512_reduce_add_ps(acc3);
+}
+
+inline void axpy_tile(const size_t tile, const float *rows, const size_t ld,
+                      const float *coeffs, const size_t n, float *y) {
+  if (tile != tile_rows) {
+    axpy_tile<float>(tile, rows, ld, coeffs, n, y);
+    return;
+  }
+  const float *r0 = rows, *r1 = rows + ld, *r2 = rows + 2 * ld,
+              *r3 = rows + 3 * ld;
+  const __m512 c0 = _mm512_set1_ps(coeffs[0]), c1 = _mm512_set1_ps(coeffs[1]),
+               c2 = _mm512_set1_ps(coeffs[2]), c3 = _mm512_set1_ps(coeffs[3]);
+  size_t index = 0;
+  for (; index + 16 <= n; index += 16) {
+    __m512 acc = _mm512_loadu_ps(y + index);
+    acc = _mm512_fmadd_ps(c0, _mm512_loadu_ps(r0 + index), acc);
+    acc = _mm512_fmadd_ps(c1, _mm512_loadu_ps(r1 + index), acc);
+    acc = _mm512_fmadd_ps(c2, _mm512_loadu_ps(r2 + index), acc);
+    acc = _mm512_fmadd_ps(c3, _mm512_loadu_ps(r3 + index), acc);
+    _mm512_storeu_ps(y + index, acc);
+  }
+  if (index < n) {
+    const __mmask16 mask = static_cast<__mmask16>((1u << (n - index)) - 1);
+    __m512 acc = _mm512_maskz_loadu_ps(mask, y + index);
+    acc = _mm512_fmadd_ps(c0, _mm512_maskz_loadu_ps(mask, r0 + index), acc);
+    acc = _mm512_fmadd_ps(c1, _mm512_maskz_loadu_ps(mask, r1 + index), acc);
+    acc = _mm512_fmadd_ps(c2, _mm512_maskz_loadu_ps(mask, r2 + index), acc);
+    acc = _mm512_fmadd_ps(c3, _mm512_maskz_loadu_ps(mask, r3 + index), acc);
+    _mm512_mask_storeu_ps(y + index, mask, acc);
+  }
+}
+
+inline __m512 load16(const precision::bf16 *ptr) {
+  const __m256i bits =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr));
+  return _mm512_castsi512_ps(
+      _mm512_slli_epi32(_mm512_cvtepu16_epi32(bits), 16));
+}
+
+inline __m512 load16(const precision::fp16 *ptr) {
+  return _mm512_cvtph_ps(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr)));
+}
+
+inline __m512 load16(const int8_t *ptr) {
+  const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+  return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(bytes));
+}
+
+template <typename Storage>
+inline void dot_tile_decoded(const size_t tile, const Storage *rows,
+                             const size_t ld, const float *x, const size_t n,
+                             float *out) {
+  if (tile != tile_rows) {
+    dot_tile<Storage, float>(tile, rows, ld, x, n, out);
+    return;
+  }
+  const Storage *r0 = rows, *r1 = rows + ld, *r2 = rows + 2 * ld,
+                *r3 = rows + 3 * ld;
+  __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(),
+         acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+  size_t index = 0;
+  for (; index + 16 <= n; index += 16) {
+    const __m512 w = _mm512_loadu_ps(x + index);
+    acc0 = _mm512_fmadd_ps(load16(r0 + index), w, acc0);
+    acc1 = _mm512_fmadd_ps(load16(r1 + index), w, acc1);
+    acc2 = _mm512_fmadd_ps(load16(r2 + index), w, acc2);
+    acc3 = _mm512_fmadd_ps(load16(r3 + index), w, acc3);
+  }
+  float tail[tile_rows] = {0, 0, 0, 0};
+  dot_tile<Storage, float>(tile, rows + index, ld, x + index, n - index, tail);
+  out[0] = _mm512_reduce_add_ps(acc0) + tail[0];
+  out[1] = _mm512_reduce_add_ps(acc1) + tail[1];
+  out[2] = _mm512_reduce_add_ps(acc2) + tail[2];
+  out[3] = _mm512_reduce_add_ps(acc3) + tail[3];
+}
+
+template <typename Storage>
+inline void axpy_tile_decoded(const size_t tile, const Storage *rows,
+                              const size_t ld, const float *coeffs,
+                              const size_t n, float *y) {
+  if (tile != tile_rows) {
+    axpy_tile<Storage, float>(tile, rows, ld, coeffs, n, y);
+    return;
+  }
+  const Storage *r0 = rows, *r1 = rows + ld, *r2 = rows + 2 * ld,
+                *r3 = rows + 3 * ld;
+  const __m512 c0 = _mm512_set1_ps(coeffs[0]), c1 = _mm512_set1_ps(coeffs[1]),
+               c2 = _mm512_set1_ps(coeffs[2]), c3 = _mm512_set1_ps(coeffs[3]);
+  size_t index = 0;
+  for (; index + 16 <= n; index += 16) {
+    __m512 acc = _mm512_loadu_ps(y + index);
+    acc = _mm512_fmadd_ps(c0, load16(r0 + index), acc);
+    acc = _mm512_fmadd_ps(c1, load16(r1 + index), acc);
+    acc = _mm512_fmadd_ps(c2, load16(r2 + index), acc);
+    acc = _mm512_fmadd_ps(c3, load16(r3 + index), acc);
+    _mm512_storeu_ps(y + index, acc);
+  }
+  axpy_tile<Storage, float>(tile, rows + index, ld, coeffs, n - index,
+                            y + index);
+}
+
+inline void dot_tile(const size_t tile, const precision::bf16 *rows,
+                     const size_t ld, const float *x, const size_t n,
+                     float *out) {
+  dot_tile_decoded(tile, rows, ld, x, n, out);
+}
+
+inline void axpy_tile(const size_t tile, const precision::bf16 *rows,
+                      const size_t ld, const float *coeffs, const size_t n,
+                      float *y) {
+  axpy_tile_decoded(tile, rows, ld, coeffs, n, y);
+}
+
+inline void dot_tile(const size_t tile, const precision::fp16 *rows,
+                     const size_t ld, const float *x, const size_t n,
+                     float *out) {
+  dot_tile_decoded(tile, rows, ld, x, n, out);
+}
+
+inline void axpy_tile(const size_t tile, const precision::fp16 *rows,
+                      const size_t ld, const float *coeffs, const size_t n,
+                      float *y) {
+  axpy_tile_decoded(tile, rows, ld, coeffs, n, y);
+}
+
+inline void dot_tile(const size_t tile, const int8_t *rows, const size_t ld,
+                     const float *x, const size_t n, float *out) {
+  dot_tile_decoded(tile, rows, ld, x, n, out);
+}
+
+inline void axpy_tile(const size_t tile, const int8_t *rows, const size_t ld,
+                      const float *coeffs, const size_t n, float *y) {
+  axpy_tile_decoded(tile, rows, ld, coeffs, n, y);
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+inline float hsum(const __m256 value) {
+  __m128 low = _mm256_castps256_ps128(value);
+  const __m128 high = _mm256_extractf128_ps(value, 1);
+  low = _mm_add_ps(low, high);
+  low = _mm_add_ps(low, _mm_movehl_ps(low, low));
+  low = _mm_add_ss(low, _mm_movehdup_ps(low));
+  return _mm_cvtss_f32(low);
+}
+
+inline void dot_tile(const size_t tile, const float *rows, const size_t ld,
+                     const float *x, const size_t n, float *out) {
+  if (tile != tile_rows) {
+    dot_tile<float>(tile, rows, ld, x, n, out);
+    return;
+  }
+  const float *r0 = rows, *r1 = rows + ld, *r2 = rows + 2 * ld,
+              *r3 = rows + 3 * ld;
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(),
+         acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+  size_t index = 0;
+  for (; index + 8 <= n; index += 8) {
+    const __m256 w = _mm256_loadu_ps(x + index);
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + index), w, acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(r1 + index), w, acc1);
+    acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(r2 + index), w, acc2);
+    acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(r3 + index), w, acc3);
+  }
+  float tail[tile_rows] = {0, 0, 0, 0};
+  for (; index < n; ++index) {
+    tail[0] += r0[index] * x[index];
+    tail[1] += r1[index] * x[index];
+    tail[2] += r2[index] * x[index];
+    tail[3] += r3[index] * x[index];
+  }
+  out[0] = hsum(acc0) + tail[0];
+  out[1] = hsum(acc1) + tail[1];
+  out[2] = hsum(acc2) + tail[2];
+  out[3] = hsum(acc3) + tail[3];
+}
+
+inline void axpy_tile(const size_t tile, const float *rows, const size_t ld,
+                      const float *coeffs, const size_t n, float *y) {
+  if (tile != tile_rows) {
+    axpy_tile<float>(tile, rows, ld, coeffs, n, y);
+    return;
+  }
+  const float *r0 = rows, *r1 = rows + ld, *r2 = rows + 2 * ld,
+              *r3 = rows + 3 * ld;
+  const __m256 c0 = _mm256_set1_ps(coeffs[0]), c1 = _mm256_set1_ps(coeffs[1]),
+               c2 = _mm256_set1_ps(coeffs[2]), c3 = _mm256_set1_ps(coeffs[3]);
+  size_t index = 0;
+  for (; index + 8 <= n; index += 8) {
+    __m256 acc = _mm256_loadu_ps(y + index);
+    acc = _mm256_fmadd_ps(c0, _mm256_loadu_ps(r0 + index), acc);
+    acc = _mm256_fmadd_ps(c1, _mm256_loadu_ps(r1 + index), acc);
+    acc = _mm256_fmadd_ps(c2, _mm256_loadu_ps(r2 + index), acc);
+    acc = _mm256_fmadd_ps(c3, _mm256_loadu_ps(r3 + index), acc);
+    _mm256_storeu_ps(y + index, acc);
+  }
+  for (; index < n; ++index) {
+    y[index] += coeffs[0] * r0[index] + coeffs[1] * r1[index] +
+                coeffs[2] * r2[index] + coeffs[3] * r3[index];
+  }
+}
+
+
+inline __m256 load8(const precision::bf16 *ptr) {
+  const __m128i bits = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+  return _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_cvtepu16_epi32(bits), 16));
+}
+
+#if defined(__F16C__)
+inline __m256 load8(const precision::fp16 *ptr) {
+  return _mm256_cvtph_ps(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr)));
+}
+#endif
+
+inline __m256 load8(const int8_t *ptr) {
+  const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(ptr));
+  return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes));
+}
+
+template <typename Storage>
+inline void dot_tile_decoded(const size_t tile, const Storage *rows,
+                             const size_t ld, const float *x, const size_t n,
+                             float *out) {
+  if (tile != tile_rows) {
+    dot_tile<Storage, float>(tile, rows, ld, x, n, out);
+    return;
+  }
+  const Storage *r0 = rows, *r1 = rows + ld, *r2 = rows + 2 * ld,
+                *r3 = rows + 3 * ld;
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(),
+         acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+  size_t index = 0;
+  for (; index + 8 <= n; index += 8) {
+    const __m256 w = _mm256_loadu_ps(x + index);
+    acc0 = _mm256_fmadd_ps(load8(r0 + index), w, acc0);
+    acc1 = _mm256_fmadd_ps(load8(r1 + index), w, acc1);
+    acc2 = _mm256_fmadd_ps(load8(r2 + index), w, acc2);
+    acc3 = _mm256_fmadd_ps(load8(r3 + index), w, acc3);
+  }
+  float tail[tile_rows] = {0, 0, 0, 0};
+  dot_tile<Storage, float>(tile, rows + index, ld, x + index, n - index, tail);
+  out[0] = hsum(acc0) + tail[0];
+  out[1] = hsum(acc1) + tail[1];
+  out[2] = hsum(acc2) + tail[2];
+  out[3] = hsum(acc3) + tail[3];
+}
+
+template <typename Storage>
+inline void axpy_tile_decoded(const size_t tile, const Storage *rows,
+                              const size_t ld, const float *coeffs,
+                              const size_t n, float *y) {
+  if (tile != tile_rows) {
+    axpy_tile<Storage, float>(tile, rows, ld, coeffs, n, y);
+    return;
+  }
+  const Storage *r0 = rows, *r1 = rows + ld, *r2 = rows + 2 * ld,
+                *r3 = rows + 3 * ld;
+  const __m256 c0 = _mm256_set1_ps(coeffs[0]), c1 = _mm256_set1_ps(coeffs[1]),
+               c2 = _mm256_set1_ps(coeffs[2]), c3 = _mm256_set1_ps(coeffs[3]);
+  size_t index = 0;
+  for (; index + 8 <= n; index += 8) {
+    __m256 acc = _mm256_loadu_ps(y + index);
+    acc = _mm256_fmadd_ps(c0, load8(r0 + index), acc);
+    acc = _mm256_fmadd_ps(c1, load8(r1 + index), acc);
+    acc = _mm256_fmadd_ps(c2, load8(r2 + index), acc);
+    acc = _mm256_fmadd_ps(c3, load8(r3 + index), acc);
+    _mm256_storeu_ps(y + index, acc);
+  }
+  axpy_tile<Storage, float>(tile, rows + index, ld, coeffs, n - index,
+                            y + index);
+}
+
+inline void dot_tile(const size_t tile, const precision::bf16 *rows,
+                     const size_t ld, const float *x, const size_t n,
+                     float *out) {
+  dot_tile_decoded(tile, rows, ld, x, n, out);
+}
+
+inline void axpy_tile(const size_t tile, const precision::bf16 *rows,
+                      const size_t ld, const float *coeffs, const size_t n,
+                      float *y) {
+  axpy_tile_decoded(tile, rows, ld, coeffs, n, y);
+}
+
+inline void dot_tile(const size_t tile, const int8_t *rows, const size_t ld,
+                     const float *x, const size_t n, float *out) {
+  dot_tile_decoded(tile, rows, ld, x, n, out);
+}
+
+inline void axpy_tile(const size_t tile, const int8_t *rows, const size_t ld,
+                      const float *coeffs, const size_t n, float *y) {
+  axpy_tile_decoded(tile, rows, ld, coeffs, n, y);
+}
+
+#if defined(__F16C__)
+inline void dot_tile(const size_t tile, const precision::fp16 *rows,
+                     const size_t ld, const float *x, const size_t n,
+                     float *out) {
+  dot_tile_decoded(tile, rows, ld, x, n, out);
+}
+
+inline void axpy_tile(const size_t tile, const precision::fp16 *rows,
+                      const size_t ld, const float *coeffs, const size_t n,
+                      float *y) {
+  axpy_tile_decoded(tile, rows, ld, coeffs, n, y);
+}
+#endif
+
+#endif
+
+} // namespace simd
+
+#endif
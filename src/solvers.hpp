@@ -0,0 +1,647 @@
+#ifndef SOLVERS_HPP
+#define SOLVERS_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <tbb/tbb.h>
+
+#include "dispatch.hpp"
+#include "logreg_hessian.hpp"
+#include "logreg_multi.hpp"
+#include "structures.hpp"
+#include "trainer.hpp"
+#include "verbose.hpp"
+#include "vmath.hpp"
+#include "workspace.hpp"
+
+// Second-order solvers: the first-order Trainer needs hundreds of data
+// passes to converge, these need tens. Both minimize
+//
+//   mean logloss + l2 / 2 * |weights|^2   (beta is not regularized)
+//
+// over full batches, and report every iteration like Trainer's epochs, with
+// the number of data passes in TrainReport::passes.
+//
+// LBFGS: quasi-Newton direction from the last `memory` steps. Its line
+// search evaluates line_search_steps step sizes (1, 1/2, 1/4, ...) in one
+// batched pass of logreg_multi, which returns the gradients at all of them
+// too, so an accepted step costs one pass.
+//
+// NewtonCG: truncated Newton. The direction solves H p = -g with conjugate
+// gradients; every CG iteration is one Hessian-vector pass of
+// logreg_hessian.hpp on the sigmoid values of the last gradient pass. The
+// passes also leave X p per row, so the line search evaluates all its step
+// sizes on the cached logits z + step * X p without reading the data.
+namespace training {
+
+template <typename FPType> struct SolverOptions {
+  Kernel kernel = Kernel::mkl;
+  size_t max_iterations = 100;
+  // Stop when the relative change of the objective is below tolerance.
+  FPType tolerance = 1e-6;
+  // Stop when the L2 norm of the objective gradient is below this value.
+  FPType gradient_tolerance = 1e-5;
+  FPType l2 = 0;
+  // Step sizes per line search pass, at most max_line_search_steps.
+  size_t line_search_steps = 4;
+  // Sufficient decrease (Armijo) and curvature (weak Wolfe) constants.
+  FPType armijo = 1e-4;
+  FPType wolfe = 0.9;
+  // LBFGS: correction pairs kept.
+  size_t memory = 10;
+  // NewtonCG: CG iterations per Newton step.
+  size_t max_cg_iterations = 20;
+};
+
+namespace solvers_detail {
+
+constexpr size_t max_line_search_steps = 16;
+// Line search passes before giving up on a direction: the step shrinks by
+// 2^line_search_steps per pass.
+constexpr size_t max_line_search_passes = 8;
+
+// Parameters are handled as columns_count + 1 values, beta last.
+template <typename FPType>
+double dot(const std::vector<FPType> &lhs, const std::vector<FPType> &rhs) {
+  double sum = 0;
+  for (size_t index = 0; index < lhs.size(); ++index) {
+    sum += static_cast<double>(lhs[index]) * rhs[index];
+  }
+  return sum;
+}
+
+template <typename FPType>
+void axpy(const double alpha, const std::vector<FPType> &x,
+          std::vector<FPType> &y) {
+  for (size_t index = 0; index < y.size(); ++index) {
+    y[index] += alpha * x[index];
+  }
+}
+
+// Objective and its gradient from the summed loss and gradient of a pass.
+template <typename FPType>
+FPType objective(const Meta &meta, const FPType l2, const double logloss,
+                 const FPType *weights_gradient, const double beta_gradient,
+                 const size_t gradient_stride, const FPType *weights,
+                 const FPType *direction, const double step,
+                 std::vector<FPType> &gradient) {
+  const double scale = 1. / meta.rows_count;
+  double squared_norm = 0;
+  for (size_t index = 0; index < meta.columns_count; ++index) {
+    const double weight =
+        weights[index] + (direction ? step * direction[index] : 0.);
+    squared_norm += weight * weight;
+    gradient[index] =
+        scale * weights_gradient[index * gradient_stride] + l2 * weight;
+  }
+  gradient[meta.columns_count] = scale * beta_gradient;
+  return scale * logloss + 0.5 * l2 * squared_norm;
+}
+
+template <typename FPType>
+void record(TrainReport<FPType> &report, const size_t iteration,
+            const FPType loss, const std::vector<FPType> &gradient,
+            const std::chrono::steady_clock::time_point start,
+            const bool verbosity) {
+  EpochStats<FPType> stats;
+  stats.epoch = iteration;
+  stats.loss = loss;
+  stats.gradient_norm = std::sqrt(dot(gradient, gradient));
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  report.history.push_back(stats);
+  verbose_print(verbosity, "Iteration ", iteration, ": loss ", stats.loss,
+                ", gradient norm ", stats.gradient_norm, ", time (sec) ",
+                stats.seconds, ", passes ", report.passes);
+}
+
+// True when the change from previous_loss to loss ends the iterations.
+template <typename FPType>
+bool stop(TrainReport<FPType> &report, const SolverOptions<FPType> &options,
+          const FPType previous_loss, const FPType loss) {
+  const FPType gradient_norm = report.history.back().gradient_norm;
+  if (!std::isfinite(loss) || !std::isfinite(gradient_norm)) {
+    report.reason = StopReason::diverged;
+    return true;
+  }
+  if (gradient_norm < options.gradient_tolerance) {
+    report.reason = StopReason::gradient_tolerance;
+    return true;
+  }
+  if (std::abs(previous_loss - loss) <=
+      options.tolerance * std::max(std::abs(loss), FPType(1))) {
+    report.reason = StopReason::converged;
+    return true;
+  }
+  return false;
+}
+
+template <typename FPType>
+void finish(TrainReport<FPType> &report,
+            const std::chrono::steady_clock::time_point start,
+            const char *name, const bool verbosity) {
+  report.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  verbose_print(verbosity, name, " stopped (",
+                stop_reason_name(report.reason), ") after ",
+                report.history.size(), " iterations, ", report.passes,
+                " passes, time (sec) ", report.seconds);
+}
+
+} // namespace solvers_detail
+
+template <typename FPType> class LBFGS {
+public:
+  LBFGS(const Meta &meta, SolverOptions<FPType> options = {})
+      : meta(meta), options(clamp(options)),
+        steps_count(this->options.line_search_steps), workspace(meta, false),
+        candidates_workspace(meta, steps_count),
+        gradient(meta.columns_count + 1), new_gradient(meta.columns_count + 1),
+        direction(meta.columns_count + 1),
+        candidates(meta.columns_count * steps_count),
+        candidate_betas(steps_count),
+        s(this->options.memory, std::vector<FPType>(meta.columns_count + 1)),
+        y(this->options.memory, std::vector<FPType>(meta.columns_count + 1)),
+        rho(this->options.memory), alpha(this->options.memory) {}
+
+  TrainReport<FPType> fit(const FPType *data, const float *groundTruth,
+                          std::vector<FPType> &weights, FPType &beta,
+                          const bool verbosity) {
+    using namespace solvers_detail;
+    TrainReport<FPType> report;
+    report.history.reserve(options.max_iterations);
+    const auto start = std::chrono::steady_clock::now();
+    const size_t columns_count = meta.columns_count;
+    pairs_count = 0;
+    newest = 0;
+
+    forward_and_gradient<FPType>(options.kernel, meta, data, weights.data(),
+                                 groundTruth, beta, workspace, verbosity);
+    ++report.passes;
+    FPType loss = objective<FPType>(
+        meta, options.l2, workspace.forward.logloss,
+        workspace.gradient.weights_gradient.data(),
+        workspace.gradient.beta_gradient, 1, weights.data(), nullptr, 0,
+        gradient);
+
+    for (size_t iteration = 0; iteration < options.max_iterations;
+         ++iteration) {
+      if (std::sqrt(dot(gradient, gradient)) < options.gradient_tolerance) {
+        report.reason = StopReason::gradient_tolerance;
+        break;
+      }
+      double slope = two_loop();
+      if (!(slope < 0)) {
+        // Not a descent direction: restart from steepest descent.
+        pairs_count = 0;
+        two_loop();
+        slope = dot(gradient, direction);
+      }
+
+      // The first step has no curvature information: unit length.
+      double step = pairs_count ? 1. : 1. / std::sqrt(-slope);
+      size_t accepted = steps_count;
+      FPType new_loss = 0;
+      for (size_t pass = 0;
+           pass < max_line_search_passes && accepted == steps_count; ++pass) {
+        evaluate_candidates(data, groundTruth, weights, beta, step,
+                            verbosity);
+        ++report.passes;
+        accepted = choose(loss, slope, weights, step, new_loss);
+        if (accepted == steps_count) {
+          step = std::ldexp(step, -static_cast<int>(steps_count));
+        }
+      }
+      if (accepted == steps_count) {
+        // No decrease along the direction at working precision.
+        report.reason = StopReason::converged;
+        break;
+      }
+
+      const double accepted_step =
+          std::ldexp(step, -static_cast<int>(accepted));
+      std::vector<FPType> &s_new = s[newest];
+      std::vector<FPType> &y_new = y[newest];
+      for (size_t index = 0; index <= columns_count; ++index) {
+        s_new[index] = accepted_step * direction[index];
+        y_new[index] = new_gradient[index] - gradient[index];
+      }
+      const double curvature = dot(s_new, y_new);
+      if (curvature > 1e-10 * dot(y_new, y_new)) {
+        rho[newest] = 1. / curvature;
+        newest = (newest + 1) % options.memory;
+        pairs_count = std::min(pairs_count + 1, options.memory);
+      }
+      for (size_t index = 0; index < columns_count; ++index) {
+        weights[index] += accepted_step * direction[index];
+      }
+      beta += accepted_step * direction[columns_count];
+      gradient.swap(new_gradient);
+
+      const FPType previous_loss = loss;
+      loss = new_loss;
+      record(report, iteration, loss, gradient, start, verbosity);
+      if (stop(report, options, previous_loss, loss)) {
+        break;
+      }
+    }
+    finish(report, start, "L-BFGS", verbosity);
+    return report;
+  }
+
+  TrainReport<FPType> fit(const DataView<FPType> &data,
+                          const std::vector<float> &groundTruth,
+                          std::vector<FPType> &weights, FPType &beta,
+                          const bool verbosity) {
+    return fit(data.data, groundTruth.data(), weights, beta, verbosity);
+  }
+
+private:
+  static SolverOptions<FPType> clamp(SolverOptions<FPType> options) {
+    options.line_search_steps =
+        std::min(std::max<size_t>(options.line_search_steps, 1),
+                 solvers_detail::max_line_search_steps);
+    options.memory = std::max<size_t>(options.memory, 1);
+    return options;
+  }
+
+  // direction = -H gradient by the two-loop recursion over the stored
+  // pairs, newest first. Returns gradient . direction.
+  double two_loop() {
+    using solvers_detail::axpy;
+    using solvers_detail::dot;
+    for (size_t index = 0; index < direction.size(); ++index) {
+      direction[index] = -gradient[index];
+    }
+    const size_t memory = options.memory;
+    for (size_t count = 0; count < pairs_count; ++count) {
+      const size_t pair = (newest + memory - 1 - count) % memory;
+      alpha[pair] = rho[pair] * dot(s[pair], direction);
+      axpy(-alpha[pair], y[pair], direction);
+    }
+    if (pairs_count) {
+      const size_t last = (newest + memory - 1) % memory;
+      const double gamma = 1. / (rho[last] * dot(y[last], y[last]));
+      for (auto &value : direction) {
+        value *= gamma;
+      }
+    }
+    for (size_t count = pairs_count; count > 0; --count) {
+      const size_t pair = (newest + memory - count) % memory;
+      const double correction = rho[pair] * dot(y[pair], direction);
+      axpy(alpha[pair] - correction, s[pair], direction);
+    }
+    return dot(gradient, direction);
+  }
+
+  // Losses and gradients at step, step / 2, ... in one logreg_multi pass.
+  void evaluate_candidates(const FPType *data, const float *groundTruth,
+                           const std::vector<FPType> &weights,
+                           const FPType beta, const double step,
+                           const bool verbosity) {
+    const size_t columns_count = meta.columns_count;
+    for (size_t candidate = 0; candidate < steps_count; ++candidate) {
+      const double candidate_step =
+          std::ldexp(step, -static_cast<int>(candidate));
+      for (size_t index = 0; index < columns_count; ++index) {
+        candidates[index * steps_count + candidate] =
+            weights[index] + candidate_step * direction[index];
+      }
+      candidate_betas[candidate] =
+          beta + candidate_step * direction[columns_count];
+    }
+    logreg_multi::forward_and_gradient<FPType>(
+        meta, data, candidates.data(), groundTruth, 0,
+        candidate_betas.data(), candidates_workspace, verbosity);
+  }
+
+  // Largest candidate with sufficient decrease, preferring one that also
+  // meets the curvature condition; steps_count when there is none. Leaves
+  // its objective in new_loss and its gradient in new_gradient.
+  size_t choose(const FPType loss, const double slope,
+                const std::vector<FPType> &weights, const double step,
+                FPType &new_loss) {
+    const MultiResult<FPType> &result = candidates_workspace.result;
+    size_t sufficient = steps_count;
+    for (size_t candidate = 0; candidate < steps_count; ++candidate) {
+      const double candidate_step =
+          std::ldexp(step, -static_cast<int>(candidate));
+      const FPType candidate_loss = solvers_detail::objective<FPType>(
+          meta, options.l2, result.logloss[candidate],
+          result.weights_gradient.data() + candidate,
+          result.beta_gradient[candidate], steps_count, weights.data(),
+          direction.data(), candidate_step, new_gradient);
+      if (!(candidate_loss <=
+            loss + options.armijo * candidate_step * slope)) {
+        continue;
+      }
+      if (solvers_detail::dot(new_gradient, direction) >=
+          options.wolfe * slope) {
+        new_loss = candidate_loss;
+        return candidate;
+      }
+      if (sufficient == steps_count) {
+        sufficient = candidate;
+      }
+    }
+    if (sufficient != steps_count) {
+      new_loss = solvers_detail::objective<FPType>(
+          meta, options.l2, result.logloss[sufficient],
+          result.weights_gradient.data() + sufficient,
+          result.beta_gradient[sufficient], steps_count, weights.data(),
+          direction.data(), std::ldexp(step, -static_cast<int>(sufficient)),
+          new_gradient);
+    }
+    return sufficient;
+  }
+
+  const Meta meta;
+  const SolverOptions<FPType> options;
+  const size_t steps_count;
+  LogRegWorkspace<FPType> workspace;
+  MultiWorkspace<FPType> candidates_workspace;
+  std::vector<FPType> gradient, new_gradient, direction;
+  std::vector<FPType> candidates, candidate_betas;
+  // Ring of correction pairs; the newest is at newest - 1.
+  std::vector<std::vector<FPType>> s, y;
+  std::vector<double> rho, alpha;
+  size_t pairs_count = 0;
+  size_t newest = 0;
+};
+
+template <typename FPType> class NewtonCG {
+public:
+  NewtonCG(const Meta &meta, SolverOptions<FPType> options = {})
+      : meta(meta), options(clamp(options)), workspace(meta, true),
+        hessian_workspace(meta, false), logits(meta.rows_count),
+        projections(meta.rows_count), direction_projections(meta.rows_count),
+        gradient(meta.columns_count + 1), direction(meta.columns_count + 1),
+        residual(meta.columns_count + 1), conjugate(meta.columns_count + 1),
+        product(meta.columns_count + 1) {}
+
+  TrainReport<FPType> fit(const FPType *data, const float *groundTruth,
+                          std::vector<FPType> &weights, FPType &beta,
+                          const bool verbosity) {
+    using namespace solvers_detail;
+    TrainReport<FPType> report;
+    report.history.reserve(options.max_iterations);
+    const auto start = std::chrono::steady_clock::now();
+    const size_t columns_count = meta.columns_count;
+
+    logreg_hessian::compute_logits<FPType>(meta, data, weights.data(), beta,
+                                           logits.data(), hessian_workspace);
+    ++report.passes;
+    FPType loss = gradient_pass(data, groundTruth, weights, beta, verbosity);
+    ++report.passes;
+
+    for (size_t iteration = 0; iteration < options.max_iterations;
+         ++iteration) {
+      const double gradient_norm = std::sqrt(dot(gradient, gradient));
+      if (gradient_norm < options.gradient_tolerance) {
+        report.reason = StopReason::gradient_tolerance;
+        break;
+      }
+      report.passes += solve(data, gradient_norm);
+      const double slope = dot(gradient, direction);
+
+      double step = 1;
+      size_t accepted = steps_count();
+      FPType new_loss = 0;
+      for (size_t pass = 0;
+           pass < max_line_search_passes && accepted == steps_count();
+           ++pass) {
+        accepted = line_search(groundTruth, weights, loss, slope, step,
+                               new_loss);
+        if (accepted == steps_count()) {
+          step = std::ldexp(step, -static_cast<int>(steps_count()));
+        }
+      }
+      if (accepted == steps_count()) {
+        report.reason = StopReason::converged;
+        break;
+      }
+
+      step = std::ldexp(step, -static_cast<int>(accepted));
+      for (size_t index = 0; index < columns_count; ++index) {
+        weights[index] += step * direction[index];
+      }
+      beta += step * direction[columns_count];
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, meta.rows_count),
+                        [&](tbb::blocked_range<size_t> r) {
+                          for (size_t row = r.begin(); row < r.end(); ++row) {
+                            logits[row] += step * direction_projections[row];
+                          }
+                        });
+
+      const FPType previous_loss = loss;
+      loss = gradient_pass(data, groundTruth, weights, beta, verbosity);
+      ++report.passes;
+      record(report, iteration, loss, gradient, start, verbosity);
+      if (stop(report, options, previous_loss, loss)) {
+        break;
+      }
+    }
+    finish(report, start, "Newton-CG", verbosity);
+    return report;
+  }
+
+  TrainReport<FPType> fit(const DataView<FPType> &data,
+                          const std::vector<float> &groundTruth,
+                          std::vector<FPType> &weights, FPType &beta,
+                          const bool verbosity) {
+    return fit(data.data, groundTruth.data(), weights, beta, verbosity);
+  }
+
+private:
+  static SolverOptions<FPType> clamp(SolverOptions<FPType> options) {
+    options.line_search_steps =
+        std::min(std::max<size_t>(options.line_search_steps, 1),
+                 solvers_detail::max_line_search_steps);
+    options.max_cg_iterations = std::max<size_t>(options.max_cg_iterations, 1);
+    return options;
+  }
+
+  size_t steps_count() const { return options.line_search_steps; }
+
+  // Loss, gradient and materialized sigmoid at the current weights.
+  FPType gradient_pass(const FPType *data, const float *groundTruth,
+                       const std::vector<FPType> &weights, const FPType beta,
+                       const bool verbosity) {
+    forward_and_gradient<FPType>(options.kernel, meta, data, weights.data(),
+                                 groundTruth, beta, workspace, verbosity);
+    return solvers_detail::objective<FPType>(
+        meta, options.l2, workspace.forward.logloss,
+        workspace.gradient.weights_gradient.data(),
+        workspace.gradient.beta_gradient, 1, weights.data(), nullptr, 0,
+        gradient);
+  }
+
+  // Truncated CG for H direction = -gradient, with the forcing term
+  // min(0.5, sqrt(|g|)) |g| on the residual. Stops early on negative
+  // curvature. Leaves X direction per row in direction_projections and
+  // returns the passes made.
+  size_t solve(const FPType *data, const double gradient_norm) {
+    using solvers_detail::axpy;
+    using solvers_detail::dot;
+    const size_t columns_count = meta.columns_count;
+    const double scale = 1. / meta.rows_count;
+    const double forcing = std::min(0.5, std::sqrt(gradient_norm)) *
+                           gradient_norm;
+    std::fill(direction.begin(), direction.end(), FPType(0));
+    std::fill(direction_projections.begin(), direction_projections.end(),
+              FPType(0));
+    for (size_t index = 0; index <= columns_count; ++index) {
+      residual[index] = -gradient[index];
+    }
+    conjugate = residual;
+    double residual_norm = dot(residual, residual);
+
+    size_t passes = 0;
+    for (size_t cg = 0; cg < options.max_cg_iterations; ++cg) {
+      logreg_hessian::hessian_vector<FPType>(
+          meta, data, workspace.forward.sigm.data(), conjugate.data(),
+          conjugate[columns_count], projections.data(), hessian_workspace);
+      ++passes;
+      const GradientResult<FPType> &hessian = hessian_workspace.gradient;
+      for (size_t index = 0; index < columns_count; ++index) {
+        product[index] = scale * hessian.weights_gradient[index] +
+                         options.l2 * conjugate[index];
+      }
+      product[columns_count] = scale * hessian.beta_gradient;
+
+      const double curvature = dot(conjugate, product);
+      if (!(curvature > 0)) {
+        if (cg == 0) {
+          // Steepest descent; the line search picks its length.
+          direction = conjugate;
+          direction_projections = projections;
+        }
+        break;
+      }
+      const double alpha = residual_norm / curvature;
+      axpy(alpha, conjugate, direction);
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, meta.rows_count),
+                        [&](tbb::blocked_range<size_t> r) {
+                          for (size_t row = r.begin(); row < r.end(); ++row) {
+                            direction_projections[row] +=
+                                alpha * projections[row];
+                          }
+                        });
+      axpy(-alpha, product, residual);
+      const double next_norm = dot(residual, residual);
+      if (std::sqrt(next_norm) <= forcing) {
+        break;
+      }
+      for (size_t index = 0; index <= columns_count; ++index) {
+        conjugate[index] =
+            residual[index] + next_norm / residual_norm * conjugate[index];
+      }
+      residual_norm = next_norm;
+    }
+    return passes;
+  }
+
+  // Objectives at step, step / 2, ... from logits + step * X direction,
+  // without a data pass. Returns the largest step with sufficient decrease
+  // and its objective in new_loss; steps_count() when there is none.
+  size_t line_search(const float *groundTruth,
+                     const std::vector<FPType> &weights, const FPType loss,
+                     const double slope, const double step,
+                     FPType &new_loss) {
+    using Losses = std::array<double, solvers_detail::max_line_search_steps>;
+    constexpr size_t chunk = 1024;
+    const size_t count = steps_count();
+    const auto sum_rows = [&](tbb::blocked_range<size_t> r, Losses sums) {
+      FPType shifted[chunk], sigm[chunk], derivatives[chunk];
+      for (size_t first = r.begin(); first < r.end(); first += chunk) {
+        const size_t rows = std::min(chunk, r.end() - first);
+        for (size_t candidate = 0; candidate < count; ++candidate) {
+          const FPType candidate_step =
+              std::ldexp(step, -static_cast<int>(candidate));
+          for (size_t row = 0; row < rows; ++row) {
+            shifted[row] = logits[first + row] +
+                           candidate_step * direction_projections[first + row];
+          }
+          double unused = 0;
+          vmath::logistic(rows, shifted, FPType(0), groundTruth + first, sigm,
+                          derivatives, sums[candidate], unused);
+        }
+      }
+      return sums;
+    };
+    const auto join = [](Losses lhs, const Losses &rhs) {
+      for (size_t index = 0; index < lhs.size(); ++index) {
+        lhs[index] += rhs[index];
+      }
+      return lhs;
+    };
+    // The deterministic reduction splits the rows down to the grain, so the
+    // tree depends on rows_count only.
+    const tbb::blocked_range<size_t> rows(0, meta.rows_count, chunk);
+    const Losses losses =
+        workspace.deterministic()
+            ? tbb::parallel_deterministic_reduce(rows, Losses{}, sum_rows,
+                                                 join,
+                                                 tbb::simple_partitioner())
+            : tbb::parallel_reduce(rows, Losses{}, sum_rows, join);
+
+    const size_t columns_count = meta.columns_count;
+    for (size_t candidate = 0; candidate < count; ++candidate) {
+      const double candidate_step =
+          std::ldexp(step, -static_cast<int>(candidate));
+      double squared_norm = 0;
+      for (size_t index = 0; index < columns_count; ++index) {
+        const double weight =
+            weights[index] + candidate_step * direction[index];
+        squared_norm += weight * weight;
+      }
+      const FPType candidate_loss = losses[candidate] / meta.rows_count +
+                                    0.5 * options.l2 * squared_norm;
+      if (candidate_loss <= loss + options.armijo * candidate_step * slope) {
+        new_loss = candidate_loss;
+        return candidate;
+      }
+    }
+    return count;
+  }
+
+  const Meta meta;
+  const SolverOptions<FPType> options;
+  LogRegWorkspace<FPType> workspace;
+  LogRegWorkspace<FPType> hessian_workspace;
+  // Per row: X weights + beta, X conjugate of the last product and
+  // X direction.
+  std::vector<FPType> logits, projections, direction_projections;
+  std::vector<FPType> gradient, direction, residual, conjugate, product;
+};
+
+template <typename FPType>
+TrainReport<FPType> fit_lbfgs(const DataView<FPType> &data,
+                              const std::vector<float> &groundTruth,
+                              std::vector<FPType> &weights, FPType &beta,
+                              SolverOptions<FPType> options,
+                              const bool verbosity) {
+  LBFGS<FPType> solver(data.meta, options);
+  return solver.fit(data, groundTruth, weights, beta, verbosity);
+}
+
+template <typename FPType>
+TrainReport<FPType> fit_newton_cg(const DataView<FPType> &data,
+                                  const std::vector<float> &groundTruth,
+                                  std::vector<FPType> &weights, FPType &beta,
+                                  SolverOptions<FPType> options,
+                                  const bool verbosity) {
+  NewtonCG<FPType> solver(data.meta, options);
+  return solver.fit(data, groundTruth, weights, beta, verbosity);
+}
+
+} // namespace training
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef SPARSE_HPP
+#define SPARSE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <tbb/tbb.h>
+
+#include "structures.hpp"
+
+// Compressed sparse row matrix: the non-zeros of row r are
+// values[row_offsets[r] ... row_offsets[r + 1]) in the columns with the same
+// indices in `columns`. Columns are sorted inside a row.
+template <typename FPType> struct CSRView {
+  const size_t *row_offsets = nullptr; // meta.rows_count + 1 entries
+  const uint32_t *columns = nullptr;
+  const FPType *values = nullptr;
+  Meta meta{};
+
+  size_t nnz() const { return row_offsets[meta.rows_count]; }
+};
+
+template <typename FPType> struct CSRMatrix {
+  std::vector<size_t> row_offsets;
+  std::vector<uint32_t> columns;
+  std::vector<FPType> values;
+  Meta meta{};
+
+  CSRView<FPType> view() const {
+    return CSRView<FPType>{row_offsets.data(), columns.data(), values.data(),
+                           meta};
+  }
+};
+
+namespace sparse {
+
+// Keeps the non-zero values of a dense matrix; two parallel passes (count,
+// then fill after a prefix sum of the row sizes).
+template <typename FPType>
+CSRMatrix<FPType> from_dense(const DataView<FPType> &data) {
+  const size_t rows_count = data.meta.rows_count;
+  const size_t columns_count = data.meta.columns_count;
+  CSRMatrix<FPType> result;
+  result.meta = data.meta;
+  result.row_offsets.assign(rows_count + 1, 0);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, rows_count),
+                    [&](tbb::blocked_range<size_t> r) {
+                      for (size_t row = r.begin(); row < r.end(); ++row) {
+                        const FPType *row_ptr = data.row(row);
+                        result.row_offsets[row + 1] = std::count_if(
+                            row_ptr, row_ptr + columns_count,
+                            [](FPType value) { return value != 0; });
+                      }
+                    });
+  for (size_t row = 0; row < rows_count; ++row) {
+    result.row_offsets[row + 1] += result.row_offsets[row];
+  }
+  result.columns.resize(result.row_offsets[rows_count]);
+  result.values.resize(result.row_offsets[rows_count]);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, rows_count),
+                    [&](tbb::blocked_range<size_t> r) {
+                      for (size_t row = r.begin(); row < r.end(); ++row) {
+                        const FPType *row_ptr = data.row(row);
+                        size_t position = result.row_offsets[row];
+                        for (size_t col = 0; col < columns_count; ++col) {
+                          if (row_ptr[col] != 0) {
+                            result.columns[position] = col;
+                            result.values[position] = row_ptr[col];
+                            ++position;
+                          }
+                        }
+                      }
+                    });
+  return result;
+}
+
+// Row blocks with about nnz_per_block non-zeros each, so that rows of very
+// different lengths still give every task the same amount of work. Block b
+// covers rows [block_start(b), block_start(b + 1)); a row longer than
+// nnz_per_block makes the following blocks empty.
+struct BalancedBlocks {
+  BalancedBlocks(const size_t *row_offsets, size_t rows_count,
+                 size_t nnz_per_block)
+      : row_offsets(row_offsets), rows_count(rows_count),
+        nnz_per_block(std::max<size_t>(nnz_per_block, 1)),
+        blocks_count(row_offsets[rows_count] / this->nnz_per_block + 1) {}
+
+  size_t block_start(size_t block_index) const {
+    if (block_index >= blocks_count) {
+      return rows_count;
+    }
+    // First row that starts at or after the block's first non-zero.
+    return std::lower_bound(row_offsets, row_offsets + rows_count,
+                            block_index * nnz_per_block) -
+           row_offsets;
+  }
+
+  const size_t *row_offsets;
+  size_t rows_count;
+  size_t nnz_per_block;
+  size_t blocks_count;
+};
+
+} // namespace sparse
+
+#endif
@@ -0,0 +1,249 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include <tbb/tbb.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "verbose.hpp"
+
+namespace stats {
+
+struct ThreadState {
+  ThreadState() = default;
+  ThreadState(const ThreadState &) = delete;
+  ThreadState &operator=(const ThreadState &) = delete;
+  ~ThreadState() {
+#if defined(__linux__)
+    for (const int descriptor : descriptors) {
+      if (descriptor >= 0) {
+        close(descriptor);
+      }
+    }
+#endif
+  }
+
+  ThreadReport report{};
+  // perf_event_open descriptors: cycles, LLC misses. Opened on the first
+  // block of the thread.
+  bool opened = false;
+  int descriptors[2] = {-1, -1};
+  uint64_t block_start[2] = {0, 0};
+};
+
+namespace {
+
+bool from_env() {
+  return check_verbosity() || std::getenv("COMP_OPT_STATS") != nullptr;
+}
+
+std::atomic<bool> &enabled_flag() {
+  static std::atomic<bool> flag(from_env());
+  return flag;
+}
+
+bool counters_requested() {
+  static const bool requested = [] {
+    const char *value = std::getenv("COMP_OPT_PERF");
+    return value && std::strcmp(value, "1") == 0;
+  }();
+  return requested;
+}
+
+std::atomic<bool> counters_failed(false);
+
+tbb::enumerable_thread_specific<ThreadState> &states() {
+  static tbb::enumerable_thread_specific<ThreadState> instance;
+  return instance;
+}
+
+std::mutex pass_mutex;
+size_t passes = 0;
+double wall_seconds = 0;
+
+#if defined(__linux__)
+int open_counter(uint32_t type, uint64_t config) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // Calling thread, any CPU.
+  return static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+uint64_t read_counter(int descriptor) {
+  uint64_t value = 0;
+  if (descriptor < 0 ||
+      read(descriptor, &value, sizeof(value)) != sizeof(value)) {
+    return 0;
+  }
+  return value;
+}
+#endif
+
+void open_counters(ThreadState &state) {
+  state.opened = true;
+#if defined(__linux__)
+  state.descriptors[0] =
+      open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  state.descriptors[1] =
+      open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  if (state.descriptors[0] < 0 || state.descriptors[1] < 0) {
+    counters_failed = true;
+  }
+#else
+  counters_failed = true;
+#endif
+}
+
+} // namespace
+
+const char *phase_name(Phase phase) {
+  switch (phase) {
+  case Phase::gemv_n:
+    return "gemv-N";
+  case Phase::elementwise:
+    return "elementwise";
+  case Phase::gemv_t:
+    return "gemv-T";
+  case Phase::fused:
+    return "fused";
+  case Phase::reduction:
+  default:
+    return "reduction";
+  }
+}
+
+bool enabled() { return enabled_flag().load(std::memory_order_relaxed); }
+
+void enable(bool value) { enabled_flag() = value; }
+
+bool counters_enabled() { return counters_requested() && !counters_failed; }
+
+ThreadState &local() { return states().local(); }
+
+void add_phase(ThreadState &state, Phase phase, double seconds) {
+  state.report.phase_seconds[static_cast<size_t>(phase)] += seconds;
+}
+
+void begin_block(ThreadState &state) {
+  if (!counters_requested()) {
+    return;
+  }
+  if (!state.opened) {
+    open_counters(state);
+  }
+#if defined(__linux__)
+  for (int index = 0; index < 2; ++index) {
+    state.block_start[index] = read_counter(state.descriptors[index]);
+  }
+#endif
+}
+
+void end_block(ThreadState &state, size_t rows, double seconds) {
+  state.report.busy_seconds += seconds;
+  state.report.blocks += 1;
+  state.report.rows += rows;
+#if defined(__linux__)
+  if (counters_requested()) {
+    state.report.counters.cycles +=
+        read_counter(state.descriptors[0]) - state.block_start[0];
+    state.report.counters.llc_misses +=
+        read_counter(state.descriptors[1]) - state.block_start[1];
+  }
+#endif
+}
+
+void add_pass(double seconds) {
+  std::lock_guard<std::mutex> lock(pass_mutex);
+  ++passes;
+  wall_seconds += seconds;
+}
+
+Report report() {
+  Report result;
+  {
+    std::lock_guard<std::mutex> lock(pass_mutex);
+    result.passes = passes;
+    result.wall_seconds = wall_seconds;
+  }
+  double busy_sum = 0, busy_max = 0;
+  for (const ThreadState &state : states()) {
+    const ThreadReport &thread = state.report;
+    result.threads.push_back(thread);
+    for (size_t phase = 0; phase < phases_count; ++phase) {
+      result.phase_seconds[phase] += thread.phase_seconds[phase];
+    }
+    result.counters.cycles += thread.counters.cycles;
+    result.counters.llc_misses += thread.counters.llc_misses;
+    if (thread.blocks) {
+      busy_sum += thread.busy_seconds;
+      busy_max = std::max(busy_max, thread.busy_seconds);
+    }
+  }
+  size_t working_threads = 0;
+  for (const auto &thread : result.threads) {
+    working_threads += thread.blocks != 0;
+  }
+  if (busy_sum > 0) {
+    result.imbalance = busy_max / (busy_sum / working_threads);
+  }
+  result.has_counters = counters_enabled();
+  if (result.has_counters && result.wall_seconds > 0) {
+    result.llc_bandwidth_gbs =
+        result.counters.llc_misses * 64. / result.wall_seconds / 1e9;
+  }
+  return result;
+}
+
+void reset() {
+  {
+    std::lock_guard<std::mutex> lock(pass_mutex);
+    passes = 0;
+    wall_seconds = 0;
+  }
+  for (ThreadState &state : states()) {
+    state.report = ThreadReport{};
+  }
+}
+
+void print(std::ostream &out, const Report &report) {
+  out << "Stats: " << report.passes << " passes, wall (sec) "
+      << report.wall_seconds << "\n";
+  for (size_t phase = 0; phase < phases_count; ++phase) {
+    out << "  " << phase_name(static_cast<Phase>(phase))
+        << " (sec, all threads): " << report.phase_seconds[phase] << "\n";
+  }
+  size_t index = 0;
+  for (const auto &thread : report.threads) {
+    out << "  thread " << index++ << ": " << thread.blocks << " blocks, "
+        << thread.rows << " rows, busy (sec) " << thread.busy_seconds
+        << ", idle (sec) "
+        << std::max(0., report.wall_seconds - thread.busy_seconds);
+    if (report.has_counters) {
+      out << ", cycles " << thread.counters.cycles << ", LLC misses "
+          << thread.counters.llc_misses;
+    }
+    out << "\n";
+  }
+  out << "  imbalance (max / mean busy): " << report.imbalance << "\n";
+  if (report.has_counters) {
+    out << "  LLC miss bandwidth (GB/s): " << report.llc_bandwidth_gbs << "\n";
+  }
+  out.flush();
+}
+
+} // namespace stats
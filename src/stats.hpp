@@ -0,0 +1,170 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Per-phase instrumentation of the kernels, independent of VTune. Kernels
+// time their phases per row block into thread-local counters: a few
+// steady_clock reads per block, nothing when collection is off. Collection
+// is on with COMP_OPT_DEBUG or COMP_OPT_STATS set, or after enable(true).
+//
+// With COMP_OPT_PERF=1 every thread also counts its cycles and LLC misses
+// with perf_event_open (user space only). Memory bandwidth is estimated
+// from the misses as one 64-byte line each.
+namespace stats {
+
+// `fused` is the single pass of kernels that do not separate the other
+// phases (logreg_fused.hpp, logreg_sparse.hpp).
+enum class Phase { gemv_n, elementwise, gemv_t, reduction, fused };
+constexpr size_t phases_count = 5;
+
+const char *phase_name(Phase phase);
+
+bool enabled();
+void enable(bool value);
+
+// perf_event_open counters were requested and could be opened.
+bool counters_enabled();
+
+struct Counters {
+  uint64_t cycles = 0;
+  uint64_t llc_misses = 0;
+};
+
+struct ThreadReport {
+  double busy_seconds = 0; // Inside row blocks
+  size_t blocks = 0;
+  size_t rows = 0;
+  std::array<double, phases_count> phase_seconds{};
+  Counters counters{};
+};
+
+struct Report {
+  size_t passes = 0;
+  double wall_seconds = 0; // Of all passes together
+  std::array<double, phases_count> phase_seconds{};
+  std::vector<ThreadReport> threads{};
+  // Largest busy time over the mean: 1 is a perfect balance.
+  double imbalance = 0;
+  bool has_counters = false;
+  Counters counters{};
+  double llc_bandwidth_gbs = 0;
+};
+
+// Snapshot of everything collected since the last reset(). Call both
+// between passes, not while kernels run.
+Report report();
+void reset();
+
+void print(std::ostream &out, const Report &report);
+
+struct ThreadState;
+ThreadState &local();
+void add_phase(ThreadState &state, Phase phase, double seconds);
+void begin_block(ThreadState &state);
+void end_block(ThreadState &state, size_t rows, double seconds);
+void add_pass(double seconds);
+
+using Clock = std::chrono::steady_clock;
+
+// One row block of a kernel, on the thread that runs it:
+//
+//   stats::BlockTimer timer(rows_to_process);
+//   ... gemv ...
+//   timer.lap(stats::Phase::gemv_n);
+class BlockTimer {
+public:
+  explicit BlockTimer(size_t rows) : active(enabled()), rows(rows) {
+    if (active) {
+      state = &local();
+      begin_block(*state);
+      start = last = Clock::now();
+    }
+  }
+
+  ~BlockTimer() {
+    if (active) {
+      end_block(*state, rows, seconds(start, Clock::now()));
+    }
+  }
+
+  BlockTimer(const BlockTimer &) = delete;
+  BlockTimer &operator=(const BlockTimer &) = delete;
+
+  // Adds the time since the previous lap (or the start) to `phase`.
+  void lap(Phase phase) {
+    if (active) {
+      const auto now = Clock::now();
+      add_phase(*state, phase, seconds(last, now));
+      last = now;
+    }
+  }
+
+private:
+  static double seconds(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+  }
+
+  const bool active;
+  const size_t rows;
+  ThreadState *state = nullptr;
+  Clock::time_point start{}, last{};
+};
+
+// Scope of a whole phase on the calling thread, e.g. the reduction.
+class PhaseTimer {
+public:
+  explicit PhaseTimer(Phase phase) : active(enabled()), phase(phase) {
+    if (active) {
+      start = Clock::now();
+    }
+  }
+
+  ~PhaseTimer() {
+    if (active) {
+      add_phase(local(), phase,
+                std::chrono::duration<double>(Clock::now() - start).count());
+    }
+  }
+
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+  const bool active;
+  const Phase phase;
+  Clock::time_point start{};
+};
+
+// Scope of a whole pass: its wall time is the reference of the per-thread
+// busy times.
+class PassTimer {
+public:
+  PassTimer() : active(enabled()) {
+    if (active) {
+      start = Clock::now();
+    }
+  }
+
+  ~PassTimer() {
+    if (active) {
+      add_pass(std::chrono::duration<double>(Clock::now() - start).count());
+    }
+  }
+
+  PassTimer(const PassTimer &) = delete;
+  PassTimer &operator=(const PassTimer &) = delete;
+
+private:
+  const bool active;
+  Clock::time_point start{};
+};
+
+} // namespace stats
+
+#endif
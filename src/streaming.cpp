@@ -0,0 +1,199 @@
+#include "streaming.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// O_DIRECT needs offsets, sizes and buffers aligned to the logical block
+// size; the page size covers all common devices.
+constexpr size_t direct_alignment = 4096;
+
+size_t align_down(size_t value) {
+  return value / direct_alignment * direct_alignment;
+}
+
+size_t align_up(size_t value) {
+  return align_down(value + direct_alignment - 1);
+}
+
+} // namespace
+
+ChunkReader::ChunkReader(const char *filename, size_t row_bytes,
+                         size_t rows_count, const StreamOptions &options)
+    : row_bytes(row_bytes), total_rows(rows_count),
+      data_offset(options.data_offset), labels_offset(options.labels_offset) {
+  if (options.direct_io) {
+    descriptor = open(filename, O_RDONLY | O_DIRECT);
+    direct_io = descriptor >= 0;
+  }
+  if (descriptor < 0) {
+    descriptor = open(filename, O_RDONLY);
+  }
+  if (descriptor < 0 || row_bytes == 0) {
+    return;
+  }
+  posix_fadvise(descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  const size_t buffers_count = std::max<size_t>(options.buffers_count, 2);
+  // An aligned read may need one extra block at each end of the chunk, and
+  // of its labels.
+  const size_t label_bytes = has_labels() ? sizeof(float) : 0;
+  const size_t read_slack = direct_io ? 2 * direct_alignment : 0;
+  const size_t slack = (has_labels() ? 2 : 1) * read_slack;
+  const size_t per_buffer = options.memory_budget / buffers_count;
+  chunk_rows =
+      per_buffer > slack ? (per_buffer - slack) / (row_bytes + label_bytes)
+                         : 0;
+  chunk_rows =
+      std::clamp<size_t>(chunk_rows, 1, std::max<size_t>(rows_count, 1));
+  chunks_total = rows_count / chunk_rows + !!(rows_count % chunk_rows);
+  labels_start = align_up(chunk_rows * row_bytes + read_slack);
+  buffer_bytes =
+      labels_start +
+      (has_labels() ? align_up(chunk_rows * label_bytes + read_slack) : 0);
+
+  slots.resize(std::min(buffers_count, std::max<size_t>(chunks_total, 1)));
+  for (auto &slot : slots) {
+    slot.buffer =
+        static_cast<char *>(std::aligned_alloc(direct_alignment, buffer_bytes));
+    if (!slot.buffer) {
+      failed = true;
+      return;
+    }
+  }
+  reader_thread = std::thread([this] { read_loop(); });
+}
+
+ChunkReader::~ChunkReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  state_changed.notify_all();
+  if (reader_thread.joinable()) {
+    reader_thread.join();
+  }
+  for (auto &slot : slots) {
+    std::free(slot.buffer);
+  }
+  if (descriptor >= 0) {
+    close(descriptor);
+  }
+}
+
+void ChunkReader::start() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    next_to_load = 0;
+    next_to_consume = 0;
+    pass_chunks = chunks_total;
+  }
+  state_changed.notify_all();
+}
+
+bool ChunkReader::next(Chunk &chunk) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (failed || next_to_consume >= chunks_total || slots.empty()) {
+    return false;
+  }
+  Slot &slot = slots[next_to_consume % slots.size()];
+  state_changed.wait(lock, [&] {
+    return failed || (slot.state == SlotState::ready &&
+                      slot.chunk_index == next_to_consume);
+  });
+  if (failed) {
+    return false;
+  }
+  slot.state = SlotState::in_use;
+  chunk.buffer_index = next_to_consume % slots.size();
+  chunk.first_row = next_to_consume * chunk_rows;
+  chunk.rows_count = std::min(chunk_rows, total_rows - chunk.first_row);
+  chunk.data = slot.data;
+  chunk.labels = slot.labels;
+  ++next_to_consume;
+  return true;
+}
+
+void ChunkReader::release(const Chunk &chunk) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    slots[chunk.buffer_index].state = SlotState::free;
+  }
+  state_changed.notify_all();
+}
+
+void ChunkReader::read_loop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    // Chunks are loaded in order into slots in round-robin order.
+    Slot *slot = nullptr;
+    state_changed.wait(lock, [&] {
+      if (stopping) {
+        return true;
+      }
+      if (pass_chunks == 0) {
+        return false;
+      }
+      slot = &slots[next_to_load % slots.size()];
+      return slot->state == SlotState::free;
+    });
+    if (stopping) {
+      return;
+    }
+    const size_t chunk_index = next_to_load++;
+    --pass_chunks;
+    slot->state = SlotState::loading;
+
+    lock.unlock();
+    const bool ok = read_chunk(*slot, chunk_index);
+    lock.lock();
+
+    if (!ok) {
+      failed = true;
+      pass_chunks = 0;
+    }
+    slot->chunk_index = chunk_index;
+    slot->state = SlotState::ready;
+    state_changed.notify_all();
+  }
+}
+
+bool ChunkReader::read_chunk(Slot &slot, size_t chunk_index) {
+  const size_t first_row = chunk_index * chunk_rows;
+  const size_t rows = std::min(chunk_rows, total_rows - first_row);
+  slot.data = read_range(slot.buffer, data_offset + first_row * row_bytes,
+                         rows * row_bytes);
+  if (!has_labels()) {
+    return slot.data != nullptr;
+  }
+  slot.labels = reinterpret_cast<const float *>(
+      read_range(slot.buffer + labels_start,
+                 labels_offset + first_row * sizeof(float),
+                 rows * sizeof(float)));
+  return slot.data && slot.labels;
+}
+
+// Reads bytes at offset into buffer, widened to aligned blocks for O_DIRECT.
+// Returns where the requested bytes start in buffer, null on a read error.
+const char *ChunkReader::read_range(char *buffer, size_t offset,
+                                    size_t bytes) {
+  const size_t read_offset = direct_io ? align_down(offset) : offset;
+  const size_t read_bytes =
+      direct_io ? align_up(offset + bytes) - read_offset : bytes;
+  const size_t needed = offset - read_offset + bytes;
+
+  size_t done = 0;
+  while (done < needed) {
+    const ssize_t result = pread(descriptor, buffer + done,
+                                 read_bytes - done, read_offset + done);
+    if (result <= 0) {
+      return nullptr;
+    }
+    done += result;
+  }
+  return buffer + (offset - read_offset);
+}
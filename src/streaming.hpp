@@ -0,0 +1,165 @@
+#ifndef STREAMING_HPP
+#define STREAMING_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "dispatch.hpp"
+#include "structures.hpp"
+#include "verbose.hpp"
+#include "workspace.hpp"
+
+struct StreamOptions {
+  // Upper bound for all chunk buffers together, in bytes; the labels of the
+  // chunks are included when labels_offset is set.
+  size_t memory_budget = 256 * 1024 * 1024;
+  // 2 for double buffering, 3 for triple buffering.
+  size_t buffers_count = 2;
+  // Bypass the page cache with O_DIRECT. Falls back to buffered reads when
+  // the file system does not support it.
+  bool direct_io = false;
+  // Bytes before the first row (file header).
+  size_t data_offset = 0;
+  // Offset of the float32 labels, one per row (format::Header::labels_offset);
+  // 0 when the file has none, the labels then have to be in memory.
+  size_t labels_offset = 0;
+};
+
+// Reads a row-major file in chunks of whole rows on a background thread,
+// with the labels of the rows when StreamOptions::labels_offset is set.
+// While the caller computes on one chunk the next ones are read with pread
+// into the other buffers. A pass is started with start() and consumed with
+// next()/release() pairs:
+//
+//   reader.start();
+//   ChunkReader::Chunk chunk;
+//   while (reader.next(chunk)) {
+//     ... use chunk ...
+//     reader.release(chunk);
+//   }
+class ChunkReader {
+public:
+  struct Chunk {
+    const char *data = nullptr;
+    // Null unless the reader reads labels.
+    const float *labels = nullptr;
+    size_t first_row = 0;
+    size_t rows_count = 0;
+    size_t buffer_index = 0;
+  };
+
+  ChunkReader(const char *filename, size_t row_bytes, size_t rows_count,
+              const StreamOptions &options = {});
+  ~ChunkReader();
+
+  ChunkReader(const ChunkReader &) = delete;
+  ChunkReader &operator=(const ChunkReader &) = delete;
+
+  bool good() const { return descriptor >= 0 && !failed; }
+  size_t rows_per_chunk() const { return chunk_rows; }
+  size_t chunks_count() const { return chunks_total; }
+  bool direct() const { return direct_io; }
+  bool has_labels() const { return labels_offset != 0; }
+
+  // Starts a new pass over the file. The previous pass must be consumed.
+  void start();
+  // Waits for the next chunk of the pass. Returns false after the last chunk
+  // or on a read error (then good() is false).
+  bool next(Chunk &chunk);
+  // Gives the buffer of a consumed chunk back to the reading thread.
+  void release(const Chunk &chunk);
+
+private:
+  enum class SlotState { free, loading, ready, in_use };
+  struct Slot {
+    char *buffer = nullptr;
+    SlotState state = SlotState::free;
+    size_t chunk_index = 0;
+    // Start of the rows and labels inside the (O_DIRECT aligned) reads.
+    const char *data = nullptr;
+    const float *labels = nullptr;
+  };
+
+  void read_loop();
+  bool read_chunk(Slot &slot, size_t chunk_index);
+  const char *read_range(char *buffer, size_t offset, size_t bytes);
+
+  int descriptor = -1;
+  bool direct_io = false;
+  size_t row_bytes;
+  size_t total_rows;
+  size_t data_offset;
+  size_t labels_offset;
+  size_t chunk_rows = 0;
+  size_t chunks_total = 0;
+  size_t buffer_bytes = 0;
+  size_t labels_start = 0; // Of the labels inside a buffer
+
+  std::vector<Slot> slots;
+  std::mutex mutex;
+  std::condition_variable state_changed;
+  size_t next_to_load = 0;
+  size_t next_to_consume = 0;
+  size_t pass_chunks = 0; // Chunks requested by start() and not loaded yet
+  std::atomic<bool> failed{false};
+  bool stopping = false;
+  std::thread reader_thread;
+};
+
+namespace logreg_stream {
+
+// forward_and_gradient over a file that does not fit in memory. The chunks
+// of the reader are fed to the row-block loop of the selected kernel, the
+// per-thread accumulators of the workspace carry over from chunk to chunk.
+// The labels come with the chunks when the reader reads them; groundTruth
+// (all rows in memory) is used otherwise and may be null then.
+//
+// The workspace must not materialize the sigmoid values: they take a value
+// per row of the file, outside the memory budget. Returns false for such a
+// workspace and if the file could not be read completely.
+template <typename FPType>
+bool forward_and_gradient(const Kernel kernel, const Meta &meta,
+                          ChunkReader &reader, const FPType *weights,
+                          const float *groundTruth, const FPType beta_weight,
+                          LogRegWorkspace<FPType> &workspace,
+                          const bool verbosity) {
+  if (workspace.materialize_sigm) {
+    verbose_print(verbosity,
+                  "!!! Streaming needs a workspace without sigmoid values");
+    return false;
+  }
+  if (!reader.has_labels() && !groundTruth) {
+    verbose_print(verbosity, "!!! Streaming without labels");
+    return false;
+  }
+  // A chunk may run any kernel, including those that accumulate into the
+  // thread-local gradients.
+  workspace.use_thread_gradients(true);
+  workspace.reset();
+  reader.start();
+  ChunkReader::Chunk chunk;
+  while (reader.next(chunk)) {
+    Meta chunk_meta = meta;
+    chunk_meta.rows_count = chunk.rows_count;
+    const float *labels =
+        chunk.labels ? chunk.labels : groundTruth + chunk.first_row;
+    accumulate_forward_and_gradient<FPType>(
+        kernel, chunk_meta, reinterpret_cast<const FPType *>(chunk.data),
+        weights, labels, beta_weight, chunk.first_row, workspace);
+    reader.release(chunk);
+  }
+  if (!reader.good()) {
+    verbose_print(verbosity, "!!! Stream read failed");
+    return false;
+  }
+  workspace.reduce();
+  return true;
+}
+
+} // namespace logreg_stream
+
+#endif
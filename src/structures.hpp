@@ -17,10 +17,35 @@ template <typename FPType> struct GradientResult {
   FPType beta_gradient = 0;
 };
 
+// Results of K outputs (models or classes) computed in one pass. The
+// gradient is a row-major columns x K matrix: column c of output k is at
+// weights_gradient[c * K + k].
+template <typename FPType> struct MultiResult {
+  MultiResult(size_t columns_count, size_t outputs_count)
+      : logloss(outputs_count), weights_gradient(columns_count * outputs_count),
+        beta_gradient(outputs_count) {}
+
+  std::vector<FPType> logloss{};
+  std::vector<FPType> weights_gradient{};
+  std::vector<FPType> beta_gradient{};
+};
+
 struct Meta {
   size_t l2_cache_size;
   size_t columns_count;
   size_t rows_count;
 };
 
+// Non-owning row-major matrix: meta.rows_count x meta.columns_count values
+// starting at data.
+template <typename FPType> struct DataView {
+  const FPType *data = nullptr;
+  Meta meta{};
+
+  size_t size() const { return meta.rows_count * meta.columns_count; }
+  const FPType *row(size_t index) const {
+    return data + index * meta.columns_count;
+  }
+};
+
 #endif
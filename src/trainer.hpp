@@ -0,0 +1,294 @@
+#ifndef TRAINER_HPP
+#define TRAINER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "dispatch.hpp"
+#include "logreg.hpp"
+#include "optimizers.hpp"
+#include "structures.hpp"
+#include "verbose.hpp"
+
+namespace training {
+
+enum class StopReason {
+  max_epochs,
+  converged,
+  gradient_tolerance,
+  early_stopping,
+  diverged
+};
+
+inline const char *stop_reason_name(const StopReason reason) {
+  switch (reason) {
+  case StopReason::converged:
+    return "converged";
+  case StopReason::gradient_tolerance:
+    return "gradient tolerance";
+  case StopReason::early_stopping:
+    return "early stopping";
+  case StopReason::diverged:
+    return "diverged";
+  case StopReason::max_epochs:
+  default:
+    return "max epochs";
+  }
+}
+
+template <typename FPType> struct TrainOptions {
+  Kernel kernel = Kernel::mkl;
+  size_t max_epochs = 100;
+  // Rows per mini-batch, 0 means full-batch training (one pass per epoch).
+  size_t batch_rows = 0;
+  // Mini-batch order is shuffled every epoch with this seed.
+  unsigned seed = 0;
+  // Stop when the relative change of the mean logloss is below tolerance.
+  FPType tolerance = 1e-6;
+  // Stop when the L2 norm of the mean gradient is below this value.
+  FPType gradient_tolerance = 0;
+  // Stop when the loss did not improve by min_delta for `patience` epochs,
+  // 0 disables early stopping. The validation loss is watched when there
+  // is a validation split, the training loss otherwise.
+  size_t patience = 0;
+  FPType min_delta = 0;
+  // Held-out rows (row-major, meta.columns_count values each), scored after
+  // every epoch by one forward pass that also collects their quality.
+  const FPType *validation_data = nullptr;
+  const float *validation_labels = nullptr;
+  size_t validation_rows = 0;
+};
+
+template <typename FPType> struct EpochStats {
+  size_t epoch = 0;
+  FPType loss = 0;          // Mean logloss over the epoch
+  FPType gradient_norm = 0; // L2 norm of the mean gradient over the epoch
+  double seconds = 0;
+  // Of the validation split at the end of the epoch, 0 without one.
+  FPType validation_loss = 0;
+  double validation_accuracy = 0;
+  double validation_precision = 0;
+  double validation_recall = 0;
+  double validation_auc = 0;
+};
+
+template <typename FPType> struct TrainReport {
+  std::vector<EpochStats<FPType>> history{};
+  StopReason reason = StopReason::max_epochs;
+  double seconds = 0;
+  // Reads of the whole data: one per epoch here, see solvers.hpp for
+  // solvers with several passes per iteration.
+  size_t passes = 0;
+};
+
+// Outer loop over forward_and_gradient. The workspace (without materialized
+// sigmoid values) and optimizer state are allocated once, so an epoch costs
+// one data pass (full-batch) and no allocations. The optimizer updates every
+// column inside the parallel gradient reduction of the pass. The validation split costs
+// one forward pass per epoch, its metrics are accumulated inside it
+// (LogRegWorkspace::track_quality).
+template <typename FPType, typename Optimizer> class Trainer {
+public:
+  Trainer(const Meta &meta, Optimizer optimizer,
+          TrainOptions<FPType> options = {})
+      : meta(meta), optimizer(std::move(optimizer)), options(options),
+        batch_rows(options.batch_rows == 0
+                       ? meta.rows_count
+                       : std::min(options.batch_rows, meta.rows_count)),
+        workspace(batch_meta(meta, batch_rows), false),
+        validation_workspace(batch_meta(meta, options.validation_rows),
+                             false),
+        epoch_gradient(meta.columns_count),
+        batch_order(meta.rows_count / batch_rows +
+                    !!(meta.rows_count % batch_rows)) {
+    std::iota(batch_order.begin(), batch_order.end(), 0);
+    validation_workspace.track_quality = true;
+  }
+
+  TrainReport<FPType> fit(const FPType *data, const float *groundTruth,
+                          std::vector<FPType> &weights, FPType &beta,
+                          const bool verbosity) {
+    TrainReport<FPType> report;
+    report.history.reserve(options.max_epochs);
+    optimizer.reset(meta.columns_count);
+    std::mt19937 generator(options.seed);
+
+    FPType previous_loss = std::numeric_limits<FPType>::max();
+    FPType best_loss = std::numeric_limits<FPType>::max();
+    size_t epochs_without_improvement = 0;
+    const auto train_start = std::chrono::steady_clock::now();
+
+    for (size_t epoch = 0; epoch < options.max_epochs; ++epoch) {
+      const auto epoch_start = std::chrono::steady_clock::now();
+      const FPType loss = run_epoch(data, groundTruth, weights, beta,
+                                    generator, verbosity);
+      FPType squared_norm = epoch_beta_gradient * epoch_beta_gradient;
+      for (const auto value : epoch_gradient) {
+        squared_norm += value * value;
+      }
+      const auto epoch_finish = std::chrono::steady_clock::now();
+
+      EpochStats<FPType> stats;
+      stats.epoch = epoch;
+      stats.loss = loss;
+      stats.gradient_norm = std::sqrt(squared_norm);
+      stats.seconds =
+          std::chrono::duration<double>(epoch_finish - epoch_start).count();
+      if (validate()) {
+        validate(weights, beta, stats, verbosity);
+      }
+      report.history.push_back(stats);
+      verbose_print(verbosity, "Epoch ", epoch, ": loss ", stats.loss,
+                    ", gradient norm ", stats.gradient_norm, ", time (sec) ",
+                    stats.seconds);
+      if (validate()) {
+        verbose_print(verbosity, "  validation: ",
+                      validation_workspace.quality);
+      }
+
+      if (!std::isfinite(loss) || !std::isfinite(stats.gradient_norm)) {
+        report.reason = StopReason::diverged;
+        break;
+      }
+      if (stats.gradient_norm < options.gradient_tolerance) {
+        report.reason = StopReason::gradient_tolerance;
+        break;
+      }
+      if (std::abs(previous_loss - loss) <=
+          options.tolerance * std::max(std::abs(loss), FPType(1))) {
+        report.reason = StopReason::converged;
+        break;
+      }
+      previous_loss = loss;
+      const FPType watched = validate() ? stats.validation_loss : loss;
+      if (watched < best_loss - options.min_delta) {
+        best_loss = watched;
+        epochs_without_improvement = 0;
+      } else if (options.patience &&
+                 ++epochs_without_improvement >= options.patience) {
+        report.reason = StopReason::early_stopping;
+        break;
+      }
+    }
+
+    report.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - train_start)
+                         .count();
+    report.passes = report.history.size();
+    verbose_print(verbosity, "Training stopped (",
+                  stop_reason_name(report.reason), ") after ",
+                  report.history.size(), " epochs, time (sec) ",
+                  report.seconds);
+    return report;
+  }
+
+  TrainReport<FPType> fit(const std::vector<FPType> &data,
+                          const std::vector<float> &groundTruth,
+                          std::vector<FPType> &weights, FPType &beta,
+                          const bool verbosity) {
+    return fit(data.data(), groundTruth.data(), weights, beta, verbosity);
+  }
+
+  TrainReport<FPType> fit(const DataView<FPType> &data,
+                          const std::vector<float> &groundTruth,
+                          std::vector<FPType> &weights, FPType &beta,
+                          const bool verbosity) {
+    return fit(data.data, groundTruth.data(), weights, beta, verbosity);
+  }
+
+private:
+  bool validate() const {
+    return options.validation_data && options.validation_labels &&
+           options.validation_rows;
+  }
+
+  // Loss and quality of the validation split at the current weights.
+  void validate(const std::vector<FPType> &weights, const FPType beta,
+                EpochStats<FPType> &stats, const bool verbosity) {
+    logreg_opt::forward<FPType>(
+        batch_meta(meta, options.validation_rows), options.validation_data,
+        weights.data(), options.validation_labels, beta,
+        validation_workspace, verbosity);
+    const metrics::Quality &quality = validation_workspace.quality;
+    stats.validation_loss = quality.mean_logloss();
+    stats.validation_accuracy = quality.accuracy();
+    stats.validation_precision = quality.precision();
+    stats.validation_recall = quality.recall();
+    stats.validation_auc = quality.auc();
+  }
+
+  static Meta batch_meta(const Meta &meta, const size_t rows_count) {
+    Meta result = meta;
+    result.rows_count = rows_count;
+    return result;
+  }
+
+  // Returns the mean logloss of the epoch, leaves the mean gradient of the
+  // epoch in epoch_gradient/epoch_beta_gradient.
+  FPType run_epoch(const FPType *data, const float *groundTruth,
+                   std::vector<FPType> &weights, FPType &beta,
+                   std::mt19937 &generator, const bool verbosity) {
+    std::fill(epoch_gradient.begin(), epoch_gradient.end(), FPType(0));
+    epoch_beta_gradient = 0;
+    if (batch_order.size() > 1) {
+      std::shuffle(batch_order.begin(), batch_order.end(), generator);
+    }
+
+    FPType loss = 0;
+    for (const size_t batch_index : batch_order) {
+      const size_t start_row = batch_index * batch_rows;
+      const size_t rows_to_process =
+          std::min(batch_rows, meta.rows_count - start_row);
+      // The step runs inside the column loop of the gradient reduction.
+      optimizer.begin_step(FPType(1) / rows_to_process);
+      forward_and_gradient<FPType>(
+          options.kernel, batch_meta(meta, rows_to_process),
+          data + start_row * meta.columns_count, weights.data(),
+          groundTruth + start_row, beta, workspace, verbosity,
+          [&](const size_t index, const FPType value) {
+            epoch_gradient[index] += value;
+            optimizer.update(index, weights[index], value);
+          });
+      const FPType beta_gradient = workspace.gradient.beta_gradient;
+      epoch_beta_gradient += beta_gradient;
+      loss += workspace.forward.logloss;
+      optimizer.update_beta(beta, beta_gradient);
+    }
+
+    const FPType scale = FPType(1) / meta.rows_count;
+    for (auto &value : epoch_gradient) {
+      value *= scale;
+    }
+    epoch_beta_gradient *= scale;
+    return loss * scale;
+  }
+
+  Meta meta;
+  Optimizer optimizer;
+  TrainOptions<FPType> options;
+  size_t batch_rows;
+  LogRegWorkspace<FPType> workspace;
+  LogRegWorkspace<FPType> validation_workspace;
+  std::vector<FPType> epoch_gradient;
+  FPType epoch_beta_gradient = 0;
+  std::vector<size_t> batch_order;
+};
+
+template <typename FPType, typename Optimizer>
+TrainReport<FPType>
+train(const Meta &meta, const std::vector<FPType> &data,
+      const std::vector<float> &groundTruth, std::vector<FPType> &weights,
+      FPType &beta, Optimizer optimizer, TrainOptions<FPType> options,
+      const bool verbosity) {
+  Trainer<FPType, Optimizer> trainer(meta, std::move(optimizer), options);
+  return trainer.fit(data, groundTruth, weights, beta, verbosity);
+}
+
+} // namespace training
+
+#endif
@@ -0,0 +1,197 @@
+#include "tuning.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace tuning {
+
+namespace {
+
+// Parses sysfs sizes like "48K", "2048K" or "32M".
+size_t parse_size(const std::string &text) {
+  char *end = nullptr;
+  size_t value = std::strtoull(text.c_str(), &end, 10);
+  if (end && (*end == 'K' || *end == 'k')) {
+    value *= 1024;
+  } else if (end && (*end == 'M' || *end == 'm')) {
+    value *= 1024 * 1024;
+  }
+  return value;
+}
+
+bool read_line(const std::string &path, std::string &line) {
+  std::ifstream file(path);
+  return static_cast<bool>(std::getline(file, line));
+}
+
+void set_level(CacheInfo &info, int level, size_t size) {
+  switch (level) {
+  case 1:
+    info.l1d = size;
+    break;
+  case 2:
+    info.l2 = size;
+    break;
+  case 3:
+    info.l3 = size;
+    break;
+  default:
+    break;
+  }
+}
+
+bool detect_sysfs(CacheInfo &info) {
+  const std::string base = "/sys/devices/system/cpu/cpu0/cache/index";
+  bool found = false;
+  for (int index = 0; index < 16; ++index) {
+    const std::string dir = base + std::to_string(index) + "/";
+    std::string level, type, size;
+    if (!read_line(dir + "level", level) || !read_line(dir + "type", type) ||
+        !read_line(dir + "size", size)) {
+      break;
+    }
+    if (type == "Instruction") {
+      continue;
+    }
+    set_level(info, std::atoi(level.c_str()), parse_size(size));
+    found = true;
+  }
+  return found;
+}
+
+bool detect_cpuid(CacheInfo &info) {
+#if defined(__x86_64__) || defined(__i386__)
+  bool found = false;
+  for (unsigned subleaf = 0; subleaf < 16; ++subleaf) {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(4, subleaf, &eax, &ebx, &ecx, &edx)) {
+      break;
+    }
+    const unsigned type = eax & 0x1F; // 0: no more caches, 2: instruction
+    if (type == 0) {
+      break;
+    }
+    if (type == 2) {
+      continue;
+    }
+    const size_t ways = ((ebx >> 22) & 0x3FF) + 1;
+    const size_t partitions = ((ebx >> 12) & 0x3FF) + 1;
+    const size_t line = (ebx & 0xFFF) + 1;
+    const size_t sets = static_cast<size_t>(ecx) + 1;
+    set_level(info, (eax >> 5) & 0x7, ways * partitions * line * sets);
+    found = true;
+  }
+  return found;
+#else
+  return false;
+#endif
+}
+
+CacheInfo detect() {
+  CacheInfo info;
+  if (!detect_sysfs(info)) {
+    detect_cpuid(info);
+  }
+  if (info.l1d == 0) {
+    info.l1d = 32 * 1024;
+  }
+  if (info.l2 == 0) {
+    info.l2 = std::max<size_t>(info.l1d, 1024 * 1024);
+  }
+  if (info.l3 == 0) {
+    info.l3 = info.l2;
+  }
+  return info;
+}
+
+struct KeyLess {
+  bool operator()(const Key &lhs, const Key &rhs) const {
+    return std::tie(lhs.rows_count, lhs.columns_count, lhs.element_size,
+                    lhs.kernel, lhs.threads) <
+           std::tie(rhs.rows_count, rhs.columns_count, rhs.element_size,
+                    rhs.kernel, rhs.threads);
+  }
+};
+
+std::mutex cache_mutex;
+std::map<Key, Config, KeyLess> &tuned_configs() {
+  static std::map<Key, Config, KeyLess> configs;
+  return configs;
+}
+
+} // namespace
+
+const CacheInfo &cache_info() {
+  static const CacheInfo info = detect();
+  return info;
+}
+
+size_t block_rows(size_t cache_bytes, size_t columns_count,
+                  size_t element_size, double fraction) {
+  const size_t row_bytes = std::max<size_t>(columns_count * element_size, 1);
+  return std::max<size_t>(1, cache_bytes * fraction / row_bytes);
+}
+
+size_t default_block_rows(size_t l2_cache_size, size_t columns_count,
+                          size_t element_size) {
+  return block_rows(l2_cache_size ? l2_cache_size : cache_info().l2,
+                    columns_count, element_size);
+}
+
+const char *partitioner_name(Partitioner partitioner) {
+  switch (partitioner) {
+  case Partitioner::affinity:
+    return "affinity";
+  case Partitioner::automatic:
+    return "auto";
+  case Partitioner::static_partitioner:
+  default:
+    return "static";
+  }
+}
+
+std::vector<size_t> candidate_block_rows(size_t l2_cache_size,
+                                         size_t columns_count,
+                                         size_t element_size) {
+  const size_t l2 = l2_cache_size ? l2_cache_size : cache_info().l2;
+  std::vector<size_t> candidates;
+  for (const double fraction : {0.25, 0.5, 0.8, 1.6}) {
+    const size_t rows = block_rows(l2, columns_count, element_size, fraction);
+    if (candidates.empty() || candidates.back() != rows) {
+      candidates.push_back(rows);
+    }
+  }
+  return candidates;
+}
+
+bool find(const Key &key, Config &config) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  const auto found = tuned_configs().find(key);
+  if (found == tuned_configs().end()) {
+    return false;
+  }
+  config = found->second;
+  return true;
+}
+
+void store(const Key &key, const Config &config) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  tuned_configs()[key] = config;
+}
+
+bool enabled() {
+  const char *value = std::getenv("COMP_OPT_AUTOTUNE");
+  return !(value && std::strcmp(value, "0") == 0);
+}
+
+} // namespace tuning
@@ -0,0 +1,84 @@
+#ifndef TUNING_HPP
+#define TUNING_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <tbb/tbb.h>
+
+// Cache sizes of the machine and block-size / partitioner tuning for the
+// row-block kernels.
+namespace tuning {
+
+struct CacheInfo {
+  size_t l1d = 0; // Per core
+  size_t l2 = 0;  // Per core
+  size_t l3 = 0;  // Shared
+};
+
+// Detected once from sysfs, then cpuid leaf 4; conservative defaults when
+// both are unavailable.
+const CacheInfo &cache_info();
+
+// Rows of columns_count elements that fit in `fraction` of cache_bytes.
+// Never 0: rows wider than the cache are processed one per block.
+size_t block_rows(size_t cache_bytes, size_t columns_count,
+                  size_t element_size, double fraction = 0.8);
+
+// Default block size: 80% of L2 (Meta::l2_cache_size when it is not 0).
+size_t default_block_rows(size_t l2_cache_size, size_t columns_count,
+                          size_t element_size);
+
+enum class Partitioner { static_partitioner, affinity, automatic };
+
+const char *partitioner_name(Partitioner partitioner);
+
+struct Config {
+  size_t rows_in_block = 1;
+  Partitioner partitioner = Partitioner::static_partitioner;
+};
+
+// Shapes that get the same tuned configuration.
+struct Key {
+  size_t rows_count;
+  size_t columns_count;
+  size_t element_size;
+  int kernel;
+  int threads;
+};
+
+// Block sizes around the L2 default worth measuring, smallest first.
+std::vector<size_t> candidate_block_rows(size_t l2_cache_size,
+                                         size_t columns_count,
+                                         size_t element_size);
+
+// Process-wide cache of tuned configurations, safe to use from any thread.
+bool find(const Key &key, Config &config);
+void store(const Key &key, const Config &config);
+
+// Autotuning is on unless COMP_OPT_AUTOTUNE=0.
+bool enabled();
+
+// Runs body over range with the selected partitioner. affinity must outlive
+// the call and be reused between passes to have an effect.
+template <typename Range, typename Body>
+void parallel_for(const Range &range, const Body &body,
+                  const Partitioner partitioner,
+                  tbb::affinity_partitioner &affinity) {
+  switch (partitioner) {
+  case Partitioner::affinity:
+    tbb::parallel_for(range, body, affinity);
+    break;
+  case Partitioner::automatic:
+    tbb::parallel_for(range, body, tbb::auto_partitioner());
+    break;
+  case Partitioner::static_partitioner:
+  default:
+    tbb::parallel_for(range, body, tbb::static_partitioner());
+    break;
+  }
+}
+
+} // namespace tuning
+
+#endif
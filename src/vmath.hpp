@@ -0,0 +1,432 @@
+#ifndef VMATH_HPP
+#define VMATH_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+// Elementwise stage of the binary kernels: sigmoid, logloss and derivative of
+// a run of rows from their logits. Per row, with z = logit + beta and
+// t = exp(-|z|):
+//
+//   sigm       = z >= 0 ? 1 / (1 + t) : t / (1 + t)
+//   loss       = softplus(z) - gt * z = max(z, 0) + log1p(t) - gt * z
+//   derivative = sigm - gt
+//
+// One exp, one log and one division per row, no overflow for any z and no
+// eps: the loss is exact where log(sigm + eps) saturates. The derivative is
+// the closed form of sigm * (1 - sigm) * (-gt / sigm + (1 - gt) / (1 - sigm))
+// that logreg_noopt keeps as the reference.
+//
+// double uses std::exp / std::log1p. float uses the polynomials below in
+// AVX-512 / AVX2 registers (and in scalar code for the tail), with errors
+// measured over all floats of the range:
+//   exp:   relative error below 1e-7 on [-87.3, 88], arguments outside
+//          are clamped;
+//   log1p: absolute error below 7e-8 on [0, 1], the range of t;
+//   sigm:  relative error below 2e-7.
+namespace vmath {
+
+// Cephes expf / logf coefficients.
+constexpr float exp_hi = 88.0f;
+constexpr float exp_lo = -87.3365478515625f;
+constexpr float log2e = 1.44269504088896341f;
+constexpr float ln2_hi = 0.693359375f;
+constexpr float ln2_lo = -2.12194440e-4f;
+constexpr float exp_p0 = 1.9875691500e-4f;
+constexpr float exp_p1 = 1.3981999507e-3f;
+constexpr float exp_p2 = 8.3334519073e-3f;
+constexpr float exp_p3 = 4.1665795894e-2f;
+constexpr float exp_p4 = 1.6666665459e-1f;
+constexpr float exp_p5 = 5.0000001201e-1f;
+constexpr float sqrt_half = 0.707106781186547524f;
+constexpr float log_p0 = 7.0376836292e-2f;
+constexpr float log_p1 = -1.1514610310e-1f;
+constexpr float log_p2 = 1.1676998740e-1f;
+constexpr float log_p3 = -1.2420140846e-1f;
+constexpr float log_p4 = 1.4249322787e-1f;
+constexpr float log_p5 = -1.6668057665e-1f;
+constexpr float log_p6 = 2.0000714765e-1f;
+constexpr float log_p7 = -2.4999993993e-1f;
+constexpr float log_p8 = 3.3333331174e-1f;
+
+// exp(x) = 2^n * exp(r), |r| <= ln2 / 2.
+inline float exp(float x) {
+  x = std::fmin(std::fmax(x, exp_lo), exp_hi);
+  const float n = std::nearbyint(x * log2e);
+  float r = x - n * ln2_hi;
+  r = r - n * ln2_lo;
+  float p = exp_p0;
+  p = p * r + exp_p1;
+  p = p * r + exp_p2;
+  p = p * r + exp_p3;
+  p = p * r + exp_p4;
+  p = p * r + exp_p5;
+  const float y = p * r * r + r + 1;
+  const int32_t bits = (static_cast<int32_t>(n) + 127) << 23;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return y * scale;
+}
+
+// log(x) for normal x > 0: x = 2^e * m, sqrt(1/2) <= m < sqrt(2).
+inline float log(const float x) {
+  int32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  float e = static_cast<float>((bits >> 23) - 126);
+  bits = (bits & 0x007FFFFF) | 0x3F000000; // m in [0.5, 1)
+  float m;
+  std::memcpy(&m, &bits, sizeof(m));
+  if (m < sqrt_half) {
+    e -= 1;
+    m = m + m - 1;
+  } else {
+    m = m - 1;
+  }
+  const float z = m * m;
+  float p = log_p0;
+  p = p * m + log_p1;
+  p = p * m + log_p2;
+  p = p * m + log_p3;
+  p = p * m + log_p4;
+  p = p * m + log_p5;
+  p = p * m + log_p6;
+  p = p * m + log_p7;
+  p = p * m + log_p8;
+  float y = p * m * z + e * ln2_lo - 0.5f * z;
+  return m + y + e * ln2_hi;
+}
+
+template <typename FPType>
+inline void logistic_row(const FPType z, const float gt, FPType &sigm,
+                         FPType &derivative, double &loss) {
+  const FPType t = std::exp(-std::abs(z));
+  const FPType inverse = 1 / (1 + t);
+  sigm = z >= 0 ? inverse : t * inverse;
+  derivative = sigm - gt;
+  loss += std::fmax(z, FPType(0)) + std::log1p(t) - gt * z;
+}
+
+// float: log1p(t) = log(u) + (t - (u - 1)) / u with u = 1 + t, the
+// correction restores the bits of t that 1 + t rounds away.
+inline void logistic_row(const float z, const float gt, float &sigm,
+                         float &derivative, double &loss) {
+  const float t = vmath::exp(-std::abs(z));
+  const float u = 1 + t;
+  const float inverse = 1 / u;
+  sigm = z >= 0 ? inverse : t * inverse;
+  derivative = sigm - gt;
+  const float log1p = vmath::log(u) + (t - (u - 1)) * inverse;
+  loss += std::fmax(z, 0.f) + log1p - gt * z;
+}
+
+template <typename FPType> inline FPType sigmoid_row(const FPType z) {
+  const FPType t = std::exp(-std::abs(z));
+  const FPType inverse = 1 / (1 + t);
+  return z >= 0 ? inverse : t * inverse;
+}
+
+inline float sigmoid_row(const float z) {
+  const float t = vmath::exp(-std::abs(z));
+  const float inverse = 1 / (1 + t);
+  return z >= 0 ? inverse : t * inverse;
+}
+
+// Rows [0, n): z = logits[i] + beta. Writes sigm and derivatives (either
+// may alias logits), adds the losses to loss and the derivatives to
+// beta_gradient. Call it without template arguments, so float picks the
+// vectorized overload.
+template <typename FPType>
+inline void logistic(const size_t n, const FPType *logits, const FPType beta,
+                     const float *gt, FPType *sigm, FPType *derivatives,
+                     double &loss, double &beta_gradient) {
+  for (size_t index = 0; index < n; ++index) {
+    logistic_row(logits[index] + beta, gt[index], sigm[index],
+                 derivatives[index], loss);
+    beta_gradient += derivatives[index];
+  }
+}
+
+// Rows [0, n): sigm[i] = sigmoid(logits[i] + beta), sigm may alias logits.
+// The sigmoid of logistic() without labels, for inference.
+template <typename FPType>
+inline void sigmoid(const size_t n, const FPType *logits, const FPType beta,
+                    FPType *sigm) {
+  for (size_t index = 0; index < n; ++index) {
+    sigm[index] = sigmoid_row(logits[index] + beta);
+  }
+}
+
+// values[i] = exp(values[i]) for i in [0, n), e.g. over a block of softmax
+// logits. Call it without template arguments, so float picks the vectorized
+// overload.
+template <typename FPType> inline void exp(const size_t n, FPType *values) {
+  for (size_t index = 0; index < n; ++index) {
+    values[index] = std::exp(values[index]);
+  }
+}
+
+#if defined(__AVX512F__)
+
+inline __m512 exp(__m512 x) {
+  x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(exp_lo)),
+                    _mm512_set1_ps(exp_hi));
+  const __m512 n = _mm512_roundscale_ps(
+      _mm512_mul_ps(x, _mm512_set1_ps(log2e)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ln2_hi), x);
+  r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ln2_lo), r);
+  __m512 p = _mm512_set1_ps(exp_p0);
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p1));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p2));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p3));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p4));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p5));
+  const __m512 y = _mm512_add_ps(
+      _mm512_fmadd_ps(_mm512_mul_ps(p, r), r, r), _mm512_set1_ps(1));
+  return _mm512_scalef_ps(y, n);
+}
+
+inline __m512 log(const __m512 x) {
+  const __m512i bits = _mm512_castps_si512(x);
+  __m512 e = _mm512_cvtepi32_ps(_mm512_sub_epi32(
+      _mm512_srli_epi32(bits, 23), _mm512_set1_epi32(126)));
+  __m512 m = _mm512_castsi512_ps(
+      _mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007FFFFF)),
+                      _mm512_set1_epi32(0x3F000000)));
+  const __mmask16 small = _mm512_cmp_ps_mask(
+      m, _mm512_set1_ps(sqrt_half), _CMP_LT_OQ);
+  e = _mm512_mask_sub_ps(e, small, e, _mm512_set1_ps(1));
+  m = _mm512_mask_add_ps(m, small, m, m);
+  m = _mm512_sub_ps(m, _mm512_set1_ps(1));
+  const __m512 z = _mm512_mul_ps(m, m);
+  __m512 p = _mm512_set1_ps(log_p0);
+  p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(log_p1));
+  p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(log_p2));
+  p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(log_p3));
+  p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(log_p4));
+  p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(log_p5));
+  p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(log_p6));
+  p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(log_p7));
+  p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(log_p8));
+  __m512 y = _mm512_mul_ps(_mm512_mul_ps(p, m), z);
+  y = _mm512_fmadd_ps(e, _mm512_set1_ps(ln2_lo), y);
+  y = _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), z, y);
+  return _mm512_fmadd_ps(e, _mm512_set1_ps(ln2_hi), _mm512_add_ps(m, y));
+}
+
+inline __m512d sum_halves(const __m512 value) {
+  const __m256 low = _mm512_castps512_ps256(value);
+  const __m256 high = _mm256_castpd_ps(
+      _mm512_extractf64x4_pd(_mm512_castps_pd(value), 1));
+  return _mm512_add_pd(_mm512_cvtps_pd(low), _mm512_cvtps_pd(high));
+}
+
+inline void logistic(const size_t n, const float *logits, const float beta,
+                     const float *gt, float *sigm, float *derivatives,
+                     double &loss, double &beta_gradient) {
+  const __m512 beta_value = _mm512_set1_ps(beta);
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512 one = _mm512_set1_ps(1);
+  const __m512 abs_mask = _mm512_castsi512_ps(_mm512_set1_epi32(0x7FFFFFFF));
+  __m512d loss_acc = _mm512_setzero_pd();
+  __m512d beta_acc = _mm512_setzero_pd();
+  size_t index = 0;
+  for (; index + 16 <= n; index += 16) {
+    const __m512 z = _mm512_add_ps(_mm512_loadu_ps(logits + index), beta_value);
+    const __m512 labels = _mm512_loadu_ps(gt + index);
+    const __m512 t = exp(_mm512_sub_ps(zero, _mm512_and_ps(z, abs_mask)));
+    const __m512 u = _mm512_add_ps(one, t);
+    const __m512 inverse = _mm512_div_ps(one, u);
+    const __mmask16 negative = _mm512_cmp_ps_mask(z, zero, _CMP_LT_OQ);
+    const __m512 value =
+        _mm512_mask_mul_ps(inverse, negative, t, inverse);
+    const __m512 derivative = _mm512_sub_ps(value, labels);
+    const __m512 log1p = _mm512_fmadd_ps(
+        _mm512_sub_ps(t, _mm512_sub_ps(u, one)), inverse, log(u));
+    const __m512 row_loss = _mm512_fnmadd_ps(
+        labels, z, _mm512_add_ps(_mm512_max_ps(z, zero), log1p));
+    _mm512_storeu_ps(sigm + index, value);
+    _mm512_storeu_ps(derivatives + index, derivative);
+    loss_acc = _mm512_add_pd(loss_acc, sum_halves(row_loss));
+    beta_acc = _mm512_add_pd(beta_acc, sum_halves(derivative));
+  }
+  loss += _mm512_reduce_add_pd(loss_acc);
+  beta_gradient += _mm512_reduce_add_pd(beta_acc);
+  for (; index < n; ++index) {
+    logistic_row(logits[index] + beta, gt[index], sigm[index],
+                 derivatives[index], loss);
+    beta_gradient += derivatives[index];
+  }
+}
+
+inline void sigmoid(const size_t n, const float *logits, const float beta,
+                    float *sigm) {
+  const __m512 beta_value = _mm512_set1_ps(beta);
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512 one = _mm512_set1_ps(1);
+  const __m512 abs_mask = _mm512_castsi512_ps(_mm512_set1_epi32(0x7FFFFFFF));
+  size_t index = 0;
+  for (; index + 16 <= n; index += 16) {
+    const __m512 z = _mm512_add_ps(_mm512_loadu_ps(logits + index), beta_value);
+    const __m512 t = exp(_mm512_sub_ps(zero, _mm512_and_ps(z, abs_mask)));
+    const __m512 inverse = _mm512_div_ps(one, _mm512_add_ps(one, t));
+    const __mmask16 negative = _mm512_cmp_ps_mask(z, zero, _CMP_LT_OQ);
+    _mm512_storeu_ps(sigm + index,
+                     _mm512_mask_mul_ps(inverse, negative, t, inverse));
+  }
+  for (; index < n; ++index) {
+    sigm[index] = sigmoid_row(logits[index] + beta);
+  }
+}
+
+inline void exp(const size_t n, float *values) {
+  size_t index = 0;
+  for (; index + 16 <= n; index += 16) {
+    _mm512_storeu_ps(values + index, exp(_mm512_loadu_ps(values + index)));
+  }
+  for (; index < n; ++index) {
+    values[index] = exp(values[index]);
+  }
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+inline __m256 exp(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(exp_lo)),
+                    _mm256_set1_ps(exp_hi));
+  const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(log2e)),
+                                   _MM_FROUND_TO_NEAREST_INT |
+                                       _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_hi), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_lo), r);
+  __m256 p = _mm256_set1_ps(exp_p0);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p1));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p2));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p3));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p4));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p5));
+  const __m256 y = _mm256_add_ps(
+      _mm256_fmadd_ps(_mm256_mul_ps(p, r), r, r), _mm256_set1_ps(1));
+  const __m256i scale = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(scale));
+}
+
+inline __m256 log(const __m256 x) {
+  const __m256i bits = _mm256_castps_si256(x);
+  __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+      _mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+  __m256 m = _mm256_castsi256_ps(
+      _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)),
+                      _mm256_set1_epi32(0x3F000000)));
+  const __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(sqrt_half), _CMP_LT_OQ);
+  e = _mm256_sub_ps(e, _mm256_and_ps(small, _mm256_set1_ps(1)));
+  m = _mm256_add_ps(m, _mm256_and_ps(small, m));
+  m = _mm256_sub_ps(m, _mm256_set1_ps(1));
+  const __m256 z = _mm256_mul_ps(m, m);
+  __m256 p = _mm256_set1_ps(log_p0);
+  p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(log_p1));
+  p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(log_p2));
+  p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(log_p3));
+  p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(log_p4));
+  p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(log_p5));
+  p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(log_p6));
+  p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(log_p7));
+  p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(log_p8));
+  __m256 y = _mm256_mul_ps(_mm256_mul_ps(p, m), z);
+  y = _mm256_fmadd_ps(e, _mm256_set1_ps(ln2_lo), y);
+  y = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, y);
+  return _mm256_fmadd_ps(e, _mm256_set1_ps(ln2_hi), _mm256_add_ps(m, y));
+}
+
+inline __m256d sum_halves(const __m256 value) {
+  return _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(value)),
+                       _mm256_cvtps_pd(_mm256_extractf128_ps(value, 1)));
+}
+
+inline double hsum(const __m256d value) {
+  const __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(value),
+                                 _mm256_extractf128_pd(value, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+inline void logistic(const size_t n, const float *logits, const float beta,
+                     const float *gt, float *sigm, float *derivatives,
+                     double &loss, double &beta_gradient) {
+  const __m256 beta_value = _mm256_set1_ps(beta);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1);
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  __m256d loss_acc = _mm256_setzero_pd();
+  __m256d beta_acc = _mm256_setzero_pd();
+  size_t index = 0;
+  for (; index + 8 <= n; index += 8) {
+    const __m256 z = _mm256_add_ps(_mm256_loadu_ps(logits + index), beta_value);
+    const __m256 labels = _mm256_loadu_ps(gt + index);
+    const __m256 t = exp(_mm256_sub_ps(zero, _mm256_and_ps(z, abs_mask)));
+    const __m256 u = _mm256_add_ps(one, t);
+    const __m256 inverse = _mm256_div_ps(one, u);
+    const __m256 negative = _mm256_cmp_ps(z, zero, _CMP_LT_OQ);
+    const __m256 value =
+        _mm256_blendv_ps(inverse, _mm256_mul_ps(t, inverse), negative);
+    const __m256 derivative = _mm256_sub_ps(value, labels);
+    const __m256 log1p = _mm256_fmadd_ps(
+        _mm256_sub_ps(t, _mm256_sub_ps(u, one)), inverse, log(u));
+    const __m256 row_loss = _mm256_fnmadd_ps(
+        labels, z, _mm256_add_ps(_mm256_max_ps(z, zero), log1p));
+    _mm256_storeu_ps(sigm + index, value);
+    _mm256_storeu_ps(derivatives + index, derivative);
+    loss_acc = _mm256_add_pd(loss_acc, sum_halves(row_loss));
+    beta_acc = _mm256_add_pd(beta_acc, sum_halves(derivative));
+  }
+  loss += hsum(loss_acc);
+  beta_gradient += hsum(beta_acc);
+  for (; index < n; ++index) {
+    logistic_row(logits[index] + beta, gt[index], sigm[index],
+                 derivatives[index], loss);
+    beta_gradient += derivatives[index];
+  }
+}
+
+inline void sigmoid(const size_t n, const float *logits, const float beta,
+                    float *sigm) {
+  const __m256 beta_value = _mm256_set1_ps(beta);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1);
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  size_t index = 0;
+  for (; index + 8 <= n; index += 8) {
+    const __m256 z = _mm256_add_ps(_mm256_loadu_ps(logits + index), beta_value);
+    const __m256 t = exp(_mm256_sub_ps(zero, _mm256_and_ps(z, abs_mask)));
+    const __m256 inverse = _mm256_div_ps(one, _mm256_add_ps(one, t));
+    const __m256 negative = _mm256_cmp_ps(z, zero, _CMP_LT_OQ);
+    _mm256_storeu_ps(sigm + index, _mm256_blendv_ps(
+                                       inverse, _mm256_mul_ps(t, inverse),
+                                       negative));
+  }
+  for (; index < n; ++index) {
+    sigm[index] = sigmoid_row(logits[index] + beta);
+  }
+}
+
+inline void exp(const size_t n, float *values) {
+  size_t index = 0;
+  for (; index + 8 <= n; index += 8) {
+    _mm256_storeu_ps(values + index, exp(_mm256_loadu_ps(values + index)));
+  }
+  for (; index < n; ++index) {
+    values[index] = exp(values[index]);
+  }
+}
+
+#endif
+
+} // namespace vmath
+
+#endif
@@ -0,0 +1,556 @@
+#ifndef WORKSPACE_HPP
+#define WORKSPACE_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include <tbb/tbb.h>
+
+#include "metrics.hpp"
+#include "reproducible.hpp"
+#include "structures.hpp"
+#include "tuning.hpp"
+
+template <typename FPType>
+using aligned_vector =
+    std::vector<FPType, tbb::cache_aligned_allocator<FPType>>;
+
+// Persistent state for the logreg kernels. Owns the results and the
+// per-thread accumulators/row-block buffers, so repeated calls with the same
+// workspace do not allocate, page-fault or zero tens of MB. Thread-local
+// buffers are created on the first call of each thread and reused afterwards.
+//
+// With materialize_sigm == false the kernels keep the sigmoid values only in
+// the thread-local row-block buffer and forward.sigm stays empty; use it when
+// only the loss and the gradient are needed.
+//
+// With track_quality == true the kernels also fill `quality` (metrics.hpp)
+// from the sigmoid values of each row block while it is in cache; the labels
+// are those passed to the pass.
+//
+// Blocks are sized from Meta::l2_cache_size, or from the detected L2 when it
+// is 0, and always hold at least one row. configure() switches to another
+// block size / partitioner, e.g. the one picked by the autotuner (see
+// dispatch.hpp).
+//
+// `reduction` selects how the kernels that loop with for_each_block() sum
+// the blocks (reproducible.hpp); COMP_OPT_DETERMINISTIC by default. The
+// deterministic modes keep deterministic_chunks partial gradients instead of
+// one per thread.
+template <typename FPType> class LogRegWorkspace {
+public:
+  struct ThreadLocal {
+    ThreadLocal(size_t columns_count, size_t rows_in_block)
+        : gradient(columns_count), sigm(rows_in_block),
+          derivatives(rows_in_block) {}
+
+    aligned_vector<FPType> gradient;
+    aligned_vector<FPType> sigm;
+    aligned_vector<FPType> derivatives;
+    // Sums over millions of rows: accumulated in double.
+    double beta_gradient = 0;
+    double logloss = 0;
+    metrics::Quality quality;
+  };
+  using TLS = tbb::enumerable_thread_specific<ThreadLocal>;
+
+  // Sums of one chunk of consecutive blocks in the deterministic modes.
+  // gradient is used by Mode::deterministic, sums by Mode::compensated;
+  // losses are plain sums (compensation 0) in Mode::deterministic.
+  struct Partial {
+    aligned_vector<FPType> gradient;
+    std::vector<reproducible::Compensated> sums;
+    reproducible::Compensated logloss;
+    reproducible::Compensated beta_gradient;
+  };
+
+  LogRegWorkspace(const Meta &meta, bool materialize_sigm = true)
+      : columns_count(meta.columns_count),
+        rows_in_block(tuning::default_block_rows(
+            meta.l2_cache_size, meta.columns_count, sizeof(FPType))),
+        materialize_sigm(materialize_sigm),
+        forward(materialize_sigm ? meta.rows_count : 0),
+        gradient(meta.columns_count), scaled_weights(meta.columns_count),
+        tls(ThreadLocal(meta.columns_count, rows_in_block)) {}
+
+  // Clear the results and accumulators before a new pass.
+  void reset_forward() {
+    forward.logloss = 0;
+    quality.clear();
+    for (auto &local : tls) {
+      local.logloss = 0;
+      local.quality.clear();
+    }
+    for (auto &partial : partials) {
+      partial.logloss = reproducible::Compensated();
+    }
+  }
+
+  void reset_gradient() {
+    std::fill(gradient.weights_gradient.begin(),
+              gradient.weights_gradient.end(), static_cast<FPType>(0));
+    gradient.beta_gradient = 0;
+    for (auto &local : tls) {
+      std::fill(local.gradient.begin(), local.gradient.end(),
+                static_cast<FPType>(0));
+      local.beta_gradient = 0;
+    }
+    for (auto &partial : partials) {
+      std::fill(partial.gradient.begin(), partial.gradient.end(),
+                static_cast<FPType>(0));
+      std::fill(partial.sums.begin(), partial.sums.end(),
+                reproducible::Compensated());
+      partial.beta_gradient = reproducible::Compensated();
+    }
+  }
+
+  void reset() {
+    reset_forward();
+    reset_gradient();
+  }
+
+  // Sum the thread-local accumulators into forward/gradient, in double. In
+  // the deterministic modes the chunk partials are summed in chunk order and
+  // the thread-local gradients and losses of for_each_block() kernels are 0.
+  void reduce_forward() {
+    double logloss =
+        forward.logloss +
+        sum_partials([](const Partial &partial) { return partial.logloss; });
+    for (auto &local : tls) {
+      logloss += local.logloss;
+      if (track_quality) {
+        quality.merge(local.quality);
+      }
+    }
+    forward.logloss = logloss;
+    quality.logloss = logloss;
+  }
+
+  // Parallel over column chunks, so wide gradients do not stall on the
+  // calling thread.
+  void reduce_gradient() {
+    reduce_gradient([](size_t, FPType) {});
+  }
+
+  // Also runs column_update(index, value) with the reduced gradient of every
+  // column, on the thread that reduced it, so that a training step
+  // (trainer.hpp) needs no second pass over the columns.
+  template <typename ColumnUpdate>
+  void reduce_gradient(const ColumnUpdate &column_update) {
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, columns_count, reduce_grain),
+        [&](tbb::blocked_range<size_t> r) {
+          for (size_t index = r.begin(); index < r.end(); ++index) {
+            double sum = gradient.weights_gradient[index];
+            if (reduction == reproducible::Mode::deterministic) {
+              sum += sum_partials([&](const Partial &partial) {
+                reproducible::Compensated value;
+                value.sum = partial.gradient[index];
+                return value;
+              });
+            } else if (reduction == reproducible::Mode::compensated) {
+              sum += sum_partials(
+                  [&](const Partial &partial) { return partial.sums[index]; });
+            }
+            if (thread_gradients) {
+              for (auto &local : tls) {
+                sum += local.gradient[index];
+              }
+            }
+            gradient.weights_gradient[index] = sum;
+            column_update(index, gradient.weights_gradient[index]);
+          }
+        });
+    double beta_gradient =
+        gradient.beta_gradient +
+        sum_partials(
+            [](const Partial &partial) { return partial.beta_gradient; });
+    for (auto &local : tls) {
+      beta_gradient += local.beta_gradient;
+    }
+    gradient.beta_gradient = beta_gradient;
+  }
+
+  void reduce() {
+    reduce_forward();
+    reduce_gradient();
+  }
+
+  // Resizes the thread-local block buffers, so call it between passes.
+  void configure(const tuning::Config &config) {
+    if (config.rows_in_block != rows_in_block) {
+      rows_in_block = config.rows_in_block;
+      tls = TLS(ThreadLocal(thread_gradients ? columns_count : 0,
+                            rows_in_block));
+    }
+    partitioner = config.partitioner;
+    tuned = true;
+  }
+
+  // Kernels that write `gradient` directly (the 2D path of
+  // logreg_tiled.hpp) turn the thread-local gradients off, so that no
+  // thread holds a columns_count copy. Call it between passes.
+  void use_thread_gradients(const bool enabled) {
+    if (enabled != thread_gradients) {
+      thread_gradients = enabled;
+      tls = TLS(ThreadLocal(enabled ? columns_count : 0, rows_in_block));
+    }
+  }
+
+  tuning::Config config() const {
+    return tuning::Config{rows_in_block, partitioner};
+  }
+
+  // Runs a kernel loop over row blocks with the configured partitioner.
+  template <typename Range, typename Body>
+  void parallel_for(const Range &range, const Body &body) {
+    tuning::parallel_for(range, body, partitioner, affinity);
+  }
+
+  bool deterministic() const {
+    return reduction != reproducible::Mode::fast;
+  }
+
+  // Runs body(block_index, local, gradient, logloss, beta_gradient) for the
+  // row blocks [0, blocks_count) of a pass. The body adds its block to the
+  // gradient (columns_count values) and the two sums it is given: the
+  // accumulators of the calling thread in fast mode, those of the block's
+  // chunk in the deterministic modes. local provides the block buffers and
+  // the quality accumulator.
+  //
+  // Chunks hold consecutive blocks and are run in parallel, the blocks of a
+  // chunk in order. In compensated mode every block is summed into
+  // local.gradient, then added to the chunk sums and zeroed.
+  template <typename Body>
+  void for_each_block(const size_t blocks_count, const Body &body) {
+    if (reduction == reproducible::Mode::fast) {
+      parallel_for(tbb::blocked_range<size_t>(0, blocks_count),
+                   [&](tbb::blocked_range<size_t> r) {
+                     ThreadLocal &local = tls.local();
+                     for (size_t block_index = r.begin();
+                          block_index < r.end(); ++block_index) {
+                       body(block_index, local, local.gradient.data(),
+                            local.logloss, local.beta_gradient);
+                     }
+                   });
+      return;
+    }
+    prepare_partials();
+    const size_t chunks_count = std::min(blocks_count, deterministic_chunks);
+    parallel_for(
+        tbb::blocked_range<size_t>(0, chunks_count, 1),
+        [&](tbb::blocked_range<size_t> r) {
+          ThreadLocal &local = tls.local();
+          for (size_t chunk = r.begin(); chunk < r.end(); ++chunk) {
+            Partial &partial = partials[chunk];
+            const size_t last_block = blocks_count * (chunk + 1) / chunks_count;
+            for (size_t block_index = blocks_count * chunk / chunks_count;
+                 block_index < last_block; ++block_index) {
+              if (reduction == reproducible::Mode::deterministic) {
+                body(block_index, local, partial.gradient.data(),
+                     partial.logloss.sum, partial.beta_gradient.sum);
+                continue;
+              }
+              double logloss = 0, beta_gradient = 0;
+              body(block_index, local, local.gradient.data(), logloss,
+                   beta_gradient);
+              partial.logloss.add(logloss);
+              partial.beta_gradient.add(beta_gradient);
+              for (size_t index = 0; index < columns_count; ++index) {
+                partial.sums[index].add(local.gradient[index]);
+                local.gradient[index] = 0;
+              }
+            }
+          }
+        });
+  }
+
+  // Where the kernels write the sigmoid of the rows starting at start_row.
+  FPType *sigm_block(ThreadLocal &local, size_t start_row) {
+    return materialize_sigm ? forward.sigm.data() + start_row
+                            : local.sigm.data();
+  }
+
+  static constexpr size_t reduce_grain = 4096;
+  // Fixed, so that the reduction tree does not depend on the thread count;
+  // machines with more threads than this run the deterministic modes with
+  // this many tasks.
+  static constexpr size_t deterministic_chunks = 64;
+
+  const size_t columns_count;
+  size_t rows_in_block;
+  tuning::Partitioner partitioner = tuning::Partitioner::static_partitioner;
+  tbb::affinity_partitioner affinity;
+  bool tuned = false;
+  // See use_thread_gradients().
+  bool thread_gradients = true;
+  // Change it between passes only.
+  reproducible::Mode reduction = reproducible::mode_from_env();
+  const bool materialize_sigm;
+  bool track_quality = false;
+  ForwardResult<FPType> forward;
+  // Filled by reduce_forward() when track_quality is set.
+  metrics::Quality quality;
+  GradientResult<FPType> gradient;
+  // Weights multiplied by the column scales of int8 features (precision.hpp).
+  aligned_vector<FPType> scaled_weights;
+  // Row-block buffers of kernels that parallelize inside a block
+  // (logreg_tiled.hpp); sized by the kernel on the first call.
+  aligned_vector<FPType> shared_sigm;
+  aligned_vector<FPType> shared_derivatives;
+  // Partial logits of a row block: one buffer per thread in fast mode, kept
+  // zero between blocks, and one per column tile in the deterministic modes.
+  tbb::enumerable_thread_specific<aligned_vector<FPType>> thread_logits;
+  aligned_vector<FPType> tile_logits;
+  TLS tls;
+  // Chunk partials of the deterministic modes, allocated on first use.
+  std::vector<Partial> partials;
+
+private:
+  void prepare_partials() {
+    partials.resize(deterministic_chunks);
+    for (Partial &partial : partials) {
+      if (reduction == reproducible::Mode::deterministic) {
+        partial.gradient.resize(columns_count, 0);
+      } else {
+        partial.sums.resize(columns_count);
+      }
+    }
+  }
+
+  // Sum of value(partial) over the chunks (reproducible::sum_chunks).
+  template <typename Value> double sum_partials(const Value &value) const {
+    return reproducible::sum_chunks(
+        reduction, partials.size(),
+        [&](size_t chunk) { return value(partials[chunk]); });
+  }
+};
+
+// Workspace of the kernels with K outputs per row (logreg_multi.hpp,
+// logreg_softmax.hpp). The
+// thread-local gradient is a columns x K matrix and the row-block buffer
+// holds rows_in_block x K logits; blocks are sized so that the data rows and
+// their logits fit in L2 together.
+//
+// `reduction` works as in LogRegWorkspace: the kernels loop with
+// for_each_block(), which keeps deterministic_chunks partials in the
+// deterministic modes.
+template <typename FPType> class MultiWorkspace {
+public:
+  struct ThreadLocal {
+    ThreadLocal(size_t columns_count, size_t outputs_count,
+                size_t rows_in_block)
+        : gradient(columns_count * outputs_count),
+          logits(rows_in_block * outputs_count), beta_gradient(outputs_count),
+          logloss(outputs_count) {}
+
+    aligned_vector<FPType> gradient;
+    aligned_vector<FPType> logits;
+    std::vector<double> beta_gradient;
+    std::vector<double> logloss;
+    // Rows skipped for labels that are not class indices (softmax).
+    size_t invalid_rows = 0;
+  };
+  using TLS = tbb::enumerable_thread_specific<ThreadLocal>;
+
+  // Sums of one chunk of consecutive blocks in the deterministic modes.
+  // Mode::deterministic uses gradient and losses (K logloss values, then K
+  // beta gradients); Mode::compensated uses sums, laid out as the gradient
+  // followed by the losses.
+  struct Partial {
+    aligned_vector<FPType> gradient;
+    std::vector<double> losses;
+    std::vector<reproducible::Compensated> sums;
+  };
+
+  MultiWorkspace(const Meta &meta, size_t outputs_count)
+      : columns_count(meta.columns_count), outputs_count(outputs_count),
+        rows_in_block(tuning::default_block_rows(
+            meta.l2_cache_size, meta.columns_count + outputs_count,
+            sizeof(FPType))),
+        result(meta.columns_count, outputs_count),
+        tls(ThreadLocal(meta.columns_count, outputs_count, rows_in_block)) {}
+
+  void reset() {
+    std::fill(result.logloss.begin(), result.logloss.end(),
+              static_cast<FPType>(0));
+    std::fill(result.weights_gradient.begin(), result.weights_gradient.end(),
+              static_cast<FPType>(0));
+    std::fill(result.beta_gradient.begin(), result.beta_gradient.end(),
+              static_cast<FPType>(0));
+    for (auto &local : tls) {
+      std::fill(local.gradient.begin(), local.gradient.end(),
+                static_cast<FPType>(0));
+      std::fill(local.beta_gradient.begin(), local.beta_gradient.end(), 0.);
+      std::fill(local.logloss.begin(), local.logloss.end(), 0.);
+      local.invalid_rows = 0;
+    }
+    for (auto &partial : partials) {
+      std::fill(partial.gradient.begin(), partial.gradient.end(),
+                static_cast<FPType>(0));
+      std::fill(partial.losses.begin(), partial.losses.end(), 0.);
+      std::fill(partial.sums.begin(), partial.sums.end(),
+                reproducible::Compensated());
+    }
+    invalid_rows = 0;
+  }
+
+  // Sum the thread-local accumulators into result, in double. In the
+  // deterministic modes the chunk partials are summed in chunk order and the
+  // thread-local gradients and losses are 0.
+  void reduce() {
+    const size_t gradient_size = result.weights_gradient.size();
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, gradient_size, reduce_grain),
+        [&](tbb::blocked_range<size_t> r) {
+          for (size_t index = r.begin(); index < r.end(); ++index) {
+            double sum = result.weights_gradient[index] +
+                         sum_partials(index, [&](const Partial &partial) {
+                           return partial.gradient[index];
+                         });
+            for (auto &local : tls) {
+              sum += local.gradient[index];
+            }
+            result.weights_gradient[index] = sum;
+          }
+        });
+    for (size_t output = 0; output < outputs_count; ++output) {
+      double logloss =
+          result.logloss[output] +
+          sum_partials(gradient_size + output, [&](const Partial &partial) {
+            return partial.losses[output];
+          });
+      double beta_gradient =
+          result.beta_gradient[output] +
+          sum_partials(gradient_size + outputs_count + output,
+                       [&](const Partial &partial) {
+                         return partial.losses[outputs_count + output];
+                       });
+      for (auto &local : tls) {
+        beta_gradient += local.beta_gradient[output];
+        logloss += local.logloss[output];
+      }
+      result.beta_gradient[output] = beta_gradient;
+      result.logloss[output] = logloss;
+    }
+    for (auto &local : tls) {
+      invalid_rows += local.invalid_rows;
+    }
+  }
+
+  // Runs a kernel loop over row blocks with the configured partitioner.
+  template <typename Range, typename Body>
+  void parallel_for(const Range &range, const Body &body) {
+    tuning::parallel_for(range, body, partitioner, affinity);
+  }
+
+  bool deterministic() const {
+    return reduction != reproducible::Mode::fast;
+  }
+
+  // Runs body(block_index, local, gradient, logloss, beta_gradient) for the
+  // row blocks [0, blocks_count) of a pass, as
+  // LogRegWorkspace::for_each_block(). The body adds its block to the
+  // gradient (columns x K values) and to the K logloss and beta gradient
+  // sums; local provides the logits buffer and counts invalid rows.
+  template <typename Body>
+  void for_each_block(const size_t blocks_count, const Body &body) {
+    if (reduction == reproducible::Mode::fast) {
+      parallel_for(tbb::blocked_range<size_t>(0, blocks_count),
+                   [&](tbb::blocked_range<size_t> r) {
+                     ThreadLocal &local = tls.local();
+                     for (size_t block_index = r.begin();
+                          block_index < r.end(); ++block_index) {
+                       body(block_index, local, local.gradient.data(),
+                            local.logloss.data(), local.beta_gradient.data());
+                     }
+                   });
+      return;
+    }
+    prepare_partials();
+    const size_t chunks_count = std::min(blocks_count, deterministic_chunks);
+    const size_t gradient_size = result.weights_gradient.size();
+    parallel_for(
+        tbb::blocked_range<size_t>(0, chunks_count, 1),
+        [&](tbb::blocked_range<size_t> r) {
+          ThreadLocal &local = tls.local();
+          for (size_t chunk = r.begin(); chunk < r.end(); ++chunk) {
+            Partial &partial = partials[chunk];
+            const size_t last_block = blocks_count * (chunk + 1) / chunks_count;
+            for (size_t block_index = blocks_count * chunk / chunks_count;
+                 block_index < last_block; ++block_index) {
+              if (reduction == reproducible::Mode::deterministic) {
+                body(block_index, local, partial.gradient.data(),
+                     partial.losses.data(),
+                     partial.losses.data() + outputs_count);
+                continue;
+              }
+              body(block_index, local, local.gradient.data(),
+                   local.logloss.data(), local.beta_gradient.data());
+              for (size_t index = 0; index < gradient_size; ++index) {
+                partial.sums[index].add(local.gradient[index]);
+                local.gradient[index] = 0;
+              }
+              for (size_t output = 0; output < outputs_count; ++output) {
+                partial.sums[gradient_size + output].add(
+                    local.logloss[output]);
+                partial.sums[gradient_size + outputs_count + output].add(
+                    local.beta_gradient[output]);
+                local.logloss[output] = 0;
+                local.beta_gradient[output] = 0;
+              }
+            }
+          }
+        });
+  }
+
+  static constexpr size_t reduce_grain = 4096;
+  static constexpr size_t deterministic_chunks =
+      LogRegWorkspace<FPType>::deterministic_chunks;
+
+  const size_t columns_count;
+  const size_t outputs_count;
+  const size_t rows_in_block;
+  tuning::Partitioner partitioner = tuning::Partitioner::static_partitioner;
+  tbb::affinity_partitioner affinity;
+  // Change it between passes only.
+  reproducible::Mode reduction = reproducible::mode_from_env();
+  MultiResult<FPType> result;
+  size_t invalid_rows = 0;
+  TLS tls;
+  // Chunk partials of the deterministic modes, allocated on first use.
+  std::vector<Partial> partials;
+
+private:
+  void prepare_partials() {
+    const size_t gradient_size = result.weights_gradient.size();
+    partials.resize(deterministic_chunks);
+    for (Partial &partial : partials) {
+      if (reduction == reproducible::Mode::deterministic) {
+        partial.gradient.resize(gradient_size, 0);
+        partial.losses.resize(2 * outputs_count, 0.);
+      } else {
+        partial.sums.resize(gradient_size + 2 * outputs_count);
+      }
+    }
+  }
+
+  // Sum over the chunks of the value at `index` of the sums layout:
+  // value(partial) in Mode::deterministic, partial.sums[index] in
+  // Mode::compensated.
+  template <typename Value>
+  double sum_partials(const size_t index, const Value &value) const {
+    return reproducible::sum_chunks(
+        reduction, partials.size(), [&](size_t chunk) {
+          const Partial &partial = partials[chunk];
+          if (reduction == reproducible::Mode::compensated) {
+            return partial.sums[index];
+          }
+          reproducible::Compensated plain;
+          plain.sum = value(partial);
+          return plain;
+        });
+  }
+};
+
+#endif